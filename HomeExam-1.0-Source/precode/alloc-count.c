@@ -0,0 +1,366 @@
+#include <arpa/inet.h>
+#include <pthread.h>
+#include <stdatomic.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+
+#include "l4sap.h"
+#include "maze.h"
+#include "maze-pipeline.h"
+
+/* Checks that the L4 layer, the maze solvers and the maze pipeline do
+ * not allocate memory per packet or per maze once they are running.
+ *
+ * The program is linked with -Wl,--wrap for malloc, calloc, realloc and
+ * aligned_alloc, so every call from the repo's own code goes through the
+ * counters below. Allocations inside the C library (e.g. for the stacks
+ * of new threads) are not counted.
+ *
+ * Every check runs twice, with a short and a long run, in a single
+ * process on localhost:
+ *   solver   - the same mazes solved again and again with one arena,
+ *              for every strategy and with dead-end filling;
+ *   l4       - ping-pong between an L4 client and an echo server thread,
+ *              in stop-and-wait and in window mode;
+ *   pipeline - mazePipelineRun against a maze server thread that answers
+ *              every request with the same maze.
+ * A check fails if the long run makes more allocations than the short
+ * one. The program returns 0 if all checks pass.
+ */
+
+static atomic_ulong allocations;
+
+void* __real_malloc( size_t size );
+void* __real_calloc( size_t count, size_t size );
+void* __real_realloc( void* p, size_t size );
+void* __real_aligned_alloc( size_t alignment, size_t size );
+
+void* __wrap_malloc( size_t size )
+{
+    atomic_fetch_add( &allocations, 1 );
+    return __real_malloc( size );
+}
+
+void* __wrap_calloc( size_t count, size_t size )
+{
+    atomic_fetch_add( &allocations, 1 );
+    return __real_calloc( count, size );
+}
+
+void* __wrap_realloc( void* p, size_t size )
+{
+    atomic_fetch_add( &allocations, 1 );
+    return __real_realloc( p, size );
+}
+
+void* __wrap_aligned_alloc( size_t alignment, size_t size )
+{
+    atomic_fetch_add( &allocations, 1 );
+    return __real_aligned_alloc( alignment, size );
+}
+
+void usage( const char* name )
+{
+    fprintf( stderr, "Usage: %s [-P <port>]\n"
+                     "       port - optional, first of the local ports to use (default 5760)\n",
+                     name );
+    exit( -1 );
+}
+
+/* ---------------------------------------------------------------- */
+/* solver                                                           */
+/* ---------------------------------------------------------------- */
+
+#define SOLVER_MAZES 3
+
+static const uint32_t solver_edges[SOLVER_MAZES] = { 64, 256, 1024 };
+
+typedef struct
+{
+    const char*  name;
+    MazeStrategy strategy;
+    int          threads;
+    unsigned     flags;
+} SolverMode;
+
+static const SolverMode solver_modes[] =
+{
+    { "solver bfs",          MAZE_BFS,          0, 0 },
+    { "solver bfs+mask",     MAZE_BFS,          0, MAZE_OPT_PASSMASK },
+    { "solver bfs+dead",     MAZE_BFS,          0, MAZE_OPT_DEADEND },
+    { "solver bidir",        MAZE_BIDIR_BFS,    0, 0 },
+    { "solver astar",        MAZE_ASTAR,        0, MAZE_OPT_PASSMASK },
+    { "solver parallel",     MAZE_PARALLEL_BFS, 2, 0 },
+    { "solver parallel+dead", MAZE_PARALLEL_BFS, 2, MAZE_OPT_DEADEND }
+};
+
+/* Solves every maze rounds times with one arena, starting each time
+ * from the unsolved cells in original. Returns the number of
+ * allocations, or -1 if a maze had no path.
+ */
+static long solver_run( const SolverMode* mode, Maze** mazes, char** original, int rounds )
+{
+    unsigned long before = atomic_load( &allocations );
+
+    MazeArena*  arena   = mazeArenaCreate( 0 );
+    MazeOptions options = { .strategy = mode->strategy, .threads = mode->threads,
+                            .flags = mode->flags, .arena = arena };
+    if( arena == NULL ) return -1;
+
+    int failed = 0;
+    for( int r = 0; r < rounds; r++ )
+    {
+        for( int m = 0; m < SOLVER_MAZES; m++ )
+        {
+            memcpy( mazes[m]->maze, original[m], mazes[m]->size );
+            if( mazeSolveWith( mazes[m], &options, NULL ) < 0 ) failed = 1;
+            mazeArenaReset( arena );
+        }
+    }
+    mazeArenaDestroy( arena );
+
+    if( failed ) return -1;
+    return (long)( atomic_load( &allocations ) - before );
+}
+
+/* ---------------------------------------------------------------- */
+/* l4                                                               */
+/* ---------------------------------------------------------------- */
+
+/* Answers every packet with the same payload until "QUIT" or an error.
+ */
+static void* echo_server( void* arg )
+{
+    L4SAP*  l4 = (L4SAP*)arg;
+    uint8_t buffer[L4Payloadsize];
+    while( 1 )
+    {
+        int len = l4sap_recv( l4, buffer, L4Payloadsize );
+        if( len < 0 ) break;
+        if( len == 5 && memcmp( buffer, "QUIT", 5 ) == 0 ) break;
+        if( l4sap_send( l4, buffer, len ) < 0 ) break;
+    }
+    return NULL;
+}
+
+/* Sends count messages to an echo server and waits for every answer.
+ * Returns the number of allocations, from creating both entities to
+ * destroying them, or -1 on error.
+ */
+static long l4_run( int port, int window, int count )
+{
+    unsigned long before = atomic_load( &allocations );
+
+    L4SAP* server = l4sap_server_create( port );
+    if( server == NULL ) return -1;
+    if( window > 1 ) l4sap_set_window( server, window );
+
+    pthread_t thread;
+    if( pthread_create( &thread, NULL, echo_server, server ) != 0 )
+    {
+        l4sap_destroy( server );
+        return -1;
+    }
+
+    L4SAP* client = l4sap_create( "127.0.0.1", port );
+    if( client == NULL )
+    {
+        fprintf( stderr, "%s: Failed to create the client\n", __FUNCTION__ );
+        exit( -1 );
+    }
+    if( window > 1 ) l4sap_set_window( client, window );
+
+    uint8_t data[L4Payloadsize];
+    uint8_t buffer[L4Payloadsize];
+    memset( data, 0xa5, sizeof(data) );
+
+    int failed = 0;
+    for( int i = 0; i < count && !failed; i++ )
+    {
+        if( l4sap_send( client, data, sizeof(data) ) < 0 ) failed = 1;
+        else if( l4sap_recv( client, buffer, sizeof(buffer) ) < 0 ) failed = 1;
+    }
+
+    l4sap_send( client, (uint8_t*)"QUIT", 5 );
+    l4sap_destroy( client );
+    pthread_join( thread, NULL );
+    l4sap_destroy( server );
+
+    if( failed ) return -1;
+    return (long)( atomic_load( &allocations ) - before );
+}
+
+/* ---------------------------------------------------------------- */
+/* pipeline                                                         */
+/* ---------------------------------------------------------------- */
+
+typedef struct
+{
+    L4SAP*      l4;
+    const char* maze;
+    int         len;
+} MazeServer;
+
+/* Answers every "MAZE <seed>" with the same maze and ignores the
+ * solutions, like maze-server, until "QUIT".
+ */
+static void* maze_server( void* arg )
+{
+    MazeServer* server = (MazeServer*)arg;
+    uint8_t     buffer[L4Payloadsize];
+    while( 1 )
+    {
+        int len = l4sap_recv( server->l4, buffer, L4Payloadsize );
+        if( len < 0 ) break;
+        if( len == 5 && memcmp( buffer, "QUIT", 5 ) == 0 ) break;
+        if( len > 5 && memcmp( buffer, "MAZE ", 5 ) == 0 &&
+            l4sap_send( server->l4, (const uint8_t*)server->maze, server->len ) < 0 ) break;
+    }
+    return NULL;
+}
+
+/* Runs the pipeline for count mazes. Returns the number of allocations,
+ * from creating both entities to destroying them, or -1 on error.
+ */
+static long pipeline_run( int port, const char* maze, int len, const long* seeds, int count )
+{
+    unsigned long before = atomic_load( &allocations );
+
+    MazeServer server = { l4sap_server_create( port ), maze, len };
+    if( server.l4 == NULL ) return -1;
+
+    pthread_t thread;
+    if( pthread_create( &thread, NULL, maze_server, &server ) != 0 )
+    {
+        l4sap_destroy( server.l4 );
+        return -1;
+    }
+
+    L4SAP* client = l4sap_create( "127.0.0.1", port );
+    if( client == NULL )
+    {
+        fprintf( stderr, "%s: Failed to create the client\n", __FUNCTION__ );
+        exit( -1 );
+    }
+
+    MazePipelineConfig config = { { .strategy = MAZE_BFS }, 1, 4, NULL };
+    MazePipelineStats  stats;
+    int result = mazePipelineRun( client, seeds, count, &config, &stats );
+
+    l4sap_destroy( client );
+    pthread_join( thread, NULL );
+    l4sap_destroy( server.l4 );
+
+    if( result != 0 || stats.solved != count ) return -1;
+    return (long)( atomic_load( &allocations ) - before );
+}
+
+/* ---------------------------------------------------------------- */
+
+/* Prints one line for a check and returns 1 if it passed.
+ */
+static int report( const char* name, int shortRun, long shortCount, int longRun, long longCount )
+{
+    int ok = shortCount >= 0 && longCount >= 0 && longCount <= shortCount;
+    printf( "%-22s %5d: %6ld allocations  %5d: %6ld allocations  %s\n",
+            name, shortRun, shortCount, longRun, longCount, ok ? "ok" : "FAIL" );
+    return ok;
+}
+
+int main( int argc, char *argv[] )
+{
+    int port = 5760;
+    int opt;
+    while( ( opt = getopt( argc, argv, "P:" ) ) != -1 )
+    {
+        switch( opt )
+        {
+        case 'P' :
+            port = atoi( optarg );
+            break;
+        default :
+            usage( argv[0] );
+        }
+    }
+    if( argc - optind != 0 || port < 1 ) usage( argv[0] );
+
+    /* A lost packet on localhost is not expected, but would make a check
+     * hang until L4 gives up. Stop long before that.
+     */
+    alarm( 120 );
+
+    int passed = 0;
+    int checks = 0;
+
+    Maze* mazes[SOLVER_MAZES];
+    char* original[SOLVER_MAZES];
+    for( int m = 0; m < SOLVER_MAZES; m++ )
+    {
+        mazes[m]    = mazeGenerate( solver_edges[m], m + 1 );
+        original[m] = mazes[m] != NULL ? (char*)malloc( mazes[m]->size ) : NULL;
+        if( original[m] == NULL )
+        {
+            fprintf( stderr, "%s: Out of memory\n", __FUNCTION__ );
+            return -1;
+        }
+        memcpy( original[m], mazes[m]->maze, mazes[m]->size );
+    }
+
+    for( size_t i = 0; i < sizeof(solver_modes) / sizeof(solver_modes[0]); i++ )
+    {
+        const SolverMode* mode = &solver_modes[i];
+        long a = solver_run( mode, mazes, original, 2 );
+        long b = solver_run( mode, mazes, original, 20 );
+        passed += report( mode->name, 2, a, 20, b );
+        checks++;
+    }
+
+    for( int m = 0; m < SOLVER_MAZES; m++ )
+    {
+        free( mazes[m]->maze );
+        free( mazes[m] );
+        free( original[m] );
+    }
+
+    const int windows[] = { 1, 8 };
+    for( int w = 0; w < 2; w++ )
+    {
+        char name[32];
+        snprintf( name, sizeof(name), "l4 window %d", windows[w] );
+        long a = l4_run( port++, windows[w], 200 );
+        long b = l4_run( port++, windows[w], 2000 );
+        passed += report( name, 200, a, 2000, b );
+        checks++;
+    }
+
+    /* A maze that fits into one L4 packet, in the wire format */
+    Maze* maze = mazeGenerate( 28, 1 );
+    char  wire[L4Payloadsize];
+    long* seeds = (long*)malloc( 200 * sizeof(long) );
+    if( maze == NULL || seeds == NULL )
+    {
+        fprintf( stderr, "%s: Out of memory\n", __FUNCTION__ );
+        return -1;
+    }
+    uint32_t header[6] = { htonl( maze->edgeLen ), htonl( maze->size ),
+                           htonl( maze->startX ), htonl( maze->startY ),
+                           htonl( maze->endX ), htonl( maze->endY ) };
+    memcpy( wire, header, MAZE_HEADER_LEN );
+    memcpy( &wire[MAZE_HEADER_LEN], maze->maze, maze->size );
+    int len = (int)( maze->size + MAZE_HEADER_LEN );
+    for( int i = 0; i < 200; i++ ) seeds[i] = i + 1;
+
+    long a = pipeline_run( port++, wire, len, seeds, 20 );
+    long b = pipeline_run( port++, wire, len, seeds, 200 );
+    passed += report( "pipeline", 20, a, 200, b );
+    checks++;
+
+    free( seeds );
+    free( maze->maze );
+    free( maze );
+
+    printf( "%d of %d checks passed\n", passed, checks );
+    return passed == checks ? 0 : 1;
+}
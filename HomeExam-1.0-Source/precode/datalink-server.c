@@ -0,0 +1,87 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+
+#include "l2sap.h"
+
+/* A native counterpart to datalink-test-server. It answers every frame
+ * from datalink-test-client with "Dummy response: <payload>", and stops
+ * after a frame with the payload "QUIT" or after the given number of
+ * frames.
+ */
+
+void usage( const char* name )
+{
+    fprintf( stderr, "Usage: %s [-n <frames>] [-c] <port>\n"
+                     "       frames - optional, stop after this many frames (default: never)\n"
+                     "       -c     - optional, answer with CRC32C instead of XOR checksums\n"
+                     "       port   - This server's port\n", name );
+    exit( -1 );
+}
+
+int main( int argc, char *argv[] )
+{
+    int frames   = 0;
+    int checksum = L2_CHECKSUM_XOR;
+    int opt;
+    while( ( opt = getopt( argc, argv, "n:c" ) ) != -1 )
+    {
+        switch( opt )
+        {
+        case 'n' :
+            frames = atoi( optarg );
+            break;
+        case 'c' :
+            checksum = L2_CHECKSUM_CRC32C;
+            break;
+        default :
+            usage( argv[0] );
+        }
+    }
+
+    if( argc - optind != 1 ) usage( argv[0] );
+
+    L2SAP* l2 = l2sap_server_create( atoi(argv[optind]) );
+    if( !l2 )
+    {
+        fprintf( stderr, "%s: Failed to create server on port %s\n", __FUNCTION__, argv[optind] );
+        return -1;
+    }
+    l2sap_set_checksum( l2, checksum );
+
+    for( int round = 0; frames == 0 || round < frames; round++ )
+    {
+        char buffer[L2Framesize];
+        char response[L2Payloadsize];
+
+        fprintf( stderr, "\n%s: Waiting for data, round %d\n\n", __FUNCTION__, round );
+
+        int len = l2sap_recvfrom( l2, (uint8_t*)buffer, L2Framesize );
+        if( len < 0 )
+        {
+            fprintf( stderr, "%s: Dropped a frame with a bad header or checksum.\n", __FUNCTION__ );
+            continue;
+        }
+        buffer[len] = 0;
+
+        fprintf( stderr, "%s: Received %d bytes of data.\n", __FUNCTION__, len );
+
+        if( strcmp( buffer, "QUIT" ) == 0 ) break;
+
+        /* The response must fit in one L2 payload, so long frames are
+         * cut to leave room for the prefix.
+         */
+        int room = (int)sizeof(response) - (int)strlen( "Dummy response: " ) - 1;
+        snprintf( response, sizeof(response), "Dummy response: %.*s", room, buffer );
+        fprintf( stderr, "%s: Sending buffer: %s\n", __FUNCTION__, response );
+
+        if( l2sap_sendto( l2, (uint8_t*)response, strlen(response)+1 ) < 0 )
+        {
+            fprintf( stderr, "%s: Failed to send response\n", __FUNCTION__ );
+        }
+    }
+
+    l2sap_destroy( l2 );
+    return 0;
+}
@@ -2,6 +2,8 @@
 #include <stdlib.h>
 #include <string.h>
 #include <sys/select.h>
+#include <sys/time.h>
+#include <unistd.h>
 
 #include "l2sap.h"
 
@@ -13,21 +15,153 @@ static int maxi( int a, int b )
 
 void usage( const char* name )
 {
-    fprintf( stderr, "Usage: %s <serverip> <port>\n"
+    fprintf( stderr, "Usage: %s [-b <frames>] [-c] <serverip> <port>\n"
+                     "       frames   - optional, measure frames/sec for this many frames\n"
+                     "                  with and without batching instead of the normal test\n"
+                     "       -c       - optional, send frames with CRC32C instead of XOR checksums\n"
                      "       serverip - IPv4 address of the server in dotted decimal notation\n"
                      "       port     - The server's port\n" , name );
     exit( -1 );
 }
 
+static double elapsed( const struct timeval* start )
+{
+    struct timeval now;
+    gettimeofday( &now, NULL );
+    return ( now.tv_sec - start->tv_sec ) + ( now.tv_usec - start->tv_usec ) / 1e6;
+}
+
+/* Frames that were dropped for a bad checksum or a short header */
+static uint64_t bad_frames( const L2SAP* l2 )
+{
+    L2Stats stats;
+    l2sap_get_stats( l2, &stats );
+    return stats.checksum_errors + stats.short_frames;
+}
+
+/* Send frames frames of payload size len, one syscall per frame or
+ * L2MaxBatch frames per syscall, then drain whatever the server answers
+ * until it has been quiet for 100 ms, in the same way. Most answers are
+ * queued on the socket by then, so the receive rate is that of the
+ * receive calls. It is timed up to the last frame, without the quiet
+ * period at the end.
+ */
+static void bench( L2SAP* l2, int frames, int len, int batched )
+{
+    uint8_t payload[L2Payloadsize];
+    memset( payload, 'x', len );
+
+    struct iovec iov[L2MaxBatch];
+    for( int i=0; i<L2MaxBatch; i++ )
+    {
+        iov[i].iov_base = payload;
+        iov[i].iov_len  = len;
+    }
+
+    struct timeval start;
+    gettimeofday( &start, NULL );
+
+    int sent = 0;
+    while( sent < frames )
+    {
+        if( batched )
+        {
+            int n = frames - sent;
+            if( n > L2MaxBatch ) n = L2MaxBatch;
+            int error = l2sap_sendto_batch( l2, iov, n );
+            if( error < 0 ) break;
+            sent += error;
+        }
+        else
+        {
+            if( l2sap_sendto( l2, payload, len ) < 0 ) break;
+            sent++;
+        }
+    }
+    double send_time = elapsed( &start );
+
+    static uint8_t buffer[L2MaxBatch*L2Framesize];
+    int lens[L2MaxBatch];
+    int received = 0;
+    int invalid  = 0;
+    double recv_time = 0.0;
+
+    gettimeofday( &start, NULL );
+    while( 1 )
+    {
+        struct timeval tv;
+        tv.tv_sec  = 0;
+        tv.tv_usec = 100000;
+        if( batched )
+        {
+            int n = l2sap_recvfrom_batch( l2, buffer, L2MaxBatch, lens, &tv );
+            if( n <= 0 ) break;
+            for( int i=0; i<n; i++ )
+            {
+                if( lens[i] >= 0 ) received++;
+                else invalid++;
+            }
+        }
+        else
+        {
+            uint64_t bad = bad_frames( l2 );
+            int n = l2sap_recvfrom_timeout( l2, buffer, L2Framesize, &tv );
+            if( n == L2_TIMEOUT ) break;
+            if( n < 0 )
+            {
+                /* A socket error is not a dropped frame and would repeat */
+                if( bad_frames( l2 ) == bad ) break;
+                invalid++;
+            }
+            else received++;
+        }
+        recv_time = elapsed( &start );
+    }
+
+    fprintf( stderr, "%s: %-9s sent %d frames in %.3f s (%.0f frames/sec)\n",
+             __FUNCTION__, batched ? "batched" : "unbatched",
+             sent, send_time, sent / send_time );
+    fprintf( stderr, "%s: %-9s received %d frames in %.3f s (%.0f frames/sec), %d invalid\n",
+             __FUNCTION__, batched ? "batched" : "unbatched",
+             received, recv_time, recv_time > 0.0 ? received / recv_time : 0.0, invalid );
+}
+
 int main( int argc, char *argv[] )
 {
-    if( argc != 3 ) usage( argv[0] );
+    int bench_frames = 0;
+    int checksum     = L2_CHECKSUM_XOR;
+    int opt;
+    while( ( opt = getopt( argc, argv, "b:c" ) ) != -1 )
+    {
+        switch( opt )
+        {
+        case 'b' :
+            bench_frames = atoi( optarg );
+            break;
+        case 'c' :
+            checksum = L2_CHECKSUM_CRC32C;
+            break;
+        default :
+            usage( argv[0] );
+        }
+    }
+
+    if( argc - optind != 2 ) usage( argv[0] );
 
-    struct L2SAP* l2 = l2sap_create( argv[1], atoi(argv[2]) );
+    struct L2SAP* l2 = l2sap_create( argv[optind], atoi(argv[optind+1]) );
     if( !l2 ) {
         fprintf( stderr, "Failed to create server\n" );
         return -1;
     }
+    l2sap_set_checksum( l2, checksum );
+
+    if( bench_frames > 0 )
+    {
+        bench( l2, bench_frames, 64, 0 );
+        bench( l2, bench_frames, 64, 1 );
+        l2sap_destroy( l2 );
+        return 0;
+    }
 
     for( int i=0; i<25; i++ )
     {
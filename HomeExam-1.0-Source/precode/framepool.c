@@ -0,0 +1,82 @@
+#include <stdlib.h>
+
+#include "framepool.h"
+#include "log.h"
+
+#define FRAMEPOOL_ALIGN 64
+
+// Ny topp med neste teller, så en gammel kopi av toppen ikke matcher
+static inline uint64_t pool_head(uint64_t old, uint32_t top) {
+    return ((old >> 32) + 1) << 32 | top;
+}
+
+FramePool* framepool_create(size_t frame_size, uint32_t count) {
+    if (count == 0 || frame_size == 0) {
+        return NULL;
+    }
+
+    FramePool* pool = malloc(sizeof(FramePool));
+    if (pool == NULL) {
+        LOG_ERROR("Error mallocing frame pool\n");
+        return NULL;
+    }
+
+    // Rundes opp til hele cache-linjer, så to tråder som skriver i hvert
+    // sitt buffer ikke deler linje
+    pool->frame_size = (frame_size + FRAMEPOOL_ALIGN - 1) & ~(size_t)(FRAMEPOOL_ALIGN - 1);
+    pool->count = count;
+    pool->next = malloc(count * sizeof(_Atomic uint32_t));
+    pool->frames = aligned_alloc(FRAMEPOOL_ALIGN, pool->frame_size * count);
+    if (pool->next == NULL || pool->frames == NULL) {
+        LOG_ERROR("Error mallocing %u frames of %zu bytes\n", count, pool->frame_size);
+        framepool_destroy(pool);
+        return NULL;
+    }
+
+    // Alle er ledige: 0 øverst, så 1, 2, ...
+    for (uint32_t i = 0; i < count; i++) {
+        atomic_init(&pool->next[i], i + 1 < count ? i + 2 : 0);
+    }
+    atomic_init(&pool->head, 1);
+    return pool;
+}
+
+void* framepool_get(FramePool* pool) {
+    uint64_t head = atomic_load_explicit(&pool->head, memory_order_acquire);
+    while (1) {
+        uint32_t top = (uint32_t)head;
+        if (top == 0) {
+            return NULL;
+        }
+
+        // next kan endres av en annen tråd som tok det samme bufferet
+        // først, men da har telleren i toppen endret seg og CAS feiler
+        uint32_t next = atomic_load_explicit(&pool->next[top - 1], memory_order_relaxed);
+        if (atomic_compare_exchange_weak_explicit(&pool->head, &head, pool_head(head, next),
+                                                  memory_order_acquire, memory_order_acquire)) {
+            return pool->frames + (size_t)(top - 1) * pool->frame_size;
+        }
+    }
+}
+
+void framepool_put(FramePool* pool, void* frame) {
+    if (frame == NULL) {
+        return;
+    }
+    uint32_t index = (uint32_t)(((uint8_t*)frame - pool->frames) / pool->frame_size);
+
+    uint64_t head = atomic_load_explicit(&pool->head, memory_order_relaxed);
+    do {
+        atomic_store_explicit(&pool->next[index], (uint32_t)head, memory_order_relaxed);
+    } while (!atomic_compare_exchange_weak_explicit(&pool->head, &head, pool_head(head, index + 1),
+                                                    memory_order_release, memory_order_relaxed));
+}
+
+void framepool_destroy(FramePool* pool) {
+    if (pool == NULL) {
+        return;
+    }
+    free((void*)pool->next);
+    free(pool->frames);
+    free(pool);
+}
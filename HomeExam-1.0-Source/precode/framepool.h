@@ -0,0 +1,44 @@
+#ifndef FRAMEPOOL_H
+#define FRAMEPOOL_H
+
+#include <stddef.h>
+#include <stdint.h>
+#include <stdatomic.h>
+
+/* Et fast antall like store buffere, allokert én gang i
+ * framepool_create. framepool_get og framepool_put kaller aldri malloc
+ * og er låsefrie, så én tråd kan ta et buffer og en annen gi det
+ * tilbake (som mellom trinnene i maze-pipeline).
+ *
+ * De ledige bufferne ligger i en stakk (Treiber). Toppen er 64 bit:
+ * lave 32 bit er indeksen + 1 (0 betyr tom), og høye 32 bit er en
+ * teller som økes ved hver endring, så en CAS ikke lykkes om toppen
+ * har vært tatt og lagt tilbake i mellomtiden (ABA).
+ */
+typedef struct FramePool FramePool;
+
+struct FramePool
+{
+    _Atomic uint64_t  head;
+    _Atomic uint32_t* next;       // next[i]: indeks + 1 under buffer i i stakken
+    uint8_t*          frames;
+    size_t            frame_size; // rundet opp til en cache-linje
+    uint32_t          count;
+};
+
+/* Lager en pool med count buffere på minst frame_size bytes hver.
+ * Bufferne er justert til 64 bytes. Returnerer NULL om minnet ikke
+ * strekker til.
+ */
+FramePool* framepool_create( size_t frame_size, uint32_t count );
+
+/* Tar et ledig buffer, eller NULL om alle er i bruk. */
+void* framepool_get( FramePool* pool );
+
+/* Gir tilbake et buffer fra framepool_get. NULL ignoreres. */
+void framepool_put( FramePool* pool, void* frame );
+
+/* Frigjør poolen og alle bufferne, også de som ikke er gitt tilbake. */
+void framepool_destroy( FramePool* pool );
+
+#endif
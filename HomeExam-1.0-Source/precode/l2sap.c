@@ -1,19 +1,212 @@
+#define _GNU_SOURCE // sendmmsg og recvmmsg
+
 #include <stdio.h>
 #include <string.h>
 #include <stdlib.h>
 #include <unistd.h>
 #include <arpa/inet.h>
+#include <errno.h>
+#include <fcntl.h>
 
 
 #include "l2sap.h"
+#include "log.h"
+
+ // XOR av alle bytes er uavhengig av posisjon, så vi kan XOR-e 8 bytes
+ // om gangen og brette resultatet ned til én byte til slutt. Gir samme
+ // checksum som å gå gjennom rammen byte for byte.
+static uint32_t xor_update( uint32_t state, const uint8_t* data, int len ) {
+    uint64_t acc = 0;
+    int i = 0;
+    for (; i + 8 <= len; i += 8) {
+        uint64_t word;
+        memcpy(&word, data + i, sizeof(word));
+        acc ^= word;
+    }
+    for (; i < len; i++) {
+        acc ^= data[i];
+    }
+    acc ^= acc >> 32;
+    acc ^= acc >> 16;
+    acc ^= acc >> 8;
+    return state ^ (uint8_t)acc;
+}
 
- // compute_checksum beregner checksum av rammen ved en XOR-operasjon
-static uint8_t compute_checksum( const uint8_t* frame, int len ) {
-    uint8_t checksum = 0;
+/* CRC32C (Castagnoli). Bruker crc32-instruksjonen fra SSE4.2 når CPU-en
+ * har den, ellers en tabell med én byte per oppslag. Tabellen for
+ * polynomet 0x82F63B78 (reflektert) er regnet ut på forhånd, så den er
+ * konstant og trygg å lese fra flere tråder samtidig.
+ */
+static const uint32_t crc32c_table[256] = {
+    0x00000000, 0xf26b8303, 0xe13b70f7, 0x1350f3f4, 0xc79a971f, 0x35f1141c,
+    0x26a1e7e8, 0xd4ca64eb, 0x8ad958cf, 0x78b2dbcc, 0x6be22838, 0x9989ab3b,
+    0x4d43cfd0, 0xbf284cd3, 0xac78bf27, 0x5e133c24, 0x105ec76f, 0xe235446c,
+    0xf165b798, 0x030e349b, 0xd7c45070, 0x25afd373, 0x36ff2087, 0xc494a384,
+    0x9a879fa0, 0x68ec1ca3, 0x7bbcef57, 0x89d76c54, 0x5d1d08bf, 0xaf768bbc,
+    0xbc267848, 0x4e4dfb4b, 0x20bd8ede, 0xd2d60ddd, 0xc186fe29, 0x33ed7d2a,
+    0xe72719c1, 0x154c9ac2, 0x061c6936, 0xf477ea35, 0xaa64d611, 0x580f5512,
+    0x4b5fa6e6, 0xb93425e5, 0x6dfe410e, 0x9f95c20d, 0x8cc531f9, 0x7eaeb2fa,
+    0x30e349b1, 0xc288cab2, 0xd1d83946, 0x23b3ba45, 0xf779deae, 0x05125dad,
+    0x1642ae59, 0xe4292d5a, 0xba3a117e, 0x4851927d, 0x5b016189, 0xa96ae28a,
+    0x7da08661, 0x8fcb0562, 0x9c9bf696, 0x6ef07595, 0x417b1dbc, 0xb3109ebf,
+    0xa0406d4b, 0x522bee48, 0x86e18aa3, 0x748a09a0, 0x67dafa54, 0x95b17957,
+    0xcba24573, 0x39c9c670, 0x2a993584, 0xd8f2b687, 0x0c38d26c, 0xfe53516f,
+    0xed03a29b, 0x1f682198, 0x5125dad3, 0xa34e59d0, 0xb01eaa24, 0x42752927,
+    0x96bf4dcc, 0x64d4cecf, 0x77843d3b, 0x85efbe38, 0xdbfc821c, 0x2997011f,
+    0x3ac7f2eb, 0xc8ac71e8, 0x1c661503, 0xee0d9600, 0xfd5d65f4, 0x0f36e6f7,
+    0x61c69362, 0x93ad1061, 0x80fde395, 0x72966096, 0xa65c047d, 0x5437877e,
+    0x4767748a, 0xb50cf789, 0xeb1fcbad, 0x197448ae, 0x0a24bb5a, 0xf84f3859,
+    0x2c855cb2, 0xdeeedfb1, 0xcdbe2c45, 0x3fd5af46, 0x7198540d, 0x83f3d70e,
+    0x90a324fa, 0x62c8a7f9, 0xb602c312, 0x44694011, 0x5739b3e5, 0xa55230e6,
+    0xfb410cc2, 0x092a8fc1, 0x1a7a7c35, 0xe811ff36, 0x3cdb9bdd, 0xceb018de,
+    0xdde0eb2a, 0x2f8b6829, 0x82f63b78, 0x709db87b, 0x63cd4b8f, 0x91a6c88c,
+    0x456cac67, 0xb7072f64, 0xa457dc90, 0x563c5f93, 0x082f63b7, 0xfa44e0b4,
+    0xe9141340, 0x1b7f9043, 0xcfb5f4a8, 0x3dde77ab, 0x2e8e845f, 0xdce5075c,
+    0x92a8fc17, 0x60c37f14, 0x73938ce0, 0x81f80fe3, 0x55326b08, 0xa759e80b,
+    0xb4091bff, 0x466298fc, 0x1871a4d8, 0xea1a27db, 0xf94ad42f, 0x0b21572c,
+    0xdfeb33c7, 0x2d80b0c4, 0x3ed04330, 0xccbbc033, 0xa24bb5a6, 0x502036a5,
+    0x4370c551, 0xb11b4652, 0x65d122b9, 0x97baa1ba, 0x84ea524e, 0x7681d14d,
+    0x2892ed69, 0xdaf96e6a, 0xc9a99d9e, 0x3bc21e9d, 0xef087a76, 0x1d63f975,
+    0x0e330a81, 0xfc588982, 0xb21572c9, 0x407ef1ca, 0x532e023e, 0xa145813d,
+    0x758fe5d6, 0x87e466d5, 0x94b49521, 0x66df1622, 0x38cc2a06, 0xcaa7a905,
+    0xd9f75af1, 0x2b9cd9f2, 0xff56bd19, 0x0d3d3e1a, 0x1e6dcdee, 0xec064eed,
+    0xc38d26c4, 0x31e6a5c7, 0x22b65633, 0xd0ddd530, 0x0417b1db, 0xf67c32d8,
+    0xe52cc12c, 0x1747422f, 0x49547e0b, 0xbb3ffd08, 0xa86f0efc, 0x5a048dff,
+    0x8ecee914, 0x7ca56a17, 0x6ff599e3, 0x9d9e1ae0, 0xd3d3e1ab, 0x21b862a8,
+    0x32e8915c, 0xc083125f, 0x144976b4, 0xe622f5b7, 0xf5720643, 0x07198540,
+    0x590ab964, 0xab613a67, 0xb831c993, 0x4a5a4a90, 0x9e902e7b, 0x6cfbad78,
+    0x7fab5e8c, 0x8dc0dd8f, 0xe330a81a, 0x115b2b19, 0x020bd8ed, 0xf0605bee,
+    0x24aa3f05, 0xd6c1bc06, 0xc5914ff2, 0x37faccf1, 0x69e9f0d5, 0x9b8273d6,
+    0x88d28022, 0x7ab90321, 0xae7367ca, 0x5c18e4c9, 0x4f48173d, 0xbd23943e,
+    0xf36e6f75, 0x0105ec76, 0x12551f82, 0xe03e9c81, 0x34f4f86a, 0xc69f7b69,
+    0xd5cf889d, 0x27a40b9e, 0x79b737ba, 0x8bdcb4b9, 0x988c474d, 0x6ae7c44e,
+    0xbe2da0a5, 0x4c4623a6, 0x5f16d052, 0xad7d5351
+};
+
+static uint32_t crc32c_table_update( uint32_t crc, const uint8_t* data, int len ) {
     for (int i = 0; i < len; i++) {
-        checksum ^= frame[i]; 
+        crc = crc32c_table[(crc ^ data[i]) & 0xff] ^ (crc >> 8);
+    }
+    return crc;
+}
+
+#if defined(__x86_64__)
+#include <nmmintrin.h>
+
+__attribute__((target("sse4.2")))
+static uint32_t crc32c_sse42_update( uint32_t crc, const uint8_t* data, int len ) {
+    uint64_t c = crc;
+    int i = 0;
+    for (; i + 8 <= len; i += 8) {
+        uint64_t word;
+        memcpy(&word, data + i, sizeof(word));
+        c = _mm_crc32_u64(c, word);
+    }
+    crc = (uint32_t)c;
+    for (; i < len; i++) {
+        crc = _mm_crc32_u8(crc, data[i]);
+    }
+    return crc;
+}
+
+static uint32_t crc32c_update( uint32_t crc, const uint8_t* data, int len ) {
+    // __builtin_cpu_supports leser bare data som er fylt ut før main
+    return __builtin_cpu_supports("sse4.2") ? crc32c_sse42_update(crc, data, len)
+                                            : crc32c_table_update(crc, data, len);
+}
+#else
+static uint32_t crc32c_update( uint32_t crc, const uint8_t* data, int len ) {
+    return crc32c_table_update(crc, data, len);
+}
+#endif
+
+/* Checksum beregnes inkrementelt: checksum_init, checksum_update for
+ * hver bit av rammen, og checksum_final gir byten som står i headeren.
+ * CRC32C må brettes ned til 8 bit for å passe i L2Header.
+ */
+static uint32_t checksum_init( int type ) {
+    return type == L2_CHECKSUM_CRC32C ? 0xffffffff : 0;
+}
+
+static uint32_t checksum_update( int type, uint32_t state, const uint8_t* data, int len ) {
+    return type == L2_CHECKSUM_CRC32C ? crc32c_update(state, data, len)
+                                      : xor_update(state, data, len);
+}
+
+static uint8_t checksum_final( int type, uint32_t state ) {
+    if (type == L2_CHECKSUM_CRC32C) {
+        state = ~state;
+        state ^= state >> 16;
+        state ^= state >> 8;
+    }
+    return (uint8_t)state;
+}
+
+
+// Fyller ut L2-headeren for en ramme med payload i iov.
+// Checksum beregnes over header og alle payload-bufferne i én
+// gjennomgang, uten å kopiere dem sammen til en ramme først.
+static void fill_header( L2SAP* client, struct L2Header* header,
+                         const struct iovec* iov, int iovcnt, int len ) {
+    int type = client->checksum_type;
+
+    header->dst_addr = client->peer_addr.sin_addr.s_addr;
+    header->len = htons((uint16_t)len + sizeof(L2Header));
+    header->checksum = 0; // Checksum = 0 før den kalkuleres
+    header->mbz = type == L2_CHECKSUM_CRC32C ? L2_MBZ_CRC32C : 0;
+
+    uint32_t cs = checksum_init(type);
+    cs = checksum_update(type, cs, (const uint8_t*)header, L2Headersize);
+    for (int i = 0; i < iovcnt; i++) {
+        cs = checksum_update(type, cs, iov[i].iov_base, iov[i].iov_len);
+    }
+    header->checksum = checksum_final(type, cs);
+}
+
+// Sjekker en mottatt ramme, og returnerer payload-lengden eller -1.
+// Algoritmen velges ut fra mbz-feltet i rammen, så vi kan ta imot
+// begge typer uansett hva vi selv sender med.
+static int check_frame( L2SAP* client, uint8_t* frame, int recv_len ) {
+
+    if (recv_len < L2Headersize) {
+        LOG_DEBUG("Frame too short\n");
+        client->stats.short_frames++;
+        return -1;
+    }
+
+    struct L2Header* header = (struct L2Header*)frame;
+    int type = (header->mbz & L2_MBZ_CRC32C) ? L2_CHECKSUM_CRC32C : L2_CHECKSUM_XOR;
+
+    // recv_cs = mottatt checksum fra frame
+    // correct_cs = kalkulert checksum basert på frame
+    uint8_t recv_cs = header->checksum;
+    header->checksum = 0; // Setter checksum til 0 før beregning
+
+    uint32_t state = checksum_update(type, checksum_init(type), frame, recv_len);
+    uint8_t correct_cs = checksum_final(type, state);
+    if (recv_cs != correct_cs) {
+        LOG_DEBUG("Checksum not correct\n");
+        client->stats.checksum_errors++;
+        return -1;
+    }
+
+    client->stats.frames_received++;
+    client->stats.bytes_received += recv_len;
+    return recv_len - L2Headersize;
+}
+
+
+int l2sap_set_checksum( L2SAP* client, int type ) {
+    if (type != L2_CHECKSUM_XOR && type != L2_CHECKSUM_CRC32C) {
+        return -1;
     }
-    return checksum;
+    client->checksum_type = type;
+    return 0;
+}
+
+
+void l2sap_get_stats( const L2SAP* client, L2Stats* stats ) {
+    *stats = client->stats;
 }
 
 
@@ -22,14 +215,14 @@ L2SAP* l2sap_create( const char* server_ip, int server_port ) {
     // socket() returnerer en file descriptor
     int socketFD = socket(AF_INET, SOCK_DGRAM, 0);
     if (socketFD < 0) {
-        printf("Couldn't create socket\n");
+        LOG_ERROR("Couldn't create socket\n");
         exit(EXIT_FAILURE);
     }
 
     // Initialiserer pointer til struct L2SAP
     L2SAP* l2sap = malloc(sizeof(struct L2SAP));
     if (l2sap == NULL) {
-        printf("Error mallocing L2SAP\n");
+        LOG_ERROR("Error mallocing L2SAP\n");
         exit(EXIT_FAILURE);
     }
 
@@ -41,7 +234,7 @@ L2SAP* l2sap_create( const char* server_ip, int server_port ) {
 
     int check = inet_pton(AF_INET, server_ip, &addr.sin_addr);
     if (check != 1) {
-        printf("Couldn't convert to network address structure\n");
+        LOG_ERROR("Couldn't convert to network address structure\n");
         free(l2sap);
         exit(EXIT_FAILURE);
     }
@@ -49,6 +242,46 @@ L2SAP* l2sap_create( const char* server_ip, int server_port ) {
     // Tilordner variablene til socket (FD + adressen)
     l2sap->socket = socketFD;
     l2sap->peer_addr = addr;
+    l2sap->checksum_type = L2_CHECKSUM_XOR;
+    memset(&l2sap->stats, 0, sizeof(l2sap->stats));
+    return l2sap;
+}
+
+
+L2SAP* l2sap_server_create( int port ) {
+
+    int socketFD = socket(AF_INET, SOCK_DGRAM, 0);
+    if (socketFD < 0) {
+        LOG_ERROR("Couldn't create socket\n");
+        return NULL;
+    }
+
+    // Lytter på alle grensesnitt
+    struct sockaddr_in addr;
+    memset(&addr, 0, sizeof(addr));
+    addr.sin_family = AF_INET;
+    addr.sin_port = htons(port);
+    addr.sin_addr.s_addr = htonl(INADDR_ANY);
+
+    if (bind(socketFD, (struct sockaddr*)&addr, sizeof(addr)) < 0) {
+        perror("Couldn't bind server socket");
+        close(socketFD);
+        return NULL;
+    }
+
+    L2SAP* l2sap = malloc(sizeof(struct L2SAP));
+    if (l2sap == NULL) {
+        LOG_ERROR("Error mallocing L2SAP\n");
+        close(socketFD);
+        return NULL;
+    }
+
+    // Peer er ukjent til første ramme kommer; recvfrom fyller inn
+    // adressen, og svarene går til den som sendte sist
+    l2sap->socket = socketFD;
+    memset(&l2sap->peer_addr, 0, sizeof(l2sap->peer_addr));
+    l2sap->checksum_type = L2_CHECKSUM_XOR;
+    memset(&l2sap->stats, 0, sizeof(l2sap->stats));
     return l2sap;
 }
 
@@ -60,49 +293,78 @@ void l2sap_destroy(L2SAP* client) {
 }
 
 
+// Setter O_NONBLOCK på socketen, slik at den kan brukes fra en
+// hendelsesløkke uten at sending eller mottak blokkerer
+int l2sap_set_nonblocking( L2SAP* client, int on ) {
+    int flags = fcntl(client->socket, F_GETFL, 0);
+    if (flags < 0) {
+        return -1;
+    }
+    flags = on ? (flags | O_NONBLOCK) : (flags & ~O_NONBLOCK);
+    return fcntl(client->socket, F_SETFL, flags);
+}
+
+
 int l2sap_sendto( L2SAP* client, const uint8_t* data, int len ) {
+    struct iovec iov;
+    iov.iov_base = (void*)data;
+    iov.iov_len = len;
+    return l2sap_sendv(client, &iov, 1);
+}
+
+
+int l2sap_sendv( L2SAP* client, const struct iovec* iov, int iovcnt ) {
+
+    if (iovcnt < 0 || iovcnt > L2MaxIov) {
+        LOG_ERROR("Too many buffers for one frame\n");
+        return -1;
+    }
+
+    int len = 0;
+    for (int i = 0; i < iovcnt; i++) {
+        len += iov[i].iov_len;
+    }
 
     // Hvis datamengden er for stor (data + header overskrider rammestrl)
     if (len + L2Headersize > L2Framesize) {
-        printf("Data exceeds frame size\n");
+        LOG_ERROR("Data exceeds frame size\n");
         return -1;
     }
 
-    int socketFD = client->socket;
-    struct sockaddr_in reciever = client->peer_addr;
+    struct sockaddr_in* reciever = &client->peer_addr;
+
+    // En server som ikke har hørt fra noen ennå har ingen å sende til
+    if (reciever->sin_port == 0) {
+        LOG_DEBUG("No peer to send to\n");
+        return -1;
+    }
 
     // Allokerer header på stacken 
     struct L2Header header;
-    header.dst_addr = reciever.sin_addr.s_addr;
-    header.len = htons((uint16_t)len + sizeof(L2Header));
-    header.checksum = 0; // Checksum = 0 før den kalkuleres
-    header.mbz = 0;
-
-    // Oppretter en frame (buffer for header + data)
-    // Rammen er begrenset til størrelsen av data
-    int framesize = L2Headersize + len;
-    printf("Framesize: %d\n", framesize);
-    uint8_t* frame = malloc(framesize);
-    if (frame == NULL) {
-        printf("Error mallocing space for buffer\n");
+    fill_header(client, &header, iov, iovcnt, len);
+
+    LOG_TRACE("Framesize: %d\n", L2Headersize + len);
+
+    // Header og payload sendes som én ramme med sendmsg
+    struct iovec frame[L2MaxIov + 1];
+    frame[0].iov_base = &header;
+    frame[0].iov_len = L2Headersize;
+    memcpy(&frame[1], iov, iovcnt * sizeof(struct iovec));
+
+    struct msghdr msg;
+    memset(&msg, 0, sizeof(msg));
+    msg.msg_name = reciever;
+    msg.msg_namelen = sizeof(*reciever);
+    msg.msg_iov = frame;
+    msg.msg_iovlen = iovcnt + 1;
+
+    if (sendmsg(client->socket, &msg, 0) < 0) {
+        perror("Error sending frame");
+        client->stats.send_errors++;
         return -1;
     }
-
-    // Kopierer først header på rammen og deretter dataen
-    memcpy(frame, &header, L2Headersize);
-    memcpy(frame+L2Headersize, data, len);
-
-    // Kaller på hjelpefunksjon for å sette checksum
-    // Beregnes ut fra hele rammen
-    uint8_t cs = compute_checksum(frame, framesize);
-    header.checksum = cs;
-
-    // Oppdaterer headeren på frame etter checksum er beregnet
-    memcpy(frame, &header, L2Headersize);
-
-    // Sender melding (sender med hele bufferet, inkludert header)
-    sendto(socketFD, frame, framesize, 0, (const struct sockaddr*)&reciever, sizeof(reciever));
-    free(frame);
+    client->stats.frames_sent++;
+    client->stats.bytes_sent += L2Headersize + len;
     return 1;
 }
 
@@ -115,6 +377,20 @@ int l2sap_recvfrom( L2SAP* client, uint8_t* data, int len ) {
 
 int l2sap_recvfrom_timeout( L2SAP* client, uint8_t* data, int len, struct timeval* timeout ) {
 
+    uint8_t* payload;
+    int payload_len = l2sap_recvframe_timeout(client, data, len, timeout, &payload);
+
+    // Fjerner headeren for kallere som vil ha payloaden først i bufferet
+    if (payload_len > 0) {
+        memmove(data, payload, payload_len);
+    }
+    return payload_len;
+}
+
+
+int l2sap_recvframe_timeout( L2SAP* client, uint8_t* frame, int len,
+                             struct timeval* timeout, uint8_t** payload ) {
+
     // Nullstiller variabel som skal holde på file descriptor
     // og henter riktig FD fra klienten
     fd_set fds;
@@ -125,10 +401,11 @@ int l2sap_recvfrom_timeout( L2SAP* client, uint8_t* data, int len, struct timeva
     // Kun interessert i å lese, så setter writefds og exceptfds til null
     int check_activity = select(client->socket + 1, &fds, NULL, NULL, timeout);
     if (check_activity < 0) {
-        printf("An error occured in select\n");
+        LOG_ERROR("An error occured in select\n");
         return -1;
     } else if (check_activity == 0) {
-        printf("Timeout waiting for data\n");
+        LOG_TRACE("Timeout waiting for data\n");
+        client->stats.timeouts++;
         return L2_TIMEOUT;
 
     // Hvis data er sendt og mottatt innen timeout:
@@ -138,29 +415,131 @@ int l2sap_recvfrom_timeout( L2SAP* client, uint8_t* data, int len, struct timeva
         socklen_t address_length = sizeof(client->peer_addr);
 
         // recvfrom() returnerer en int (rammestørrelsen)
-        int recv_len = recvfrom(client->socket, data, len, 0, (struct sockaddr*) &client->peer_addr, &address_length);
+        int recv_len = recvfrom(client->socket, frame, len, 0, (struct sockaddr*) &client->peer_addr, &address_length);
+        if (recv_len < 0) {
+            perror("Error receiving frame");
+            return -1;
+        }
 
-        if (recv_len < L2Headersize) {
-            printf("Frame too short\n");
+        int payload_len = check_frame(client, frame, recv_len);
+        if (payload_len < 0) {
             return -1;
         }
 
-        // recv_cs = mottatt checksum fra frame
-        // correct_cs = kalkulert checksum basert på frame
-        uint8_t recv_cs = data[L2Headersize-2];
-        data[L2Headersize-2] = 0; // Setter checksum til 0 før beregning
+        // Headeren blir liggende, kalleren får en peker til payloaden
+        *payload = frame + L2Headersize;
+        return payload_len;
+    }
+}
+
+
+int l2sap_sendto_batch( L2SAP* client, const struct iovec* frames, int count ) {
 
-        uint8_t correct_cs = compute_checksum(data, recv_len);
-        if (recv_cs != correct_cs) {
-            printf("Checksum not correct\n");
+    struct L2Header headers[L2MaxBatch];
+    struct iovec iovs[L2MaxBatch][2];
+    struct mmsghdr msgs[L2MaxBatch];
+
+    if (client->peer_addr.sin_port == 0) {
+        LOG_DEBUG("No peer to send to\n");
+        return -1;
+    }
+
+    int sent = 0;
+    while (sent < count) {
+
+        // Bygger opp til L2MaxBatch rammer, hver med header + payload
+        int n = count - sent;
+        if (n > L2MaxBatch) {
+            n = L2MaxBatch;
+        }
+
+        for (int i = 0; i < n; i++) {
+            const struct iovec* payload = &frames[sent + i];
+            if ((int)payload->iov_len + L2Headersize > L2Framesize) {
+                LOG_ERROR("Data exceeds frame size\n");
+                return sent > 0 ? sent : -1;
+            }
+
+            fill_header(client, &headers[i], payload, 1, payload->iov_len);
+            iovs[i][0].iov_base = &headers[i];
+            iovs[i][0].iov_len = L2Headersize;
+            iovs[i][1] = *payload;
+
+            memset(&msgs[i], 0, sizeof(msgs[i]));
+            msgs[i].msg_hdr.msg_name = &client->peer_addr;
+            msgs[i].msg_hdr.msg_namelen = sizeof(client->peer_addr);
+            msgs[i].msg_hdr.msg_iov = iovs[i];
+            msgs[i].msg_hdr.msg_iovlen = 2;
+        }
+
+        int done = sendmmsg(client->socket, msgs, n, 0);
+        if (done < 0) {
+            perror("Error sending frames");
+            client->stats.send_errors++;
+            return sent > 0 ? sent : -1;
+        }
+        for (int i = 0; i < done; i++) {
+            client->stats.bytes_sent += L2Headersize + frames[sent + i].iov_len;
+        }
+        client->stats.frames_sent += done;
+        sent += done;
+    }
+    return sent;
+}
+
+
+int l2sap_recvfrom_batch( L2SAP* client, uint8_t* frames, int count, int* lens,
+                          struct timeval* timeout ) {
+
+    if (count > L2MaxBatch) {
+        count = L2MaxBatch;
+    }
+
+    struct sockaddr_in addrs[L2MaxBatch];
+    struct iovec iovs[L2MaxBatch];
+    struct mmsghdr msgs[L2MaxBatch];
+
+    for (int i = 0; i < count; i++) {
+        iovs[i].iov_base = frames + i * L2Framesize;
+        iovs[i].iov_len = L2Framesize;
+
+        memset(&msgs[i], 0, sizeof(msgs[i]));
+        msgs[i].msg_hdr.msg_name = &addrs[i];
+        msgs[i].msg_hdr.msg_namelen = sizeof(addrs[i]);
+        msgs[i].msg_hdr.msg_iov = &iovs[i];
+        msgs[i].msg_hdr.msg_iovlen = 1;
+    }
+
+    // Prøver først uten å vente; select() bare hvis køen er tom
+    int received = recvmmsg(client->socket, msgs, count, MSG_DONTWAIT, NULL);
+    if (received < 0 && (errno == EAGAIN || errno == EWOULDBLOCK)) {
+
+        fd_set fds;
+        FD_ZERO(&fds);
+        FD_SET(client->socket, &fds);
+
+        int check_activity = select(client->socket + 1, &fds, NULL, NULL, timeout);
+        if (check_activity < 0) {
+            LOG_ERROR("An error occured in select\n");
             return -1;
+        } else if (check_activity == 0) {
+            client->stats.timeouts++;
+            return L2_TIMEOUT;
         }
 
-        // Fjerne headeren 
-        // Oppdaterer pointer til å peke på data etter header
-        uint8_t* payload = data + L2Headersize;
-        memcpy(data, payload, recv_len - L2Headersize); 
+        received = recvmmsg(client->socket, msgs, count, MSG_DONTWAIT, NULL);
+    }
 
-        return recv_len-L2Headersize;
+    if (received < 0) {
+        perror("Error receiving frames");
+        return -1;
     }
-}
\ No newline at end of file
+
+    for (int i = 0; i < received; i++) {
+        lens[i] = check_frame(client, frames + i * L2Framesize, msgs[i].msg_len);
+        if (lens[i] >= 0) {
+            client->peer_addr = addrs[i];
+        }
+    }
+    return received;
+}
@@ -6,6 +6,7 @@
 #include <netinet/in.h>
 #include <arpa/inet.h>
 #include <sys/select.h>
+#include <sys/uio.h>
 
 #define L2Framesize   1024
 #define L2Headersize  (int)(sizeof(struct L2Header))
@@ -13,6 +14,22 @@
 
 #define L2_TIMEOUT    0
 
+/* Maks antall iovecs en kaller kan gi til l2sap_sendv (L2-headeren
+ * kommer i tillegg) */
+#define L2MaxIov      4
+
+/* Maks antall rammer per sendmmsg/recvmmsg-kall */
+#define L2MaxBatch    32
+
+/* Checksum-algoritmer. XOR er det standardserverne forventer.
+ * CRC32C (brettet ned til 8 bit) oppdager mange flere feil, og rammer
+ * med den har L2_MBZ_CRC32C satt i mbz-feltet, slik at mottakeren vet
+ * hvilken algoritme den skal sjekke med.
+ */
+#define L2_CHECKSUM_XOR     0
+#define L2_CHECKSUM_CRC32C  1
+#define L2_MBZ_CRC32C       0x1
+
 typedef struct L2Header L2Header;
 
 struct L2Header {
@@ -22,22 +39,86 @@ struct L2Header {
     uint8_t  mbz;
 };
 
+/* Tellere for én L2SAP, fra den ble laget. Oppdateres med vanlige
+ * inkrementer uten låsing, så den som bruker L2SAP-en fra flere tråder
+ * må holde samme lås når den leser dem.
+ */
+typedef struct L2Stats L2Stats;
+
+struct L2Stats {
+    uint64_t frames_sent;
+    uint64_t frames_received;  // rammer med gyldig checksum
+    uint64_t bytes_sent;       // hele rammer, med L2-headeren
+    uint64_t bytes_received;
+    uint64_t checksum_errors;
+    uint64_t short_frames;     // kortere enn L2-headeren
+    uint64_t send_errors;
+    uint64_t timeouts;         // ingen ramme innen timeout
+};
+
 typedef struct L2SAP L2SAP;
 
 struct L2SAP {
     int                socket;
     struct sockaddr_in peer_addr;
+    int                checksum_type; // L2_CHECKSUM_XOR eller _CRC32C
+    L2Stats            stats;
 };
 
+/* Lager en L2-server som lytter på port på alle grensesnitt. Peer er
+ * ukjent til første ramme kommer, og som for klienten er det avsenderen
+ * av siste mottatte ramme som får svarene; før det feiler sending med
+ * -1. Returnerer NULL hvis porten ikke kan bindes.
+ */
 struct L2SAP* l2sap_server_create( int port );
 struct L2Header l2sap_addheader(struct sockaddr_in addr, int len) ;
 
 L2SAP* l2sap_create( const char* server_ip, int server_port );
 void l2sap_destroy( L2SAP* client );
+int  l2sap_set_nonblocking( L2SAP* client, int on );
+
+/* Velger checksum for rammer som sendes (L2_CHECKSUM_XOR er standard).
+ * Mottak godtar begge. Returnerer 0, eller -1 for ukjent type.
+ */
+int  l2sap_set_checksum( L2SAP* client, int type );
+
+/* Kopierer tellerne til stats */
+void l2sap_get_stats( const L2SAP* client, L2Stats* stats );
 int  l2sap_sendto( L2SAP* client, const uint8_t* data, int len );
 int  l2sap_recvfrom_timeout( L2SAP* client, uint8_t* data, int len, struct timeval* timeout );
 int  l2sap_recvfrom( L2SAP* client, uint8_t* data, int len );
 
+/* Scatter/gather-sending: payloaden er de iovcnt (maks L2MaxIov)
+ * bufferne i iov etter hverandre. L2-headeren legges foran med sendmsg,
+ * så verken header eller payload kopieres eller allokeres.
+ * Returnerer 1 ved suksess og -1 ved feil, som l2sap_sendto.
+ */
+int  l2sap_sendv( L2SAP* client, const struct iovec* iov, int iovcnt );
+
+/* Som l2sap_recvfrom_timeout, men hele rammen blir liggende i frame og
+ * payloaden flyttes ikke. *payload settes til å peke på payloaden inne i
+ * frame. Returnerer payload-lengden, L2_TIMEOUT eller -1.
+ */
+int  l2sap_recvframe_timeout( L2SAP* client, uint8_t* frame, int len,
+                              struct timeval* timeout, uint8_t** payload );
+
+/* Sender count rammer med så få sendmmsg-kall som mulig (L2MaxBatch
+ * per kall). Hver iovec er payloaden til én ramme.
+ * Returnerer antall rammer som ble sendt, eller -1 ved feil.
+ */
+int  l2sap_sendto_batch( L2SAP* client, const struct iovec* frames, int count );
+
+/* Mottar opptil count (maks L2MaxBatch) rammer med ett recvmmsg-kall.
+ * frames må ha plass til count * L2Framesize bytes; ramme i ligger på
+ * frames + i*L2Framesize og payloaden dens på frames + i*L2Framesize
+ * + L2Headersize, uten å være flyttet. lens[i] får payload-lengden, eller
+ * -1 hvis rammen var for kort eller hadde feil checksum.
+ * select() brukes bare når det ikke allerede ligger rammer i køen.
+ * Returnerer antall rammer (>0), L2_TIMEOUT eller -1 ved feil.
+ */
+int  l2sap_recvfrom_batch( L2SAP* client, uint8_t* frames, int count, int* lens,
+                           struct timeval* timeout );
+
 
 #endif
 
@@ -0,0 +1,345 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <sys/epoll.h>
+#include <sys/time.h>
+
+#include "l4reactor.h"
+#include "log.h"
+
+#define L4ReactorEvents 64
+
+// Tilstand for sending i en sesjon
+#define SEND_IDLE    0
+#define SEND_WINDOW  1 // venter på plass i vinduet
+#define SEND_ACK     2 // pakken er sendt, venter på ack
+
+struct L4Session
+{
+    L4Reactor* reactor;
+    L4SAP* l4;
+    void* user;
+    int index; // plass i reactor->sessions
+    int ended; // L4_QUIT eller L4_SEND_FAILED når sesjonen er over, ellers 0
+
+    int send_state;
+    const uint8_t* send_data;
+    int send_len;
+    L4Callback send_cb;
+    void* send_arg;
+
+    int receiving;
+    uint8_t* recv_data;
+    int recv_len;
+    L4Callback recv_cb;
+    void* recv_arg;
+};
+
+struct L4Reactor
+{
+    int epfd;
+    L4Session** sessions;
+    int count;
+    int capacity;
+};
+
+
+L4Reactor* l4reactor_create( void )
+{
+    L4Reactor* reactor = malloc(sizeof(struct L4Reactor));
+    if (reactor == NULL) {
+        LOG_ERROR("Error mallocing L4Reactor\n");
+        return NULL;
+    }
+
+    reactor->epfd = epoll_create1(0);
+    if (reactor->epfd < 0) {
+        perror("Error creating epoll instance");
+        free(reactor);
+        return NULL;
+    }
+
+    reactor->sessions = NULL;
+    reactor->count = 0;
+    reactor->capacity = 0;
+    return reactor;
+}
+
+
+void l4reactor_destroy( L4Reactor* reactor )
+{
+    while (reactor->count > 0) {
+        l4reactor_remove(reactor, reactor->sessions[reactor->count - 1]);
+    }
+    close(reactor->epfd);
+    free(reactor->sessions);
+    free(reactor);
+}
+
+
+L4Session* l4reactor_add( L4Reactor* reactor, L4SAP* l4, void* user )
+{
+    if (reactor->count == reactor->capacity) {
+        int capacity = reactor->capacity ? 2 * reactor->capacity : 16;
+        L4Session** sessions = realloc(reactor->sessions, capacity * sizeof(L4Session*));
+        if (sessions == NULL) {
+            LOG_ERROR("Error growing session table\n");
+            return NULL;
+        }
+        reactor->sessions = sessions;
+        reactor->capacity = capacity;
+    }
+
+    L4Session* session = calloc(1, sizeof(struct L4Session));
+    if (session == NULL) {
+        LOG_ERROR("Error mallocing L4Session\n");
+        return NULL;
+    }
+    session->reactor = reactor;
+    session->l4 = l4;
+    session->user = user;
+
+    // Sesjonen må aldri blokkere tråden som driver alle de andre
+    if (l2sap_set_nonblocking(l4->l2sap, 1) < 0) {
+        perror("Error setting socket non-blocking");
+        free(session);
+        return NULL;
+    }
+
+    struct epoll_event ev;
+    memset(&ev, 0, sizeof(ev));
+    ev.events = EPOLLIN;
+    ev.data.ptr = session;
+    if (epoll_ctl(reactor->epfd, EPOLL_CTL_ADD, l4->l2sap->socket, &ev) < 0) {
+        perror("Error adding socket to epoll");
+        free(session);
+        return NULL;
+    }
+
+    session->index = reactor->count;
+    reactor->sessions[reactor->count++] = session;
+    return session;
+}
+
+
+void l4reactor_remove( L4Reactor* reactor, L4Session* session )
+{
+    if (!session->ended) {
+        epoll_ctl(reactor->epfd, EPOLL_CTL_DEL, session->l4->l2sap->socket, NULL);
+    }
+
+    // Flytter siste sesjon inn på plassen som blir ledig
+    L4Session* last = reactor->sessions[--reactor->count];
+    reactor->sessions[session->index] = last;
+    last->index = session->index;
+
+    // l4sap_destroy venter blokkerende på ukvitterte pakker
+    l2sap_set_nonblocking(session->l4->l2sap, 0);
+    l4sap_destroy(session->l4);
+    free(session);
+}
+
+
+L4SAP* l4session_l4sap( L4Session* session )
+{
+    return session->l4;
+}
+
+void* l4session_user( L4Session* session )
+{
+    return session->user;
+}
+
+
+static void finish_send( L4Session* session, int result )
+{
+    session->send_state = SEND_IDLE;
+    session->send_cb(session, result, session->send_arg);
+}
+
+static void finish_recv( L4Session* session, int result )
+{
+    session->receiving = 0;
+    session->recv_cb(session, result, session->recv_arg);
+}
+
+// Avslutter alle operasjoner i sesjonen med samme feilkode. Sesjonen
+// leser aldri mer fra socketen, så den tas ut av epoll; ellers ville
+// rammer som kommer etterpå (f.eks. resten av RESET-ene) holde
+// epoll_wait våken til alle andre sesjoner er ferdige
+static void fail_session( L4Session* session, int result )
+{
+    if (!session->ended) {
+        session->ended = result;
+        epoll_ctl(session->reactor->epfd, EPOLL_CTL_DEL, session->l4->l2sap->socket, NULL);
+    }
+    if (session->send_state != SEND_IDLE) {
+        finish_send(session, result);
+    }
+    if (session->receiving) {
+        finish_recv(session, result);
+    }
+}
+
+/* Driver sesjonen så langt det går uten å blokkere: leser rammer som
+ * har kommet, leverer data, fyller vinduet og fullfører operasjoner.
+ * Callbacks kan starte nye operasjoner, så vi går rundt til ingenting
+ * endrer seg.
+ */
+static void session_progress( L4Session* session )
+{
+    int progress = 1;
+    while (progress && !session->ended) {
+        progress = 0;
+
+        int result;
+        if (session->receiving) {
+            result = l4sap_recv_nb(session->l4, session->recv_data, session->recv_len);
+            if (result >= 0) {
+                finish_recv(session, result);
+                progress = 1;
+                continue;
+            }
+        } else {
+            // Ingen mottaksoperasjon: behandler ACKer, og legger data
+            // på bufferet til neste l4reactor_recv
+            result = l4sap_recv_nb(session->l4, NULL, 0);
+        }
+        if (result == L4_QUIT || result == L4_SEND_FAILED) {
+            fail_session(session, result);
+            return;
+        }
+
+        if (session->send_state == SEND_WINDOW) {
+            result = l4sap_send_nb(session->l4, session->send_data, session->send_len);
+            if (result >= 0) {
+                session->send_len = result;
+                session->send_state = SEND_ACK;
+                progress = 1;
+            } else if (result != L4_WOULD_BLOCK) {
+                finish_send(session, result);
+                progress = 1;
+            }
+        }
+
+        if (session->send_state == SEND_ACK && l4sap_outstanding(session->l4) == 0) {
+            finish_send(session, session->send_len);
+            progress = 1;
+        }
+    }
+}
+
+
+int l4reactor_send( L4Session* session, const uint8_t* data, int len,
+                    L4Callback cb, void* arg )
+{
+    if (session->send_state != SEND_IDLE) {
+        return -1;
+    }
+
+    session->send_state = SEND_WINDOW;
+    session->send_data = data;
+    session->send_len = len;
+    session->send_cb = cb;
+    session->send_arg = arg;
+
+    if (session->ended) {
+        finish_send(session, session->ended);
+    } else {
+        session_progress(session);
+    }
+    return 0;
+}
+
+
+int l4reactor_recv( L4Session* session, uint8_t* data, int len,
+                    L4Callback cb, void* arg )
+{
+    if (session->receiving) {
+        return -1;
+    }
+
+    session->receiving = 1;
+    session->recv_data = data;
+    session->recv_len = len;
+    session->recv_cb = cb;
+    session->recv_arg = arg;
+
+    if (session->ended) {
+        finish_recv(session, session->ended);
+    } else {
+        session_progress(session);
+    }
+    return 0;
+}
+
+
+// Antall operasjoner som ikke er fullført
+static int reactor_busy( L4Reactor* reactor )
+{
+    int busy = 0;
+    for (int i = 0; i < reactor->count; i++) {
+        L4Session* session = reactor->sessions[i];
+        busy += (session->send_state != SEND_IDLE) + session->receiving;
+    }
+    return busy;
+}
+
+
+int l4reactor_poll( L4Reactor* reactor, int timeout_ms )
+{
+    // Kjører retransmisjonstimere som har gått ut, og finner den
+    // nærmeste fristen slik at epoll_wait ikke sover forbi den
+    long wait_us = -1;
+    for (int i = 0; i < reactor->count; i++) {
+        L4Session* session = reactor->sessions[i];
+        if (session->ended) {
+            continue;
+        }
+
+        struct timeval left;
+        int armed = l4sap_timer_nb(session->l4, &left);
+        if (armed == L4_SEND_FAILED) {
+            fail_session(session, L4_SEND_FAILED);
+        } else if (armed == 1) {
+            long us = left.tv_sec * 1000000L + left.tv_usec;
+            if (wait_us < 0 || us < wait_us) {
+                wait_us = us;
+            }
+        }
+    }
+
+    int wait_ms = timeout_ms;
+    if (wait_us >= 0) {
+        int timer_ms = (int)((wait_us + 999) / 1000);
+        if (wait_ms < 0 || timer_ms < wait_ms) {
+            wait_ms = timer_ms;
+        }
+    }
+
+    struct epoll_event events[L4ReactorEvents];
+    int n = epoll_wait(reactor->epfd, events, L4ReactorEvents, wait_ms);
+    if (n < 0) {
+        perror("Error in epoll_wait");
+        return -1;
+    }
+
+    for (int i = 0; i < n; i++) {
+        session_progress((L4Session*)events[i].data.ptr);
+    }
+
+    return reactor_busy(reactor);
+}
+
+
+int l4reactor_run( L4Reactor* reactor )
+{
+    int busy;
+    while ((busy = reactor_busy(reactor)) > 0) {
+        if (l4reactor_poll(reactor, -1) < 0) {
+            return -1;
+        }
+    }
+    return 0;
+}
@@ -0,0 +1,72 @@
+#ifndef L4REACTOR_H
+#define L4REACTOR_H
+
+#include "l4sap.h"
+
+/* An epoll-based event loop that drives many L4SAP sessions from one
+ * thread. Each session can have one send and one receive operation in
+ * progress at a time. When an operation finishes, its callback is
+ * called from l4reactor_poll with the result that the blocking
+ * function (l4sap_send or l4sap_recv) would have returned.
+ *
+ * The sessions use the non-blocking L4 interface, so against the stock
+ * servers they speak stop-and-wait, and against a windowed peer they use
+ * the window that was set with l4sap_set_window before l4reactor_add.
+ */
+typedef struct L4Reactor L4Reactor;
+typedef struct L4Session L4Session;
+
+typedef void (*L4Callback)( L4Session* session, int result, void* arg );
+
+L4Reactor* l4reactor_create( void );
+
+/* Destroys the reactor and all its sessions, including their L4SAPs.
+ */
+void l4reactor_destroy( L4Reactor* reactor );
+
+/* Registers an L4SAP with the reactor, which takes ownership of it.
+ * user is an arbitrary pointer that can be read back with
+ * l4session_user. Returns NULL on error.
+ */
+L4Session* l4reactor_add( L4Reactor* reactor, L4SAP* l4, void* user );
+
+/* Unregisters the session and destroys its L4SAP, which first waits
+ * for packets that have not been acknowledged. Operations in progress
+ * are not completed. Must not be called from a callback.
+ */
+void l4reactor_remove( L4Reactor* reactor, L4Session* session );
+
+/* Starts sending len bytes of data (truncated to L4Payloadsize). The
+ * buffer must stay valid until the callback is called with the number of
+ * bytes that were acknowledged, L4_SEND_FAILED or L4_QUIT.
+ * Returns 0, or -1 if a send is already in progress on the session.
+ */
+int l4reactor_send( L4Session* session, const uint8_t* data, int len,
+                    L4Callback cb, void* arg );
+
+/* Starts receiving one DATA packet into data. The callback is called
+ * with the payload length, L4_QUIT or L4_SEND_FAILED.
+ *
+ * Once an operation has ended with L4_QUIT or L4_SEND_FAILED, the
+ * session no longer reads its socket and is taken out of the epoll set,
+ * and every later operation ends at once with the same code. The
+ * session stays registered until l4reactor_remove.
+ * Returns 0, or -1 if a receive is already in progress on the session.
+ */
+int l4reactor_recv( L4Session* session, uint8_t* data, int len,
+                    L4Callback cb, void* arg );
+
+/* Waits for at most timeout_ms milliseconds (-1: until the next event or
+ * retransmission timer), processes what happened and runs callbacks.
+ * Returns the number of operations still in progress, or -1 on error.
+ */
+int l4reactor_poll( L4Reactor* reactor, int timeout_ms );
+
+/* Calls l4reactor_poll until no operations are in progress.
+ */
+int l4reactor_run( L4Reactor* reactor );
+
+L4SAP* l4session_l4sap( L4Session* session );
+void*  l4session_user( L4Session* session );
+
+#endif
@@ -6,24 +6,24 @@
 #include <stdlib.h>
 #include <sys/time.h>
 #include <time.h>       // for struct tm, localtime, strftime
+#include <stdint.h>
 
 
 #include "l4sap.h"
 #include "l2sap.h"
+#include "log.h"
 
 
-L4SAP* l4sap_create( const char* server_ip, int server_port )
-{
+// Felles for klient og server: lager L4-entiteten rundt en ferdig L2SAP
+static L4SAP* l4sap_init(L2SAP* l2) {
 
     // Må allokere minne for L4SAP
     L4SAP* l4sap = malloc(sizeof(struct L4SAP));
     if (l4sap == NULL) {
-        printf("Error mallocing L4SAP\n");
+        LOG_ERROR("Error mallocing L4SAP\n");
         exit(EXIT_FAILURE);
     }
 
-    // Oppretter en L2-klient som legges inn i L4-klienten
-    L2SAP* l2 = l2sap_create(server_ip, server_port);
     l4sap->l2sap = l2;
 
     // Fyller ut feltene
@@ -31,22 +31,736 @@ L4SAP* l4sap_create( const char* server_ip, int server_port )
     l4sap->last_seq_received = 1; // første mottatte seq vil alltid være 0
     l4sap->last_ack_sent = 0;
     l4sap->reset = 0; 
+    l4sap->failed = 0;
+    l4sap->msg_broken = 0;
     
     l4sap->timeout.tv_sec = 1;
     l4sap->timeout.tv_usec = 0;
+    l4sap->srtt_us = 0;
+    l4sap->rttvar_us = 0;
+    l4sap->rto_us = L4RtoInitial;
+    memset(&l4sap->stats, 0, sizeof(l4sap->stats));
+    l4sap->stats_fd = -1;
+    l4sap->stats_interval_us = 0;
+    timerclear(&l4sap->stats_next);
 
-     // Initialiserer pending_data og de relaterte feltene
-     memset(l4sap->pending_data, 0, L4Payloadsize);  // Nullstiller bufferet
-     l4sap->pending_len = 0;       // Ingen ventende data
-     l4sap->has_pending_data = 0;  // Ingen ventende data
+    // Rammene til mottaksringen allokeres én gang, så mottak mens vi
+    // sender aldri trenger malloc
+    l4sap->frames = framepool_create(L2Framesize, L4RecvFrames);
+    if (l4sap->frames == NULL) {
+        LOG_ERROR("Error mallocing L4 receive frames\n");
+        exit(EXIT_FAILURE);
+    }
+    l4sap->recv_head = 0;
+    l4sap->recv_count = 0;
+
+    // Vindusmodus er av til l4sap_set_window kalles
+    l4sap->window_size = 1;
+    l4sap->peer_window = 0;
+    l4sap->send_base = 0;
+    l4sap->send_next = 0;
+    l4sap->recv_next = 0;
+    l4sap->retrans_attempts = 0;
+    timerclear(&l4sap->last_progress);
+    l4sap->dup_acks = 0;
+    timerclear(&l4sap->retrans_deadline);
+    l4sap->window = NULL;
+    l4sap->ack_pending = 0;
+    l4sap->rx_frames = NULL;
+    l4sap->rx_count = 0;
+    l4sap->rx_pos = 0;
 
     return l4sap;
 }
 
 
+L4SAP* l4sap_create( const char* server_ip, int server_port )
+{
+    // Oppretter en L2-klient som legges inn i L4-klienten
+    L2SAP* l2 = l2sap_create(server_ip, server_port);
+    return l4sap_init(l2);
+}
+
+
+L4SAP* l4sap_server_create( int port )
+{
+    // Serveren kjenner ikke klienten før første pakke kommer, så
+    // L2-serveren lærer adressen fra det den tar imot
+    L2SAP* l2 = l2sap_server_create(port);
+    if (l2 == NULL) {
+        return NULL;
+    }
+    return l4sap_init(l2);
+}
+
+
+/* Mottaksringen (se L4RecvSlots) */
+static inline int ring_full(const L4SAP* l4) {
+    return l4->recv_count == L4RecvSlots;
+}
+
+// Legger en ramme fra l4->frames bakerst i ringen; payloaden er len
+// bytes fra payload, som ligger inne i frame. Ringen eier rammen etterpå.
+// Kalleren har sjekket at det er plass.
+static void ring_push(L4SAP* l4, uint8_t* frame, const uint8_t* payload, int len) {
+    struct L4RecvSlot* slot = &l4->recv_ring[(l4->recv_head + l4->recv_count) % L4RecvSlots];
+    slot->frame = frame;
+    slot->offset = (uint16_t)(payload - frame);
+    slot->len = len;
+    l4->recv_count++;
+}
+
+// Kopierer payload inn i en ledig ramme og legger den i ringen. Det er
+// alltid en ledig ramme når ringen ikke er full (se L4RecvFrames)
+static void ring_push_copy(L4SAP* l4, const uint8_t* payload, int len) {
+    uint8_t* frame = framepool_get(l4->frames);
+    memcpy(frame, payload, len);
+    ring_push(l4, frame, frame, len);
+}
+
+// Tar eldste payload ut av ringen, kuttet til len bytes, og gir rammen
+// tilbake til poolen
+static int ring_pop(L4SAP* l4, uint8_t* data, int len) {
+    struct L4RecvSlot* slot = &l4->recv_ring[l4->recv_head];
+    if (len > slot->len) {
+        len = slot->len;
+    }
+    memcpy(data, slot->frame + slot->offset, len);
+    framepool_put(l4->frames, slot->frame);
+    slot->frame = NULL;
+    l4->recv_head = (l4->recv_head + 1) % L4RecvSlots;
+    l4->recv_count--;
+    return len;
+}
+
+
+/* RTT-estimering (Jacobson/Karels)
+ *
+ * srtt = 7/8 srtt + 1/8 r, rttvar = 3/4 rttvar + 1/4 |srtt - r| og
+ * rto = srtt + 4 rttvar, begrenset til [L4RtoMin, L4RtoMax].
+ */
+static void rtt_sample(L4SAP* l4, const struct timeval* sent) {
+    struct timeval now, diff;
+    gettimeofday(&now, NULL);
+    timersub(&now, sent, &diff);
+    long r = diff.tv_sec * 1000000L + diff.tv_usec;
+    if (r < 0) {
+        return;
+    }
+
+    // Bøtte etter log2 av RTT, se L4RttBuckets
+    int bucket = r < 32 ? 0 : (63 - __builtin_clzl((unsigned long)r)) - 4;
+    if (bucket >= L4RttBuckets) {
+        bucket = L4RttBuckets - 1;
+    }
+    l4->stats.rtt_hist[bucket]++;
+
+    if (l4->srtt_us == 0) {
+        // Første måling
+        l4->srtt_us = r > 0 ? r : 1;
+        l4->rttvar_us = r / 2;
+    } else {
+        long err = r - l4->srtt_us;
+        if (err < 0) {
+            err = -err;
+        }
+        l4->rttvar_us += (err - l4->rttvar_us) / 4;
+        l4->srtt_us += (r - l4->srtt_us) / 8;
+    }
+
+    l4->rto_us = l4->srtt_us + 4 * l4->rttvar_us;
+    if (l4->rto_us < L4RtoMin) {
+        l4->rto_us = L4RtoMin;
+    } else if (l4->rto_us > L4RtoMax) {
+        l4->rto_us = L4RtoMax;
+    }
+}
+
+// Eksponentiell backoff etter en timeout
+static void rtt_backoff(L4SAP* l4) {
+    l4->rto_us *= 2;
+    if (l4->rto_us > L4RtoMax) {
+        l4->rto_us = L4RtoMax;
+    }
+}
+
+static void rtt_timeout(const L4SAP* l4, struct timeval* tv) {
+    tv->tv_sec = l4->rto_us / 1000000;
+    tv->tv_usec = l4->rto_us % 1000000;
+}
+
+// Sant når vi har prøvd nok ganger og det har gått minst L4GiveUpUs
+// siden since uten fremgang
+static int give_up_due(int attempts, const struct timeval* since) {
+    if (attempts < L4GiveUpAttempts) {
+        return 0;
+    }
+    struct timeval now, diff;
+    gettimeofday(&now, NULL);
+    timersub(&now, since, &diff);
+    return diff.tv_sec * 1000000L + diff.tv_usec >= L4GiveUpUs;
+}
+
+
+int l4sap_get_rtt( const L4SAP* l4, long* srtt_us, long* rttvar_us, long* rto_us )
+{
+    if (srtt_us) *srtt_us = l4->srtt_us;
+    if (rttvar_us) *rttvar_us = l4->rttvar_us;
+    if (rto_us) *rto_us = l4->rto_us;
+    return l4->srtt_us != 0;
+}
+
+
+unsigned long l4sap_get_retransmits( const L4SAP* l4 )
+{
+    return l4->stats.retransmits;
+}
+
+
+void l4sap_get_stats( const L4SAP* l4, L4Stats* l4stats, L2Stats* l2stats )
+{
+    if (l4stats) *l4stats = l4->stats;
+    if (l2stats) l2sap_get_stats(l4->l2sap, l2stats);
+}
+
+
+int l4sap_dump_stats( const L4SAP* l4, int fd )
+{
+    const L4Stats* s = &l4->stats;
+    L2Stats l2;
+    l2sap_get_stats(l4->l2sap, &l2);
+
+    // Bygger hele linjen først, så den kommer i ett write-kall
+    char line[1024];
+    int n = snprintf(line, sizeof(line),
+        "l4 data_sent=%llu data_received=%llu bytes_sent=%llu bytes_received=%llu "
+        "retransmits=%llu timeouts=%llu dup_data=%llu acks=%llu stray_acks=%llu resets=%llu "
+        "srtt_us=%ld rto_us=%ld rtt_hist=",
+        (unsigned long long)s->data_sent, (unsigned long long)s->data_received,
+        (unsigned long long)s->bytes_sent, (unsigned long long)s->bytes_received,
+        (unsigned long long)s->retransmits, (unsigned long long)s->timeouts,
+        (unsigned long long)s->dup_data, (unsigned long long)s->acks_received,
+        (unsigned long long)s->stray_acks, (unsigned long long)s->resets_received,
+        l4->srtt_us, l4->rto_us);
+    for (int i = 0; i < L4RttBuckets; i++) {
+        n += snprintf(line + n, sizeof(line) - n, "%s%llu", i ? "," : "",
+                      (unsigned long long)s->rtt_hist[i]);
+    }
+    n += snprintf(line + n, sizeof(line) - n,
+        " l2 frames_sent=%llu frames_received=%llu bytes_sent=%llu bytes_received=%llu "
+        "checksum_errors=%llu short_frames=%llu send_errors=%llu timeouts=%llu\n",
+        (unsigned long long)l2.frames_sent, (unsigned long long)l2.frames_received,
+        (unsigned long long)l2.bytes_sent, (unsigned long long)l2.bytes_received,
+        (unsigned long long)l2.checksum_errors, (unsigned long long)l2.short_frames,
+        (unsigned long long)l2.send_errors, (unsigned long long)l2.timeouts);
+
+    return write(fd, line, n) == n ? 0 : -1;
+}
+
+
+void l4sap_set_stats_dump( L4SAP* l4, int fd, int interval_ms )
+{
+    l4->stats_fd = fd;
+    l4->stats_interval_us = interval_ms > 0 ? interval_ms * 1000L : 1000000L;
+    gettimeofday(&l4->stats_next, NULL);
+    struct timeval interval = { l4->stats_interval_us / 1000000, l4->stats_interval_us % 1000000 };
+    timeradd(&l4->stats_next, &interval, &l4->stats_next);
+}
+
+
+// Kalles først i de offentlige funksjonene. Uten dump er det bare én
+// sammenligning; med dump et gettimeofday-kall (vDSO, ingen syscall).
+static inline void stats_tick(L4SAP* l4) {
+    if (l4->stats_fd < 0) {
+        return;
+    }
+    struct timeval now;
+    gettimeofday(&now, NULL);
+    if (timercmp(&now, &l4->stats_next, <)) {
+        return;
+    }
+    l4sap_dump_stats(l4, l4->stats_fd);
+    struct timeval interval = { l4->stats_interval_us / 1000000, l4->stats_interval_us % 1000000 };
+    timeradd(&now, &interval, &l4->stats_next);
+}
+
+
+// Slår på vindusmotoren. Når l4->window er satt, går all trafikk
+// gjennom den i stedet for den opprinnelige stop-and-wait-koden.
+static int window_alloc(L4SAP* l4) {
+    if (l4->window != NULL) {
+        return 0;
+    }
+
+    l4->window = malloc(L4MaxWindow * sizeof(struct L4SendSlot));
+    l4->rx_frames = malloc(L2MaxBatch * L2Framesize);
+    if (l4->window == NULL || l4->rx_frames == NULL) {
+        LOG_ERROR("Error mallocing send window\n");
+        free(l4->window);
+        free(l4->rx_frames);
+        l4->window = NULL;
+        l4->rx_frames = NULL;
+        return -1;
+    }
+    return 0;
+}
+
+
+int l4sap_set_window( L4SAP* l4, int window_size )
+{
+    if (window_size < 1) {
+        return -1;
+    }
+    if (window_size > L4MaxWindow) {
+        window_size = L4MaxWindow;
+    }
+
+    if (window_size > 1 && window_alloc(l4) < 0) {
+        return -1;
+    }
+
+    l4->window_size = window_size;
+    return window_size;
+}
+
+
+/* Vindusmodus (Go-Back-N)
+ *
+ * Samme kode håndterer både peer med vindusstøtte og en vanlig
+ * stop-and-wait-peer: mot en vanlig peer er sekvensrommet 2 og vinduet
+ * 1, og da er kumulative ACKs (ackno = neste forventede seq) nøyaktig
+ * det samme som seq ^ 1.
+ */
+
+// Maske for sekvensrommet: 256 mot peer med vindusstøtte, ellers 2
+static inline uint8_t window_seq_mask(const L4SAP* l4) {
+    return l4->peer_window ? 0xff : 0x1;
+}
+
+static inline int window_effective(const L4SAP* l4) {
+    return l4->peer_window ? l4->window_size : 1;
+}
+
+// Antall pakker som er sendt, men ikke kvittert
+static inline int window_outstanding(const L4SAP* l4) {
+    return (uint8_t)(l4->send_next - l4->send_base) & window_seq_mask(l4);
+}
+
+static void window_arm_timer(L4SAP* l4) {
+    struct timeval now, rto;
+    gettimeofday(&now, NULL);
+    rtt_timeout(l4, &rto);
+    timeradd(&now, &rto, &l4->retrans_deadline);
+}
+
+static int window_xmit(L4SAP* l4, uint8_t seq) {
+    struct L4SendSlot* slot = &l4->window[seq % L4MaxWindow];
+    gettimeofday(&slot->sent, NULL);
+    return l2sap_sendto(l4->l2sap, slot->packet, slot->len);
+}
+
+// Go-Back-N: sender alle ukvitterte pakker på nytt, med så få
+// sendmmsg-kall som mulig.
+// backoff er 0 ved rask retransmisjon, der timeren ikke har gått ut.
+static void window_retransmit(L4SAP* l4, int backoff) {
+    int outstanding = window_outstanding(l4);
+    uint8_t mask = window_seq_mask(l4);
+    struct iovec frames[L4MaxWindow];
+    struct timeval now;
+    gettimeofday(&now, NULL);
+
+    for (int i = 0; i < outstanding; i++) {
+        struct L4SendSlot* slot = &l4->window[((l4->send_base + i) & mask) % L4MaxWindow];
+        slot->retransmitted = 1;
+        slot->sent = now;
+        frames[i].iov_base = slot->packet;
+        frames[i].iov_len = slot->len;
+    }
+    if (l2sap_sendto_batch(l4->l2sap, frames, outstanding) != outstanding) {
+        LOG_WARN("WINDOW: feil ved retransmisjon\n");
+    }
+    l4->stats.retransmits += outstanding;
+    if (backoff) {
+        rtt_backoff(l4);
+    }
+    window_arm_timer(l4);
+}
+
+// Kumulativ ACK: ackno er neste seq peer forventer
+static int window_send_ack(L4SAP* l4) {
+    struct L4Header ack_header;
+    ack_header.type = L4_ACK;
+    ack_header.seqno = 0;
+    ack_header.ackno = l4->recv_next;
+    ack_header.mbz = L4_CAP_WINDOW;
+
+    if (l2sap_sendto(l4->l2sap, (uint8_t*)&ack_header, L4Headersize) != 1) {
+        LOG_WARN("WINDOW: feil ved avsending av ack\n");
+        return -1;
+    }
+    return ack_header.ackno;
+}
+
+/* Behandler én mottatt ramme i vindusmodus.
+ * Hvis data != NULL leveres ny DATA i rekkefølge rett til kalleren, og
+ * funksjonen returnerer antall bytes. Ellers legges den i mottaksringen
+ * (L4_DATA_RECEIVED) hvis det er plass. Andre returverdier:
+ * L4_QUIT, L4_ACK_RECEIVED og L4_NODATA_RECEIVED.
+ */
+static int window_handle_frame(L4SAP* l4, uint8_t* frame, int received, uint8_t* data, int len) {
+
+    if (received < L4Headersize) {
+        return L4_NODATA_RECEIVED;
+    }
+
+    struct L4Header* recv_header = (struct L4Header*)frame;
+
+    // Første pakke med L4_CAP_WINDOW slår på hele sekvensrommet.
+    // Det skjer senest ved ack for seq 0, der begge varianter er like.
+    if (recv_header->mbz & L4_CAP_WINDOW) {
+        l4->peer_window = 1;
+    }
+
+    uint8_t mask = window_seq_mask(l4);
+
+    if (recv_header->type == L4_RESET) {
+        l4->stats.resets_received++;
+        l4->reset = 1;
+        return L4_QUIT;
+
+    } else if (recv_header->type == L4_ACK) {
+        int acked = (uint8_t)(recv_header->ackno - l4->send_base) & mask;
+        if (acked == 0 && window_outstanding(l4) > 0) {
+            // Peer mangler send_base: tredje like ack gir rask
+            // retransmisjon i stedet for å vente på timeren
+            l4->stats.stray_acks++;
+            if (++l4->dup_acks == 3) {
+                window_retransmit(l4, 0);
+            }
+            return L4_NODATA_RECEIVED;
+        }
+        if (acked == 0 || acked > window_outstanding(l4)) {
+            l4->stats.stray_acks++;
+            return L4_NODATA_RECEIVED; // gammel eller ugyldig ack
+        }
+        l4->stats.acks_received++;
+
+        // Måler RTT på den nyeste kvitterte pakken (Karn: bare hvis
+        // den ikke er sendt på nytt)
+        struct L4SendSlot* newest = &l4->window[((l4->send_base + acked - 1) & mask) % L4MaxWindow];
+        if (!newest->retransmitted) {
+            rtt_sample(l4, &newest->sent);
+        }
+
+        l4->send_base = (l4->send_base + acked) & mask;
+        l4->retrans_attempts = 0;
+        gettimeofday(&l4->last_progress, NULL);
+        l4->dup_acks = 0;
+        if (window_outstanding(l4) > 0) {
+            window_arm_timer(l4);
+        }
+        return L4_ACK_RECEIVED;
+
+    } else if (recv_header->type == L4_DATA) {
+        uint8_t* payload = frame + L4Headersize;
+        int payload_size = received - L4Headersize;
+
+        // Utenfor rekkefølge eller duplikat: ny ack for det vi har
+        if (recv_header->seqno != l4->recv_next) {
+            l4->stats.dup_data++;
+            window_send_ack(l4);
+            return L4_NODATA_RECEIVED;
+        }
+
+        if (data != NULL) {
+            if (payload_size > len) {
+                payload_size = len;
+            }
+            memcpy(data, payload, payload_size);
+        } else if (!ring_full(l4)) {
+            ring_push_copy(l4, payload, payload_size);
+        } else {
+            // Ingen plass: kvitterer ikke, så peer sender på nytt
+            window_send_ack(l4);
+            return L4_NODATA_RECEIVED;
+        }
+
+        l4->stats.data_received++;
+        l4->stats.bytes_received += received - L4Headersize;
+
+        // Kvitteringen utsettes til vi har behandlet resten av
+        // rammene fra samme batch (se window_wait)
+        l4->recv_next = (l4->recv_next + 1) & mask;
+        l4->ack_pending = 1;
+        return data != NULL ? payload_size : L4_DATA_RECEIVED;
+    }
+
+    return L4_NODATA_RECEIVED;
+}
+
+// Retransmisjonsfristen har gått ut.
+// Gir vi opp, blir vinduet liggende som det er: peer venter fortsatt
+// på send_base, så å hoppe over pakkene ville gjort alle senere pakker
+// og acker ugyldige. Entiteten merkes i stedet som død (l4->failed)
+static int window_expire(L4SAP* l4) {
+    if (l4->failed) {
+        return L4_SEND_FAILED;
+    }
+    if (window_outstanding(l4) == 0) {
+        return L4_NODATA_RECEIVED;
+    }
+    if (give_up_due(l4->retrans_attempts, &l4->last_progress)) {
+        LOG_WARN("WINDOW: ingen fremgang etter %d retransmisjoner, gir opp\n", l4->retrans_attempts);
+        l4->failed = 1;
+        return L4_SEND_FAILED;
+    }
+    if (l4->retrans_attempts < UINT8_MAX) {
+        l4->retrans_attempts++;
+    }
+    l4->stats.timeouts++;
+    LOG_DEBUG("WINDOW: timeout, sender %d pakker på nytt\n", window_outstanding(l4));
+    window_retransmit(l4, 1);
+    return L4_NODATA_RECEIVED;
+}
+
+// Behandler neste ramme, eller venter på en ny batch eller timeout.
+// Med nonblock venter vi ikke, og timeren sjekkes ikke; da returneres
+// L4_WOULD_BLOCK når det ikke ligger flere rammer klare.
+static int window_next_event(L4SAP* l4, uint8_t* data, int len, int nonblock) {
+
+    // Behandler først rammer som ligger igjen fra forrige batch
+    while (l4->rx_pos < l4->rx_count) {
+        int i = l4->rx_pos++;
+        if (l4->rx_lens[i] >= 0) {
+            uint8_t* payload = l4->rx_frames + i * L2Framesize + L2Headersize;
+            return window_handle_frame(l4, payload, l4->rx_lens[i], data, len);
+        }
+    }
+
+    struct timeval timeout;
+    struct timeval* tp = NULL;
+
+    if (nonblock) {
+        timerclear(&timeout);
+        tp = &timeout;
+    } else if (window_outstanding(l4) > 0) {
+        struct timeval now;
+        gettimeofday(&now, NULL);
+        if (timercmp(&now, &l4->retrans_deadline, <)) {
+            timersub(&l4->retrans_deadline, &now, &timeout);
+        } else {
+            timerclear(&timeout);
+        }
+        tp = &timeout;
+    }
+
+    int received = l2sap_recvfrom_batch(l4->l2sap, l4->rx_frames, L2MaxBatch, l4->rx_lens, tp);
+    if (received < 0) {
+        return L4_NODATA_RECEIVED;
+    }
+
+    if (received == L2_TIMEOUT) {
+        return nonblock ? L4_WOULD_BLOCK : window_expire(l4);
+    }
+
+    l4->rx_count = received;
+    l4->rx_pos = 0;
+    return window_next_event(l4, data, len, nonblock);
+}
+
+/* Venter på én hendelse. Med ukvitterte pakker venter vi maks til
+ * retransmisjonsfristen; uten venter vi evig.
+ * Ved timeout sendes vinduet på nytt, til vi gir opp (se L4GiveUpUs).
+ *
+ * Rammer hentes L2MaxBatch om gangen med l2sap_recvfrom_batch og
+ * behandles én per kall. Ny data fra samme batch kvitteres med én
+ * kumulativ ACK når batchen er tom, eller før vi returnerer noe annet
+ * enn L4_NODATA_RECEIVED eller L4_WOULD_BLOCK til kalleren.
+ */
+static int window_wait(L4SAP* l4, uint8_t* data, int len, int nonblock) {
+
+    if (l4->failed) {
+        return L4_SEND_FAILED;
+    }
+
+    int result = window_next_event(l4, data, len, nonblock);
+
+    if (l4->ack_pending && (l4->rx_pos >= l4->rx_count
+                            || (result != L4_NODATA_RECEIVED && result != L4_WOULD_BLOCK))) {
+        window_send_ack(l4);
+        l4->ack_pending = 0;
+    }
+    return result;
+}
+
+// Legger en ny pakke i vinduet og sender den. Det må være plass.
+static void window_enqueue(L4SAP* l4, const uint8_t* data, int len) {
+
+    uint8_t seq = l4->send_next;
+    struct L4SendSlot* slot = &l4->window[seq % L4MaxWindow];
+
+    struct L4Header header;
+    header.type = L4_DATA;
+    header.seqno = seq;
+    header.ackno = 0;
+    header.mbz = L4_CAP_WINDOW;
+
+    memcpy(slot->packet, &header, L4Headersize);
+    memcpy(slot->packet + L4Headersize, data, len);
+    slot->len = L4Headersize + len;
+    slot->retransmitted = 0;
+
+    if (window_outstanding(l4) == 0) {
+        l4->retrans_attempts = 0;
+        gettimeofday(&l4->last_progress, NULL);
+        window_arm_timer(l4);
+    }
+    l4->send_next = (seq + 1) & window_seq_mask(l4);
+    l4->stats.data_sent++;
+    l4->stats.bytes_sent += len;
+
+    if (window_xmit(l4, seq) != 1) {
+        LOG_WARN("WINDOW: feil ved avsending, venter på retransmisjon\n");
+    }
+}
+
+static int l4sap_send_window(L4SAP* l4, const uint8_t* data, int len) {
+
+    if (l4->failed) {
+        return L4_SEND_FAILED;
+    }
+    if (len > L4Payloadsize) {
+        len = L4Payloadsize;
+    }
+
+    // Venter på plass i vinduet
+    while (window_outstanding(l4) >= window_effective(l4)) {
+        int result = window_wait(l4, NULL, 0, 0);
+        if (result == L4_QUIT || result == L4_SEND_FAILED) {
+            return result;
+        }
+    }
+
+    window_enqueue(l4, data, len);
+
+    // Mot en stop-and-wait-peer returnerer vi ikke før acken er mottatt
+    if (window_effective(l4) == 1) {
+        int result = l4sap_flush(l4);
+        if (result < 0) {
+            return result;
+        }
+    }
+
+    return len;
+}
+
+
+int l4sap_flush( L4SAP* l4 )
+{
+    if (l4->window == NULL) {
+        return 0; // stop-and-wait har aldri ukvitterte pakker
+    }
+
+    while (window_outstanding(l4) > 0) {
+        int result = window_wait(l4, NULL, 0, 0);
+        if (result == L4_QUIT || result == L4_SEND_FAILED) {
+            return result;
+        }
+    }
+    return 0;
+}
+
+
+int l4sap_send_nb( L4SAP* l4, const uint8_t* data, int len )
+{
+    stats_tick(l4);
+    if (window_alloc(l4) < 0) {
+        return -1;
+    }
+    if (l4->reset) {
+        return L4_QUIT;
+    }
+    if (l4->failed) {
+        return L4_SEND_FAILED;
+    }
+    if (len > L4Payloadsize) {
+        len = L4Payloadsize;
+    }
+
+    // Leser inn ACKer som allerede har kommet før vi gir opp
+    while (window_outstanding(l4) >= window_effective(l4)) {
+        int result = window_wait(l4, NULL, 0, 1);
+        if (result == L4_WOULD_BLOCK || result == L4_QUIT || result == L4_SEND_FAILED) {
+            return result;
+        }
+    }
+
+    window_enqueue(l4, data, len);
+    return len;
+}
+
+
+int l4sap_recv_nb( L4SAP* l4, uint8_t* data, int len )
+{
+    stats_tick(l4);
+    if (window_alloc(l4) < 0) {
+        return -1;
+    }
+
+    if (data != NULL && l4->recv_count > 0) {
+        return ring_pop(l4, data, len);
+    }
+
+    while (1) {
+        int result = window_wait(l4, data, len, 1);
+        if (result >= 0 || result == L4_WOULD_BLOCK || result == L4_QUIT || result == L4_SEND_FAILED) {
+            return result;
+        }
+    }
+}
+
+
+int l4sap_timer_nb( L4SAP* l4, struct timeval* left )
+{
+    stats_tick(l4);
+    if (l4->window == NULL || window_outstanding(l4) == 0) {
+        return 0;
+    }
+
+    struct timeval now;
+    gettimeofday(&now, NULL);
+    if (!timercmp(&now, &l4->retrans_deadline, <)) {
+        if (window_expire(l4) == L4_SEND_FAILED) {
+            return L4_SEND_FAILED;
+        }
+        gettimeofday(&now, NULL);
+    }
+
+    if (left != NULL) {
+        if (timercmp(&now, &l4->retrans_deadline, <)) {
+            timersub(&l4->retrans_deadline, &now, left);
+        } else {
+            timerclear(left);
+        }
+    }
+    return 1;
+}
+
+
+int l4sap_outstanding( const L4SAP* l4 )
+{
+    return l4->window != NULL ? window_outstanding(l4) : 0;
+}
+
+
 int l4sap_send( L4SAP* l4, const uint8_t* data, int len )
 {
-    
+    stats_tick(l4);
+
+    if (l4->window != NULL) {
+        return l4sap_send_window(l4, data, len);
+    }
+
     // Kutter pakken om datamengden er for stor
     // Her oppdaterer vi kun lengden, fordi memcpy brukes senere
     // for å faktisk sende pakken, og da definerer vi lengden med len
@@ -66,62 +780,93 @@ int l4sap_send( L4SAP* l4, const uint8_t* data, int len )
     header.ackno = 0; // ack er ikke relevant her, settes alltid til 0
     header.mbz = 0;
 
-    // Legger headeren på en buffer med datapakken
-    int packetsize = L4Headersize + len;
-    uint8_t* packet = malloc(packetsize);
-    if (packet == NULL) {
-        perror("Error mallocing space for buffer");
-        return -1;
-    }
-
-    memcpy(packet, &header, L4Headersize); // Legger først inn header
-    memcpy(packet+L4Headersize, data, len); // Så datapakken 
+    // Header og datapakke sendes som to iovecs, så vi slipper å
+    // allokere og kopiere dem sammen til en pakke
     // Her er len oppdatert dersom pakken var for stor, så den overskrider ikke strl
+    struct iovec packet[2];
+    packet[0].iov_base = &header;
+    packet[0].iov_len = L4Headersize;
+    packet[1].iov_base = (void*)data;
+    packet[1].iov_len = len;
 
     int result = L4_SEND_FAILED;
+    struct timeval first_sent; // for RTT-måling av første forsøk
+
+    // Tar imot rett i en ramme fra poolen, så ny DATA kan legges i
+    // ringen uten kopiering. Den siste ledige rammen er alltid vår,
+    // fordi ringen har én plass mindre enn poolen har rammer
+    uint8_t* frame = framepool_get(l4->frames);
     
-    // Forsøker avsending av pakke maks 4 ganger
-    for (int attempt = 1; attempt <= 4; attempt++) {
+    // Forsøker avsending av pakke til vi har prøvd minst 4 ganger og
+    // L4GiveUpUs har gått siden første forsøk
+    for (int attempt = 1; attempt == 1 || !give_up_due(attempt - 1, &first_sent); attempt++) {
 
-        int send = l2sap_sendto(l4->l2sap, packet, len+L4Headersize);
+        if (attempt == 1) {
+            gettimeofday(&first_sent, NULL);
+            l4->stats.data_sent++;
+            l4->stats.bytes_sent += len;
+        } else {
+            l4->stats.retransmits++;
+        }
+        int send = l2sap_sendv(l4->l2sap, packet, 2);
         if (send != 1) {
             perror("Error sending frame from L2");
             continue;
         }  
         
-        // Resetter timeout hver runde 
-        l4->timeout.tv_sec = 1;
-        l4->timeout.tv_usec = 0;
+        // Resetter timeout hver runde, fra den adaptive RTO-en
+        rtt_timeout(l4, &l4->timeout);
 
-        uint8_t buffer[L2Framesize]; 
+        uint8_t* buffer; // L4-pakken inne i frame
         int received = 0; // Boolean for mottatt data
         int is_ack_received = 0; // Boolean for mottatt ack
 
         // Mottar data fortløpende så lenge vi ikke har timeout
         while(1) {
-            received = l2sap_recvfrom_timeout(l4->l2sap, buffer, sizeof(buffer), &l4->timeout);
+            received = l2sap_recvframe_timeout(l4->l2sap, frame, L2Framesize, &l4->timeout, &buffer);
             if (received <= 0) {
                 break; // Timeout hvis vi ikke mottar data fra L2
             }
+            if (received < L4Headersize) {
+                continue; // For kort til å ha en L4-header
+            }
 
             struct L4Header* recv_header = (struct L4Header*)buffer;
 
             // Sjekker om vi har mottatt ack og den er riktig
             if (recv_header->type == L4_ACK && recv_header->ackno == (l4->current_seq_send ^ 1)) {
                 is_ack_received = 1; // Ack ok
+                l4->stats.acks_received++;
+                if (attempt == 1) {
+                    rtt_sample(l4, &first_sent); // Karn: ikke etter retransmisjon
+                }
                 l4->current_seq_send ^= 1; // Oppdater neste seq som skal sendes
                 result = len; // Oppdater returverdi
                 break; 
 
             // Om vi mottar feil ack, data eller reset
             } else {
+                if (recv_header->type == L4_ACK) {
+                    l4->stats.stray_acks++;
+                }
                 if (recv_header->type == L4_RESET) {
+                    // Kalleren eier fortsatt entiteten og sletter den,
+                    // som i vindusmodus (se l4sap.h)
+                    l4->stats.resets_received++;
                     l4->reset = 1;
-                    l4sap_destroy(l4);
+                    framepool_put(l4->frames, frame);
                     return L4_QUIT;
         
-                } else if (recv_header->type = L4_DATA) {
-                
+                } else if (recv_header->type == L4_DATA) {
+
+                    // Ny pakke uten plass i ringen kvitteres ikke, så
+                    // peer sender den på nytt i stedet for at den går tapt
+                    int is_new = recv_header->seqno != l4->last_seq_received;
+                    if (is_new && ring_full(l4)) {
+                        LOG_DEBUG("SEND: mottaksringen er full, kvitterer ikke\n");
+                        continue;
+                    }
+
                     int sent_ack = send_ack(l4, recv_header); 
                     if (sent_ack < 0) {
                         perror("Error sending ack");
@@ -130,22 +875,21 @@ int l4sap_send( L4SAP* l4, const uint8_t* data, int len )
                     l4->last_ack_sent = sent_ack;
 
                     // Sjekker om mottatt pakke er duplikat
-                    // Hvis duplikat: ignorer, hvis ny pakke: legg i buffer
-                    if (recv_header->seqno == l4->last_seq_received) { // Duplikat
-                        l4->last_seq_received = recv_header->seqno;
-                        printf("SEND: mottok duplikat data-pakke, går videre\n");
+                    // Hvis duplikat: ignorer, hvis ny pakke: legg i ringen
+                    if (!is_new) {
+                        l4->stats.dup_data++;
+                        LOG_TRACE("SEND: mottok duplikat data-pakke, går videre\n");
                         continue;
                     } 
 
-                    // Ny pakke: legger på buffer og oppdaterer last seq recv
-                    printf("SEND: mottok ny data-pakke. Legger på buffer\n");
-                    if (!l4->has_pending_data) {
-                        l4->last_seq_received = recv_header->seqno;
-                        memcpy(l4->pending_data, buffer + L4Headersize, received - L4Headersize);
-                        l4->pending_len = received - L4Headersize;
-                        l4->has_pending_data = 1;
-                        continue;
-                    }
+                    // Ny pakke: legger i ringen og oppdaterer last seq recv
+                    LOG_TRACE("SEND: mottok ny data-pakke. Legger i ringen\n");
+                    l4->last_seq_received = recv_header->seqno;
+                    ring_push(l4, frame, buffer + L4Headersize, received - L4Headersize);
+                    frame = framepool_get(l4->frames);
+                    l4->stats.data_received++;
+                    l4->stats.bytes_received += received - L4Headersize;
+                    continue;
                 }
         
             }
@@ -153,16 +897,16 @@ int l4sap_send( L4SAP* l4, const uint8_t* data, int len )
 
         // If ACK was not received, increment attempt and retry
         if (!is_ack_received) {
-            printf("SEND: Ingen ACK, prøver på nytt...\n");
+            l4->stats.timeouts++;
+            rtt_backoff(l4);
+            LOG_DEBUG("SEND: Ingen ACK, prøver på nytt...\n");
         } else {
-            printf("SEND: ACK mottatt, avslutter sending...\n");
+            LOG_TRACE("SEND: ACK mottatt, avslutter sending...\n");
             break; // Exit attempts, as we received ACK    
         }
     }
 
-    // Frigjør minne
-    free(packet);
-
+    framepool_put(l4->frames, frame);
     return result; // Return result of sending
 }
 
@@ -196,12 +940,12 @@ int send_ack(L4SAP* l4, struct L4Header* recv_header) {
     // Sender headeren via L2
     int send = l2sap_sendto(l4->l2sap, (uint8_t*)&ack_header, L4Headersize);
     if (send != 1) {
-        printf("SEND ACK: feil ved avsending av ack\n");
+        LOG_WARN("SEND ACK: feil ved avsending av ack\n");
         perror("Error sending ack from L2");
         return -1;
     }
 
-    printf("SEND ACK: Sendte ACK fra klient til server: seq = %d, ack = %d\n", recv_header->seqno, ack_header.ackno);
+    LOG_TRACE("SEND ACK: Sendte ACK fra klient til server: seq = %d, ack = %d\n", recv_header->seqno, ack_header.ackno);
     //l4->last_ack_sent = ack_header.ackno;
     return ack_header.ackno;
 }
@@ -229,21 +973,31 @@ int send_ack(L4SAP* l4, struct L4Header* recv_header) {
  // Ansvaret til denne funksjonen er å motta datapakker og sende acks
 int l4sap_recv( L4SAP* l4, uint8_t* data, int len ) {
 
-    // Returnerer fra bufferet om det ligger noe data der
-    if (l4->has_pending_data) {
-        memcpy(data, l4->pending_data, l4->pending_len);
-        l4->has_pending_data = 0;
-        return l4->pending_len;
+    stats_tick(l4);
+
+    // Returnerer fra ringen om det ligger noe data der, i rekkefølge
+    if (l4->recv_count > 0) {
+        return ring_pop(l4, data, len);
+    }
+
+    if (l4->window != NULL) {
+        while (1) {
+            int result = window_wait(l4, data, len, 0);
+            if (result >= 0 || result == L4_QUIT || result == L4_SEND_FAILED) {
+                return result;
+            }
+        }
     }
 
     // Loopen går evig til det kommer en ny data-pakke
-    uint8_t buffer[L2Framesize];
+    uint8_t frame[L2Framesize];
+    uint8_t* buffer; // L4-pakken inne i frame
 
     while(1) {
 
-        int received = l2sap_recvfrom(l4->l2sap, buffer, sizeof(buffer));
-        if (received < 0) {
-            printf("Error recieving frame from L2\n");
+        int received = l2sap_recvframe_timeout(l4->l2sap, frame, sizeof(frame), NULL, &buffer);
+        if (received < L4Headersize) {
+            LOG_DEBUG("Error recieving frame from L2\n");
             continue;
         }
 
@@ -252,17 +1006,19 @@ int l4sap_recv( L4SAP* l4, uint8_t* data, int len ) {
 
         // Hvis en reset-pakke blir sendt 
         if (recv_header->type == L4_RESET) {
+            l4->stats.resets_received++;
             l4->reset = 1;
             return L4_QUIT;
 
         } else if (recv_header->type == L4_ACK) {
-            printf("-------------------RECV: mottok ack\n");
+            LOG_TRACE("RECV: mottok ack\n");
+            l4->stats.stray_acks++;
             
 
             // Hvis datapakke: send ack og sjekk om duplikat, hvis duplikat fortsett å vent på ny pakke
         } else if (recv_header->type == L4_DATA) {
 
-            printf("RECV: Mottatt DATA-pakke fra server med seq = %d\n", recv_header->seqno);
+            LOG_TRACE("RECV: Mottatt DATA-pakke fra server med seq = %d\n", recv_header->seqno);
 
             // Sender ack via hjelpefunksjon
             int sent_ack = send_ack(l4, recv_header); 
@@ -274,7 +1030,8 @@ int l4sap_recv( L4SAP* l4, uint8_t* data, int len ) {
 
             // Hvis duplikat (samme seq som forrige pakke den mottok)
             if (recv_header->seqno == l4->last_seq_received) {
-                printf("RECV: Duplikat!\n");
+                LOG_TRACE("RECV: Duplikat!\n");
+                l4->stats.dup_data++;
                 continue; // Går tilbake til start på while-løkken
             }
             
@@ -287,14 +1044,21 @@ int l4sap_recv( L4SAP* l4, uint8_t* data, int len ) {
             // Oppdaterer last ack til acken vi akkurat sendte 
             l4->last_seq_received = recv_header->seqno;
 
-            printf("RECV: last_ack_sent = %d\n", l4->last_ack_sent);
-            printf("RECV: last seq received = %d\n", l4->last_seq_received);
+            LOG_TRACE("RECV: last_ack_sent = %d\n", l4->last_ack_sent);
+            LOG_TRACE("RECV: last seq received = %d\n", l4->last_seq_received);
 
 
             // Fjerner header og returnerer payload_size
             // Oppdaterer pointer til å peke på data etter header
             uint8_t* payload = buffer + L4Headersize;
             int payload_size = received - L4Headersize;
+            l4->stats.data_received++;
+            l4->stats.bytes_received += payload_size;
+
+            // Kutter til bufferet til kalleren
+            if (payload_size > len) {
+                payload_size = len;
+            }
             memcpy(data, payload, payload_size);
 
             return payload_size;
@@ -304,6 +1068,162 @@ int l4sap_recv( L4SAP* l4, uint8_t* data, int len ) {
     return L4_QUIT;
 }
 
+// Meldingslaget
+// Første pakke er [lengde][data], resten er bare data. Pakkene sendes
+// med l4sap_send, så i vindusmodus går de i pipeline uten å vente på acker
+long l4sap_send_msg( L4SAP* l4, const uint8_t* data, size_t len )
+{
+    if (l4->msg_broken) {
+        return L4_BAD_MESSAGE;
+    }
+    if (len > UINT32_MAX) {
+        return L4_MSG_TOO_LARGE;
+    }
+
+    // Første pakke kopieres for å få lengden foran dataene
+    uint8_t first[L4Payloadsize];
+    uint32_t total = htonl((uint32_t)len);
+    memcpy(first, &total, L4MsgHeadersize);
+
+    size_t chunk = len;
+    if (chunk > (size_t)(L4Payloadsize - L4MsgHeadersize)) {
+        chunk = L4Payloadsize - L4MsgHeadersize;
+    }
+    memcpy(first + L4MsgHeadersize, data, chunk);
+
+    // Feiler en sending, kan peer ha fått pakken likevel (acken kan
+    // være borte), så vi vet ikke lenger hvor neste melding starter
+    int result = l4sap_send(l4, first, L4MsgHeadersize + (int)chunk);
+    if (result < 0) {
+        l4->msg_broken = 1;
+        return result;
+    }
+
+    // Resten sendes rett fra bufferet til kalleren
+    size_t sent = chunk;
+    while (sent < len) {
+        chunk = len - sent;
+        if (chunk > (size_t)L4Payloadsize) {
+            chunk = L4Payloadsize;
+        }
+
+        result = l4sap_send(l4, data + sent, (int)chunk);
+        if (result < 0) {
+            l4->msg_broken = 1;
+            return result;
+        }
+        sent += chunk;
+    }
+
+    LOG_TRACE("SEND_MSG: sendte melding på %zu bytes\n", len);
+    return (long)len;
+}
+
+// Meldingslaget er ute av takt med peer (se l4sap.h)
+static long msg_broken(L4SAP* l4, long result) {
+    l4->msg_broken = 1;
+    return result;
+}
+
+// Tar imot en melding til *buf. Med grow = 1 utvides bufferet med realloc
+// opptil L4MsgMaxsize, ellers kastes meldingen om den ikke får plass.
+// Pakkene leses uansett helt ut, så neste melding starter på en ny pakke
+static long msg_recv(L4SAP* l4, uint8_t** buf, size_t* cap, int grow) {
+
+    if (l4->msg_broken) {
+        return L4_BAD_MESSAGE;
+    }
+
+    uint8_t fragment[L4Payloadsize];
+
+    // Feil før første pakke er lest endrer ikke takten
+    int received = l4sap_recv(l4, fragment, sizeof(fragment));
+    if (received < 0) {
+        return received;
+    }
+    if (received < L4MsgHeadersize) {
+        LOG_WARN("RECV_MSG: første pakke mangler lengdefelt\n");
+        return msg_broken(l4, L4_BAD_MESSAGE);
+    }
+
+    uint32_t total;
+    memcpy(&total, fragment, L4MsgHeadersize);
+    total = ntohl(total);
+
+    size_t chunk = received - L4MsgHeadersize;
+    if (chunk > total) {
+        LOG_WARN("RECV_MSG: første pakke er lengre enn meldingen\n");
+        return msg_broken(l4, L4_BAD_MESSAGE);
+    }
+
+    int fits = 1;
+    if (total > *cap) {
+        fits = 0;
+        if (grow && total > L4MsgMaxsize) {
+            LOG_WARN("RECV_MSG: melding på %u bytes er over grensen på %d\n", total, L4MsgMaxsize);
+        } else if (grow) {
+            uint8_t* bigger = realloc(*buf, total);
+            if (bigger == NULL) {
+                LOG_ERROR("RECV_MSG: fikk ikke plass til melding på %u bytes\n", total);
+            } else {
+                *buf = bigger;
+                *cap = total;
+                fits = 1;
+            }
+        }
+    }
+
+    if (fits) {
+        memcpy(*buf, fragment + L4MsgHeadersize, chunk);
+    }
+
+    size_t got = chunk;
+    while (got < total) {
+        size_t left = total - got;
+
+        // Hele pakker tas imot rett i bufferet. Den siste går via
+        // fragment, så en for lang pakke ikke skriver utenfor
+        uint8_t* dst = fragment;
+        if (fits && left >= (size_t)L4Payloadsize) {
+            dst = *buf + got;
+        }
+
+        received = l4sap_recv(l4, dst, L4Payloadsize);
+        if (received < 0) {
+            return msg_broken(l4, received);
+        }
+        if (received == 0 || (size_t)received > left) {
+            LOG_WARN("RECV_MSG: pakke på %d bytes passer ikke i meldingen\n", received);
+            return msg_broken(l4, L4_BAD_MESSAGE);
+        }
+
+        if (fits && dst == fragment) {
+            memcpy(*buf + got, fragment, received);
+        }
+        got += received;
+    }
+
+    if (!fits) {
+        LOG_WARN("RECV_MSG: melding på %u bytes ble kastet\n", total);
+        return L4_MSG_TOO_LARGE;
+    }
+
+    LOG_TRACE("RECV_MSG: mottok melding på %u bytes\n", total);
+    return (long)total;
+}
+
+long l4sap_recv_msg( L4SAP* l4, uint8_t* data, size_t len )
+{
+    uint8_t* buf = data;
+    size_t cap = len;
+    return msg_recv(l4, &buf, &cap, 0);
+}
+
+long l4sap_recv_msg_alloc( L4SAP* l4, uint8_t** buf, size_t* cap )
+{
+    return msg_recv(l4, buf, cap, 1);
+}
+
 /** This function is called to terminate the L4 entity and
  *  free all of its resources.
  *  We recommend that you send several L4_RESET packets from
@@ -312,13 +1232,17 @@ int l4sap_recv( L4SAP* l4, uint8_t* data, int len ) {
  */
  void l4sap_destroy(L4SAP* l4)
  {
-    
+     // Gir ukvitterte pakker i vinduet en sjanse før vi avslutter
+     if (l4->window != NULL && !l4->reset && !l4->failed) {
+         l4sap_flush(l4);
+     }
+
      // Oppretter headeren 
      struct L4Header reset_header;
      reset_header.type = L4_RESET;
      reset_header.seqno = 0;
      reset_header.ackno = 0;
-     reset_header.mbz = 0;
+     reset_header.mbz = l4->window != NULL ? L4_CAP_WINDOW : 0;
  
      // Sender RESET mange ganger
      for (int i = 0; i < 10; i++) {
@@ -326,11 +1250,19 @@ int l4sap_recv( L4SAP* l4, uint8_t* data, int len ) {
          if (sendReset != 1) {
              perror("Error sending reset message\n");
          } else {
-             printf("Sent reset message to peer entity\n");
+             LOG_DEBUG("Sent reset message to peer entity\n");
          }
      }
  
+     // Siste utskrift, med RESET-ene over
+     if (l4->stats_fd >= 0) {
+         l4sap_dump_stats(l4, l4->stats_fd);
+     }
+
      // Frigjør minnet
      l2sap_destroy(l4->l2sap);
+     free(l4->window);
+     free(l4->rx_frames);
+     framepool_destroy(l4->frames);
      free(l4);
  }
\ No newline at end of file
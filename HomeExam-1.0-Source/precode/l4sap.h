@@ -5,6 +5,7 @@
 #include <netinet/in.h>
 
 #include "l2sap.h"
+#include "framepool.h"
 
 #define L4Framesize   (int)L2Payloadsize
 #define L4Headersize  (int)(sizeof(L4Header))
@@ -26,6 +27,64 @@
 
 #define L4_DATA_RECEIVED    -103
 #define L4_NODATA_RECEIVED  -104
+#define L4_WOULD_BLOCK      -105
+#define L4_BAD_MESSAGE      -106
+#define L4_MSG_TOO_LARGE    -107
+
+/* Meldingslaget (l4sap_send_msg/l4sap_recv_msg) legger lengden av
+ * meldingen foran dataene i første pakke, som et 32-bits tall i
+ * nettverksrekkefølge.
+ */
+#define L4MsgHeadersize     (int)sizeof(uint32_t)
+
+/* Største melding l4sap_recv_msg_alloc utvider bufferet til. Lengden
+ * kommer fra peer, så uten grense kunne den få oss til å allokere 4 GB.
+ */
+#define L4MsgMaxsize        (64 * 1024 * 1024)
+
+/* Vindusmodus (Go-Back-N).
+ * L4_CAP_WINDOW settes i mbz-feltet på alle pakker fra en entitet som
+ * støtter vindusmodus. Standardserverne setter aldri dette bitet, og
+ * da faller vi tilbake til stop-and-wait med sekvensnummer 0 og 1.
+ * L4MaxWindow må gå opp i 256 og være mindre enn sekvensrommet.
+ */
+#define L4_CAP_WINDOW       0x1
+#define L4MaxWindow         64
+
+/* Grenser for retransmisjonstimeren (mikrosekunder).
+ * RTO starter på 1 sekund som i oppgaveteksten, og tilpasses etter
+ * hvert som vi får RTT-målinger (Jacobson/Karels).
+ */
+#define L4RtoInitial        1000000
+#define L4RtoMin            20000
+#define L4RtoMax            8000000
+
+/* Sending gis opp etter minst 4 forsøk, og først når det har gått
+ * L4GiveUpUs uten fremgang. Med en liten RTO blir det altså flere
+ * forsøk, så en kort stopp i nettet ikke får sendingen til å feile
+ * (4 forsøk med RTO på 20 ms tar bare 300 ms).
+ */
+#define L4GiveUpAttempts    4
+#define L4GiveUpUs          4000000
+
+/* Mottaksringen: ny DATA som kommer mens vi venter på noe annet, som
+ * en ACK i l4sap_send, legges her i rekkefølge, og l4sap_recv tømmer
+ * ringen før den leser fra socketen. Den har plass til et helt vindu.
+ * Er ringen full, kvitteres ikke ny DATA, så peer sender den på nytt.
+ *
+ * Rammene i ringen kommer fra en FramePool med L4RecvFrames rammer som
+ * hver L4SAP eier: én per plass, og én som l4sap_send tar imot i. Ny
+ * DATA blir da liggende i rammen den kom i, og ingenting allokeres
+ * etter l4sap_create.
+ */
+#define L4RecvSlots         L4MaxWindow
+#define L4RecvFrames        (L4RecvSlots + 1)
+
+/* RTT-histogrammet i L4Stats har logaritmiske bøtter: bøtte 0 er RTT
+ * under 32 us, bøtte i er [2^(i+4), 2^(i+5)) us, og den siste tar alt
+ * fra 2^19 us (ca. 0,5 s) og oppover.
+ */
+#define L4RttBuckets        16
 
 
 /* The design of the L4 layer is the following:
@@ -77,6 +136,46 @@ struct L4Header
  * You can add any number of data structures that are convenient for you.
  */
 
+ // En plass i sendevinduet: hele L4-pakken (header + payload) som
+ // må kunne sendes på nytt helt til den er kvittert
+typedef struct L4SendSlot L4SendSlot;
+struct L4SendSlot
+{
+    uint16_t       len;
+    uint8_t        retransmitted; // Karn: ingen RTT-måling fra denne
+    struct timeval sent;
+    uint8_t        packet[L4Framesize];
+};
+
+ // En plass i mottaksringen: en ramme fra L4SAP-ens FramePool, og hvor
+ // i rammen payloaden til DATA-pakken ligger
+typedef struct L4RecvSlot L4RecvSlot;
+struct L4RecvSlot
+{
+    uint8_t* frame;
+    uint16_t offset;
+    uint16_t len;
+};
+
+/* Tellere for én L4SAP, fra den ble laget. Som L2Stats oppdateres de
+ * uten låsing. Se l4sap_get_stats.
+ */
+typedef struct L4Stats L4Stats;
+struct L4Stats
+{
+    uint64_t data_sent;        // nye DATA-pakker, uten retransmisjoner
+    uint64_t data_received;    // nye DATA-pakker tatt imot
+    uint64_t bytes_sent;       // payload i data_sent
+    uint64_t bytes_received;   // payload i data_received
+    uint64_t retransmits;      // DATA sendt på nytt
+    uint64_t timeouts;         // retransmisjonstimeren gikk ut
+    uint64_t dup_data;         // DATA som var mottatt før, eller kom i feil rekkefølge
+    uint64_t acks_received;    // ACK som kvitterte noe nytt
+    uint64_t stray_acks;       // ACK som ikke kvitterte noe, f.eks. i l4sap_recv
+    uint64_t resets_received;
+    uint64_t rtt_hist[L4RttBuckets];
+};
+
 /* The data structure for maintaining the L4 entity should
  * be called L4SAP.
  */
@@ -98,10 +197,39 @@ typedef struct L4SAP L4SAP;
      uint8_t last_seq_received; // forrige mottatte pakke
      uint8_t last_ack_sent; // forrige ack som ble sendt
      uint8_t reset; // for å vite om en RESET er sendt (1: true, 0: false)
+     uint8_t failed; // vindusmotoren har gitt opp; alt annet enn destroy feiler
+     uint8_t msg_broken; // meldingslaget er ute av takt, se l4sap_recv_msg
      struct timeval timeout;
-     uint8_t pending_data[L4Payloadsize];
-     uint8_t pending_len;
-     uint8_t has_pending_data;
+     long srtt_us; // glattet RTT, 0 før første måling
+     long rttvar_us; // RTT-variasjon
+     long rto_us; // nåværende retransmisjonstimeout
+     L4Stats stats;
+     int stats_fd; // periodisk utskrift av tellerne, -1 når av
+     long stats_interval_us;
+     struct timeval stats_next; // neste utskrift
+     FramePool* frames; // L4RecvFrames rammer av L2Framesize til mottaksringen
+     struct L4RecvSlot recv_ring[L4RecvSlots];
+     uint8_t recv_head; // eldste plass med data
+     uint8_t recv_count; // plasser med data
+
+     // Vindusmodus (se l4sap_set_window)
+     uint8_t window_size; // ønsket vindu, 1 betyr vanlig stop-and-wait
+     uint8_t peer_window; // 1 når peer har annonsert L4_CAP_WINDOW
+     uint8_t send_base; // eldste ukvitterte seq
+     uint8_t send_next; // seq til neste nye pakke
+     uint8_t recv_next; // neste seq vi forventer fra peer
+     uint8_t retrans_attempts; // retransmisjoner uten fremgang
+     struct timeval last_progress; // sist vinduet gikk fremover, se L4GiveUpUs
+     uint8_t dup_acks; // like acker på rad (rask retransmisjon ved 3)
+     struct timeval retrans_deadline; // når eldste pakke skal sendes på nytt
+     struct L4SendSlot* window; // L4MaxWindow plasser, indeksert med seq
+     uint8_t ack_pending; // ny data er tatt imot, men ikke kvittert ennå
+
+     // Rammer fra siste l2sap_recvfrom_batch som ikke er behandlet
+     uint8_t* rx_frames; // L2MaxBatch * L2Framesize bytes
+     int rx_lens[L2MaxBatch];
+     int rx_count;
+     int rx_pos;
  };
 
 
@@ -109,6 +237,29 @@ typedef struct L4SAP L4SAP;
  */
 L4SAP* l4sap_create( const char* server_ip, int server_port );
 
+/* Create an L4 server that listens on the given UDP port on all
+ * interfaces. It has no peer until the first packet arrives; like the
+ * L2 server it then answers whoever sent the last frame, so it serves
+ * one client at a time. Returns NULL if the port cannot be bound.
+ */
+L4SAP* l4sap_server_create( int port );
+
+/* Ownership after L4_QUIT and L4_SEND_FAILED
+ *
+ * No L4 function destroys the entity it is called on. When a call
+ * returns L4_QUIT (the peer has sent L4_RESET) the caller must still
+ * call l4sap_destroy, in stop-and-wait and windowed mode alike. This
+ * replaces the rule in the descriptions of l4sap_send and l4sap_recv
+ * below, which asks them to delete the entities themselves.
+ *
+ * In stop-and-wait mode L4_SEND_FAILED leaves the entity usable: the
+ * sequence number is unchanged, so sending again retransmits the same
+ * packet. In windowed mode the unacknowledged packets cannot be skipped
+ * without breaking the sequence space, so the entity is dead after
+ * L4_SEND_FAILED: every later call except l4sap_destroy returns
+ * L4_SEND_FAILED at once.
+ */
+
 /* l4sap_send is a blocking function that sends data to
  *l4sap_create its peer entity.
  *
@@ -137,6 +288,93 @@ L4SAP* l4sap_create( const char* server_ip, int server_port );
 int l4sap_send( L4SAP* l4, const uint8_t* data, int len );
 int send_ack(L4SAP* l4, struct L4Header* recv_header);
 
+/* l4sap_get_rtt reports the smoothed round-trip time, its variation
+ * and the current retransmission timeout in microseconds. Any of the
+ * pointers may be NULL. Only ACKs for packets that were sent exactly
+ * once are sampled (Karn's rule), and the timeout is doubled on every
+ * retransmission until a new valid sample arrives.
+ *
+ * Returns 1 if at least one RTT sample has been taken, otherwise 0.
+ */
+int l4sap_get_rtt( const L4SAP* l4, long* srtt_us, long* rttvar_us, long* rto_us );
+
+/* l4sap_get_retransmits returns the number of DATA packets this
+ * entity has sent again after a timeout or duplicate ACKs, counted
+ * since it was created. In windowed mode every packet of a Go-Back-N
+ * burst counts.
+ */
+unsigned long l4sap_get_retransmits( const L4SAP* l4 );
+
+/* l4sap_get_stats copies the counters of the L4 entity and of the
+ * L2SAP below it. Either pointer may be NULL. The counters are plain
+ * fields updated without atomics; an L4SAP that is shared between
+ * threads must be read under the same lock as it is used with.
+ */
+void l4sap_get_stats( const L4SAP* l4, L4Stats* l4stats, L2Stats* l2stats );
+
+/* l4sap_dump_stats writes all counters as one line of key=value pairs
+ * to fd. Returns 0, or -1 if the write failed.
+ *
+ * l4sap_set_stats_dump makes the L4 entity dump its counters to fd
+ * every interval_ms milliseconds, and once more when it is destroyed.
+ * The check is done when the application calls into L4, so nothing is
+ * written while a call blocks or while the entity is not used. A
+ * negative fd turns the dump off. The caller keeps ownership of fd.
+ */
+int  l4sap_dump_stats( const L4SAP* l4, int fd );
+void l4sap_set_stats_dump( L4SAP* l4, int fd, int interval_ms );
+
+/* l4sap_set_window enables the sliding-window mode with up to
+ * window_size packets in flight (at most L4MaxWindow). It must be
+ * called before any data is sent or received.
+ *
+ * A windowed L4SAP advertises L4_CAP_WINDOW in the mbz byte of
+ * every packet. Only when the peer advertises it as well does it use
+ * the full 8-bit sequence space with cumulative ACKs (the ackno is the
+ * next expected seqno). Otherwise, e.g. against the stock test
+ * servers, it stays at stop-and-wait with sequence numbers 0 and 1.
+ *
+ * In windowed mode l4sap_send returns as soon as the packet has a
+ * place in the window. l4sap_flush blocks until every packet has
+ * been acknowledged.
+ *
+ * Returns the window size in use, or -1 on error.
+ */
+int l4sap_set_window( L4SAP* l4, int window_size );
+
+/* l4sap_flush blocks until all packets in the send window have
+ * been acknowledged. It returns 0 on success, L4_SEND_FAILED if a
+ * packet got no ACK within L4GiveUpAttempts retransmissions and
+ * L4GiveUpUs (the entity is then dead, see above), or L4_QUIT.
+ */
+int l4sap_flush( L4SAP* l4 );
+
+/* Non-blocking interface, used by the event loop in l4reactor.h.
+ * These functions always run the window engine (with window 1 and
+ * sequence numbers 0/1 against a stop-and-wait peer), so they should
+ * not be mixed with the blocking functions on an L4SAP in stop-and-wait
+ * mode that has already sent or received data.
+ *
+ * l4sap_send_nb puts one packet into the send window and transmits it.
+ * It returns the accepted length, or L4_WOULD_BLOCK if the window is
+ * full. The packet counts as delivered when l4sap_outstanding is 0.
+ *
+ * l4sap_recv_nb processes the frames that are already queued on the
+ * socket. With data != NULL it returns the length of the next DATA
+ * payload as soon as one is available. It returns L4_WOULD_BLOCK when
+ * there is nothing more to read.
+ *
+ * l4sap_timer_nb retransmits if the retransmission timer has expired.
+ * It returns 0 if no timer is armed, 1 if it is armed (with the time
+ * until it expires in *left, if left is not NULL), or L4_SEND_FAILED.
+ *
+ * All three may return L4_QUIT when the peer has sent L4_RESET.
+ */
+int l4sap_send_nb( L4SAP* l4, const uint8_t* data, int len );
+int l4sap_recv_nb( L4SAP* l4, uint8_t* data, int len );
+int l4sap_timer_nb( L4SAP* l4, struct timeval* left );
+int l4sap_outstanding( const L4SAP* l4 );
+
 /* l4sap_recv is a blocking function that receives data from
  * its peer entity.
  *
@@ -161,6 +399,43 @@ int send_ack(L4SAP* l4, struct L4Header* recv_header);
  */
 int l4sap_recv( L4SAP* l4, uint8_t* data, int len );
 
+/* Message interface on top of l4sap_send and l4sap_recv.
+ *
+ * l4sap_send_msg sends a message of any length up to UINT32_MAX
+ * bytes. The first L4 packet starts with the message length as a
+ * 32-bit number in network byte order, followed by as much data as
+ * fits; the rest of the data follows in packets of L4Payloadsize
+ * bytes. In windowed mode the packets are pipelined, so the function
+ * returns when the last packet has a place in the window (call
+ * l4sap_flush to wait for the ACKs). Returns len, or an L4 error code.
+ *
+ * Both ends must use the message interface; the stock servers do not
+ * understand it.
+ *
+ * l4sap_recv_msg receives one message into the caller's buffer of
+ * size len. If the message does not fit, the remaining packets are
+ * still received and discarded so that the next message starts at a
+ * packet boundary, and L4_MSG_TOO_LARGE is returned.
+ *
+ * l4sap_recv_msg_alloc receives one message into *buf, which is grown
+ * with realloc when the message is larger than *cap, up to
+ * L4MsgMaxsize bytes; larger messages are discarded like in
+ * l4sap_recv_msg. *buf must be NULL or point to memory from malloc,
+ * and belongs to the caller also on error.
+ *
+ * Both return the length of the message, L4_BAD_MESSAGE if a packet
+ * does not match the framing, or an L4 error code.
+ *
+ * When a packet does not match the framing, or an L4 call fails in the
+ * middle of a message (on either side), the two ends no longer agree
+ * on where messages start. The message interface of the entity is then
+ * broken for good: all later calls of the three functions return
+ * L4_BAD_MESSAGE at once, and the caller should destroy the entity.
+ */
+long l4sap_send_msg( L4SAP* l4, const uint8_t* data, size_t len );
+long l4sap_recv_msg( L4SAP* l4, uint8_t* data, size_t len );
+long l4sap_recv_msg_alloc( L4SAP* l4, uint8_t** buf, size_t* cap );
+
 /* Send the L4_RESET message to the peer (OK to send it several
  * times, then delete the L2 and L4 entities and all memory
  * associated with them.
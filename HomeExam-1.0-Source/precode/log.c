@@ -0,0 +1,32 @@
+#include <stdlib.h>
+#include <string.h>
+#include <strings.h>
+
+#include "log.h"
+
+int log_runtime_level = -1;
+
+// Leser HOMEEXAM_LOG_LEVEL én gang. Godtar både tall (0-5) og navn.
+int log_init( void ) {
+    static const char* names[] = { "none", "error", "warn", "info", "debug", "trace" };
+
+    int level = LOG_DEFAULT_LEVEL;
+    const char* env = getenv("HOMEEXAM_LOG_LEVEL");
+
+    if (env != NULL && *env != '\0') {
+        char* end;
+        long value = strtol(env, &end, 10);
+        if (*end == '\0' && value >= LOG_LEVEL_NONE && value <= LOG_LEVEL_TRACE) {
+            level = (int)value;
+        } else {
+            for (int i = LOG_LEVEL_NONE; i <= LOG_LEVEL_TRACE; i++) {
+                if (strcasecmp(env, names[i]) == 0) {
+                    level = i;
+                }
+            }
+        }
+    }
+
+    log_runtime_level = level;
+    return level;
+}
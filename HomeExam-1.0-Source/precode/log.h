@@ -0,0 +1,51 @@
+#ifndef LOG_H
+#define LOG_H
+
+#include <stdio.h>
+
+/* Loggnivåer. Alt over LOG_COMPILE_LEVEL fjernes helt av kompilatoren,
+ * og alt over nivået i miljøvariabelen HOMEEXAM_LOG_LEVEL hoppes over
+ * når programmet kjører.
+ *
+ * TRACE er for meldinger som skrives per pakke eller ramme, og skal
+ * ikke være med i en release-bygg.
+ */
+#define LOG_LEVEL_NONE   0
+#define LOG_LEVEL_ERROR  1
+#define LOG_LEVEL_WARN   2
+#define LOG_LEVEL_INFO   3
+#define LOG_LEVEL_DEBUG  4
+#define LOG_LEVEL_TRACE  5
+
+/* Settes fra CMake med -DLOG_LEVEL=<nivå> */
+#ifndef LOG_COMPILE_LEVEL
+#define LOG_COMPILE_LEVEL LOG_LEVEL_TRACE
+#endif
+
+/* Nivå når HOMEEXAM_LOG_LEVEL ikke er satt */
+#define LOG_DEFAULT_LEVEL LOG_LEVEL_WARN
+
+/* Nivået som gjelder nå. Er -1 til log_init har lest miljøvariabelen,
+ * så sjekken i LOG er bare én sammenligning etter første kall.
+ */
+extern int log_runtime_level;
+int log_init( void );
+
+#define LOG_ENABLED(level) \
+    ((level) <= LOG_COMPILE_LEVEL && \
+     (level) <= (log_runtime_level >= 0 ? log_runtime_level : log_init()))
+
+#define LOG(level, ...) \
+    do { \
+        if (LOG_ENABLED(level)) { \
+            fprintf(stderr, __VA_ARGS__); \
+        } \
+    } while (0)
+
+#define LOG_ERROR(...) LOG(LOG_LEVEL_ERROR, __VA_ARGS__)
+#define LOG_WARN(...)  LOG(LOG_LEVEL_WARN,  __VA_ARGS__)
+#define LOG_INFO(...)  LOG(LOG_LEVEL_INFO,  __VA_ARGS__)
+#define LOG_DEBUG(...) LOG(LOG_LEVEL_DEBUG, __VA_ARGS__)
+#define LOG_TRACE(...) LOG(LOG_LEVEL_TRACE, __VA_ARGS__)
+
+#endif
@@ -0,0 +1,132 @@
+#include <stdlib.h>
+#include <stdint.h>
+
+#include "maze.h"
+#include "log.h"
+
+// Arena for arbeidsminnet til løserne. Blokkene ligger i en lenket liste
+// med den nyeste først, og bare den nyeste har ledig plass. Etter en
+// reset med flere blokker slås de sammen til én, så neste runde med
+// samme behov får plass uten malloc.
+
+#define ARENA_ALIGN   64
+#define ARENA_DEFAULT (64 * 1024)
+
+typedef struct ArenaBlock ArenaBlock;
+struct ArenaBlock {
+    ArenaBlock* next; // eldre blokk
+    size_t size; // bytes i data
+    size_t used;
+    uint8_t* data;
+};
+
+struct MazeArena {
+    ArenaBlock* blocks;
+    size_t total; // summen av size i alle blokkene
+    unsigned long mallocs;
+};
+
+static inline size_t arena_round(size_t bytes) {
+    return (bytes + ARENA_ALIGN - 1) & ~(size_t)(ARENA_ALIGN - 1);
+}
+
+static ArenaBlock* arena_block(MazeArena* arena, size_t size) {
+    size = arena_round(size);
+    ArenaBlock* block = malloc(sizeof(ArenaBlock));
+    if (block == NULL) {
+        return NULL;
+    }
+    block->data = aligned_alloc(ARENA_ALIGN, size);
+    if (block->data == NULL) {
+        free(block);
+        return NULL;
+    }
+    block->size = size;
+    block->used = 0;
+    block->next = arena->blocks;
+    arena->blocks = block;
+    arena->total += size;
+    arena->mallocs++;
+    return block;
+}
+
+static void arena_free_blocks(MazeArena* arena) {
+    while (arena->blocks != NULL) {
+        ArenaBlock* block = arena->blocks;
+        arena->blocks = block->next;
+        free(block->data);
+        free(block);
+    }
+    arena->total = 0;
+}
+
+MazeArena* mazeArenaCreate(size_t initial) {
+    MazeArena* arena = malloc(sizeof(MazeArena));
+    if (arena == NULL) {
+        return NULL;
+    }
+    arena->blocks = NULL;
+    arena->total = 0;
+    arena->mallocs = 0;
+
+    if (arena_block(arena, initial > 0 ? initial : ARENA_DEFAULT) == NULL) {
+        free(arena);
+        return NULL;
+    }
+    return arena;
+}
+
+void* mazeArenaAlloc(MazeArena* arena, size_t bytes) {
+    bytes = arena_round(bytes > 0 ? bytes : 1);
+
+    ArenaBlock* block = arena->blocks;
+    if (block == NULL || block->size - block->used < bytes) {
+        // Minst dobbelt så stor som forrige, så antall blokker i en
+        // runde blir logaritmisk
+        size_t size = block != NULL ? block->size * 2 : ARENA_DEFAULT;
+        if (size < bytes) {
+            size = bytes;
+        }
+        block = arena_block(arena, size);
+        if (block == NULL) {
+            LOG_ERROR("ERROR: Fikk ikke %zu bytes til arenaen\n", size);
+            return NULL;
+        }
+    }
+
+    void* p = block->data + block->used;
+    block->used += bytes;
+    return p;
+}
+
+void mazeArenaReset(MazeArena* arena) {
+    if (arena->blocks == NULL) {
+        return;
+    }
+
+    // Én blokk: bare spol tilbake
+    if (arena->blocks->next == NULL) {
+        arena->blocks->used = 0;
+        return;
+    }
+
+    // Flere blokker: erstatter dem med én som rommer alt. Feiler det,
+    // lager mazeArenaAlloc nye blokker etter behov
+    size_t total = arena->total;
+    arena_free_blocks(arena);
+    if (arena_block(arena, total) == NULL) {
+        LOG_WARN("WARNING: Fikk ikke slått sammen arenaen til %zu bytes\n", total);
+    }
+}
+
+unsigned long mazeArenaMallocs(const MazeArena* arena) {
+    return arena->mallocs;
+}
+
+void mazeArenaDestroy(MazeArena* arena) {
+    if (arena == NULL) {
+        return;
+    }
+    arena_free_blocks(arena);
+    free(arena);
+}
@@ -0,0 +1,338 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <unistd.h>
+#include <sys/resource.h>
+#include <sys/wait.h>
+
+#include "maze.h"
+
+static const char* simd_names[] = { "auto", "scalar", "sse2", "avx2" };
+
+void usage( const char* name )
+{
+    fprintf( stderr, "Usage: %s [-n <edge>] [-r <repeat>] [-s <seed>]\n"
+                     "       %s -c [-n <edge>] [-r <repeat>] [-s <seed>]\n"
+                     "       %s -g <file> [-n <edge>] [-s <seed>]\n"
+                     "       -c      - optional, time every solver on generated mazes of 16, 32, ...\n"
+                     "                 up to edge cells per side (default 16384) and print CSV\n"
+                     "       -g      - optional, write a generated maze to file and exit\n"
+                     "       edge    - optional, number of cells along each side (default 4096)\n"
+                     "       repeat  - optional, runs per measurement, the best is reported (default 5)\n"
+                     "       seed    - optional, random number generator seed (default 1)\n", name, name, name );
+    exit( -1 );
+}
+
+static double now( void )
+{
+    struct timespec ts;
+    clock_gettime( CLOCK_MONOTONIC, &ts );
+    return ts.tv_sec + ts.tv_nsec / 1e9;
+}
+
+/* Random grid where each wall to the right and below is open with
+ * probability 3/5. Both neighbours get their direction bit, so the
+ * grid is consistent. The top row and the right column are always
+ * open, so there is at least one path from corner to corner. It is
+ * meant for timing, not for play.
+ */
+static Maze* random_grid( uint32_t edge, unsigned seed )
+{
+    Maze* maze = (Maze*)malloc( sizeof(Maze) );
+    if( maze == NULL ) return NULL;
+
+    maze->edgeLen = edge;
+    maze->size    = edge * edge;
+    maze->startX  = 0;
+    maze->startY  = 0;
+    maze->endX    = edge - 1;
+    maze->endY    = edge - 1;
+    maze->maze    = (char*)calloc( maze->size, 1 );
+    if( maze->maze == NULL )
+    {
+        free( maze );
+        return NULL;
+    }
+
+    srand( seed );
+    for( uint32_t y = 0; y < edge; y++ )
+    {
+        for( uint32_t x = 0; x < edge; x++ )
+        {
+            uint32_t i = y * edge + x;
+            if( x + 1 < edge && ( y == 0 || rand() % 5 < 3 ) )
+            {
+                maze->maze[i]   |= right;
+                maze->maze[i+1] |= left;
+            }
+            if( y + 1 < edge && ( x + 1 == edge || rand() % 5 < 3 ) )
+            {
+                maze->maze[i]      |= down;
+                maze->maze[i+edge] |= up;
+            }
+        }
+    }
+    return maze;
+}
+
+static void clear_marks( Maze* maze )
+{
+    for( uint32_t i = 0; i < maze->size; i++ )
+    {
+        maze->maze[i] &= ~( mark | tmark );
+    }
+}
+
+/* The CSV suite runs every (size, solver) pair in a child process, so
+ * that the peak RSS that wait4() reports belongs to that run alone. The
+ * child generates the maze, solves it repeat times and writes the best
+ * result to a pipe; the peak RSS includes the maze itself.
+ */
+typedef struct
+{
+    const char*  name;
+    MazeStrategy strategy;
+    unsigned     flags;
+    int          packed;
+} SuiteMode;
+
+static const SuiteMode suite_modes[] =
+{
+    { "bfs",      MAZE_BFS,          0,                 0 },
+    { "bidir",    MAZE_BIDIR_BFS,    0,                 0 },
+    { "astar",    MAZE_ASTAR,        0,                 0 },
+    { "parallel", MAZE_PARALLEL_BFS, 0,                 0 },
+    { "bfs+mask", MAZE_BFS,          MAZE_OPT_PASSMASK, 0 },
+    { "bfs+dead", MAZE_BFS,          MAZE_OPT_DEADEND,  0 },
+    { "packed",   MAZE_BFS,          0,                 1 }
+};
+
+static int suite_child( const SuiteMode* mode, uint32_t edge, long seed, int repeat, MazeStats* best )
+{
+    Maze* maze = mazeGenerate( edge, seed );
+    if( maze == NULL ) return -1;
+
+    PackedMaze* packed = NULL;
+    if( mode->packed )
+    {
+        packed = mazePack( maze );
+        if( packed == NULL ) return -1;
+    }
+
+    MazeOptions options = { .strategy = mode->strategy, .flags = mode->flags };
+    best->seconds = 1e30;
+    for( int r = 0; r < repeat; r++ )
+    {
+        MazeStats stats;
+        if( packed != NULL )
+        {
+            mazeSolvePacked( packed, &stats );
+        }
+        else
+        {
+            clear_marks( maze );
+            mazeSolveWith( maze, &options, &stats );
+        }
+        if( stats.pathLength < 0 ) return -1;
+        if( stats.seconds < best->seconds ) *best = stats;
+    }
+    return 0;
+}
+
+static int suite_run( const SuiteMode* mode, uint32_t edge, long seed, int repeat )
+{
+    int fds[2];
+    if( pipe( fds ) < 0 )
+    {
+        perror( "pipe" );
+        return -1;
+    }
+
+    fflush( stdout );
+    pid_t pid = fork();
+    if( pid < 0 )
+    {
+        perror( "fork" );
+        close( fds[0] );
+        close( fds[1] );
+        return -1;
+    }
+    if( pid == 0 )
+    {
+        MazeStats best;
+        close( fds[0] );
+        if( suite_child( mode, edge, seed, repeat, &best ) < 0 ) _exit( 1 );
+        if( write( fds[1], &best, sizeof(best) ) != sizeof(best) ) _exit( 1 );
+        _exit( 0 );
+    }
+
+    close( fds[1] );
+    MazeStats best;
+    ssize_t got = read( fds[0], &best, sizeof(best) );
+    close( fds[0] );
+
+    int status;
+    struct rusage usage;
+    if( wait4( pid, &status, 0, &usage ) < 0 )
+    {
+        perror( "wait4" );
+        return -1;
+    }
+    if( got != sizeof(best) || !WIFEXITED( status ) || WEXITSTATUS( status ) != 0 )
+    {
+        fprintf( stderr, "%s: %s on %ux%u failed\n", __FUNCTION__, mode->name, edge, edge );
+        return -1;
+    }
+
+    double cells = (double)edge * edge;
+    printf( "%u,%.0f,%s,%.9f,%.0f,%llu,%d,%ld\n",
+            edge, cells, mode->name, best.seconds,
+            best.seconds > 0 ? cells / best.seconds : 0.0,
+            (unsigned long long)best.expanded, best.pathLength,
+            usage.ru_maxrss );
+    fflush( stdout );
+    return 0;
+}
+
+static int suite( uint32_t maxEdge, long seed, int repeat )
+{
+    int failed = 0;
+    printf( "edge,cells,solver,seconds,cells_per_sec,expanded,path_length,peak_rss_kb\n" );
+    for( uint32_t edge = 16; edge <= maxEdge; edge *= 2 )
+    {
+        for( size_t m = 0; m < sizeof(suite_modes) / sizeof(suite_modes[0]); m++ )
+        {
+            if( suite_run( &suite_modes[m], edge, seed, repeat ) < 0 ) failed = 1;
+        }
+    }
+    return failed ? -1 : 0;
+}
+
+int main( int argc, char *argv[] )
+{
+    uint32_t    edge   = 0;
+    int         repeat = 5;
+    unsigned    seed   = 1;
+    int         csv    = 0;
+    const char* output = NULL;
+    int opt;
+    while( ( opt = getopt( argc, argv, "cg:n:r:s:" ) ) != -1 )
+    {
+        switch( opt )
+        {
+        case 'c' :
+            csv = 1;
+            break;
+        case 'g' :
+            output = optarg;
+            break;
+        case 'n' :
+            edge = (uint32_t)strtoul( optarg, NULL, 10 );
+            break;
+        case 'r' :
+            repeat = atoi( optarg );
+            break;
+        case 's' :
+            seed = (unsigned)strtoul( optarg, NULL, 10 );
+            break;
+        default :
+            usage( argv[0] );
+        }
+    }
+    if( edge == 0 ) edge = csv ? 16384 : 4096;
+    if( edge < 2 || repeat < 1 || ( csv && output != NULL ) ) usage( argv[0] );
+
+    if( csv ) return suite( edge, seed, repeat );
+
+    if( output != NULL )
+    {
+        Maze* maze = mazeGenerate( edge, seed );
+        if( maze == NULL || mazeFileSave( maze, output ) < 0 )
+        {
+            fprintf( stderr, "%s: Could not write a %ux%u maze to %s\n", __FUNCTION__, edge, edge, output );
+            return -1;
+        }
+        free( maze->maze );
+        free( maze );
+        return 0;
+    }
+
+    Maze* maze = random_grid( edge, seed );
+    uint8_t* reference = (uint8_t*)malloc( (size_t)edge * edge );
+    uint8_t* pass      = (uint8_t*)malloc( (size_t)edge * edge );
+    if( maze == NULL || reference == NULL || pass == NULL )
+    {
+        fprintf( stderr, "%s: Could not allocate a %ux%u maze\n", __FUNCTION__, edge, edge );
+        return -1;
+    }
+
+    printf( "maze %ux%u, best of %d runs\n\n", edge, edge, repeat );
+
+    mazePassMask( maze, reference, MAZE_SIMD_SCALAR );
+
+    for( int simd = MAZE_SIMD_SCALAR; simd <= MAZE_SIMD_AVX2; simd++ )
+    {
+        double best = 1e30;
+        int    used = -1;
+        for( int r = 0; r < repeat; r++ )
+        {
+            double t0 = now();
+            used = mazePassMask( maze, pass, (MazeSimd)simd );
+            double t = now() - t0;
+            if( t < best ) best = t;
+        }
+        if( used != simd )
+        {
+            printf( "mask %-6s  not available on this CPU\n", simd_names[simd] );
+            continue;
+        }
+        int same = memcmp( pass, reference, maze->size ) == 0;
+        printf( "mask %-6s  %9.3f ms  %7.2f Mcells/s  %s\n",
+                simd_names[simd], best * 1e3, maze->size / best / 1e6,
+                same ? "ok" : "DIFFERS FROM SCALAR" );
+    }
+
+    printf( "\n" );
+
+    const char* modes[] = { "bfs", "bfs+mask", "bfs+dead" };
+    const unsigned flags[] = { 0, MAZE_OPT_PASSMASK, MAZE_OPT_DEADEND };
+    for( int m = 0; m < 3; m++ )
+    {
+        MazeOptions options = { .strategy = MAZE_BFS, .flags = flags[m] };
+        MazeStats   stats;
+        double best = 1e30;
+        for( int r = 0; r < repeat; r++ )
+        {
+            clear_marks( maze );
+            mazeSolveWith( maze, &options, &stats );
+            if( stats.seconds < best ) best = stats.seconds;
+        }
+        printf( "solve %-9s %9.3f ms  path %d  expanded %llu  pruned %llu\n",
+                modes[m], best * 1e3, stats.pathLength,
+                (unsigned long long)stats.expanded,
+                (unsigned long long)stats.pruned );
+    }
+
+    PackedMaze* packed = mazePack( maze );
+    if( packed != NULL )
+    {
+        MazeStats stats;
+        double best = 1e30;
+        for( int r = 0; r < repeat; r++ )
+        {
+            mazeSolvePacked( packed, &stats );
+            if( stats.seconds < best ) best = stats.seconds;
+        }
+        printf( "solve %-9s %9.3f ms  path %d  expanded %llu\n",
+                "packed", best * 1e3, stats.pathLength,
+                (unsigned long long)stats.expanded );
+        mazePackedFree( packed );
+    }
+
+    free( pass );
+    free( reference );
+    free( maze->maze );
+    free( maze );
+    return 0;
+}
@@ -0,0 +1,427 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <stdint.h>
+#include <errno.h>
+#include <unistd.h>
+#include <sys/stat.h>
+#include <arpa/inet.h>
+
+#include "maze.h"
+#include "log.h"
+
+// Løsningscache: nøkkelen er en XXH64 av labyrinten slik den kom fra
+// nettet, og verdien er listen over celler på stien. Et treff gir samme
+// merker som søket ville gitt, uten å løse på nytt.
+//
+// I minnet ligger oppføringene i en hashtabell med kjeding, og i en
+// dobbeltlenket liste ordnet etter siste bruk (LRU). På disk er hver
+// oppføring en egen fil <dir>/<nøkkel>.path.
+
+// XXH64 (xxHash, Yann Collet), her bare for hele buffere
+#define XXH_PRIME1 0x9E3779B185EBCA87ull
+#define XXH_PRIME2 0xC2B2AE3D27D4EB4Full
+#define XXH_PRIME3 0x165667B19E3779F9ull
+#define XXH_PRIME4 0x85EBCA77C2B2AE63ull
+#define XXH_PRIME5 0x27D4EB2F165667C5ull
+
+static inline uint64_t xxh_rotl(uint64_t x, int r) {
+    return (x << r) | (x >> (64 - r));
+}
+
+static inline uint64_t xxh_read64(const uint8_t* p) {
+    uint64_t v;
+    memcpy(&v, p, sizeof(v));
+    return v; // XXH64 er definert for little endian, som x86
+}
+
+static inline uint32_t xxh_read32(const uint8_t* p) {
+    uint32_t v;
+    memcpy(&v, p, sizeof(v));
+    return v;
+}
+
+static inline uint64_t xxh_round(uint64_t acc, uint64_t input) {
+    acc += input * XXH_PRIME2;
+    acc = xxh_rotl(acc, 31);
+    return acc * XXH_PRIME1;
+}
+
+static inline uint64_t xxh_merge(uint64_t acc, uint64_t val) {
+    acc ^= xxh_round(0, val);
+    return acc * XXH_PRIME1 + XXH_PRIME4;
+}
+
+static uint64_t xxh64(const void* data, size_t len, uint64_t seed) {
+    const uint8_t* p = data;
+    const uint8_t* end = p + len;
+    uint64_t h;
+
+    if (len >= 32) {
+        uint64_t v1 = seed + XXH_PRIME1 + XXH_PRIME2;
+        uint64_t v2 = seed + XXH_PRIME2;
+        uint64_t v3 = seed;
+        uint64_t v4 = seed - XXH_PRIME1;
+        do {
+            v1 = xxh_round(v1, xxh_read64(p));
+            v2 = xxh_round(v2, xxh_read64(p + 8));
+            v3 = xxh_round(v3, xxh_read64(p + 16));
+            v4 = xxh_round(v4, xxh_read64(p + 24));
+            p += 32;
+        } while (p + 32 <= end);
+
+        h = xxh_rotl(v1, 1) + xxh_rotl(v2, 7) + xxh_rotl(v3, 12) + xxh_rotl(v4, 18);
+        h = xxh_merge(h, v1);
+        h = xxh_merge(h, v2);
+        h = xxh_merge(h, v3);
+        h = xxh_merge(h, v4);
+    } else {
+        h = seed + XXH_PRIME5;
+    }
+
+    h += (uint64_t)len;
+
+    while (p + 8 <= end) {
+        h ^= xxh_round(0, xxh_read64(p));
+        h = xxh_rotl(h, 27) * XXH_PRIME1 + XXH_PRIME4;
+        p += 8;
+    }
+    if (p + 4 <= end) {
+        h ^= (uint64_t)xxh_read32(p) * XXH_PRIME1;
+        h = xxh_rotl(h, 23) * XXH_PRIME2 + XXH_PRIME3;
+        p += 4;
+    }
+    while (p < end) {
+        h ^= (*p++) * XXH_PRIME5;
+        h = xxh_rotl(h, 11) * XXH_PRIME1;
+    }
+
+    h ^= h >> 33;
+    h *= XXH_PRIME2;
+    h ^= h >> 29;
+    h *= XXH_PRIME3;
+    h ^= h >> 32;
+    return h;
+}
+
+uint64_t mazeHash(const Maze* maze) {
+    uint32_t header[6];
+    header[0] = htonl(maze->edgeLen);
+    header[1] = htonl(maze->size);
+    header[2] = htonl(maze->startX);
+    header[3] = htonl(maze->startY);
+    header[4] = htonl(maze->endX);
+    header[5] = htonl(maze->endY);
+
+    // Headeren gir frøet til hashen av cellene
+    return xxh64(maze->maze, maze->size, xxh64(header, sizeof(header), 0));
+}
+
+
+typedef struct CacheEntry CacheEntry;
+struct CacheEntry {
+    uint64_t key;
+    uint32_t edgeLen;
+    uint32_t start; // startY * edgeLen + startX
+    uint32_t end;
+    uint32_t count; // celler på stien
+    uint32_t* cells;
+    CacheEntry* chain; // neste i samme bøtte
+    CacheEntry* newer;
+    CacheEntry* older;
+};
+
+struct MazeCache {
+    CacheEntry** buckets;
+    size_t mask; // antall bøtter - 1
+    size_t count;
+    size_t capacity;
+    CacheEntry* newest;
+    CacheEntry* oldest;
+    char* dir; // NULL uten disklager
+    MazeCacheStats stats;
+};
+
+// Diskformat: magi, de samme feltene som CacheEntry og så cellene,
+// alt i nettverksrekkefølge
+#define CACHE_MAGIC 0x4d5a4331 // "MZC1"
+
+MazeCache* mazeCacheCreate(size_t capacity, const char* dir) {
+    MazeCache* cache = calloc(1, sizeof(MazeCache));
+    if (cache == NULL) {
+        return NULL;
+    }
+
+    // Minst dobbelt så mange bøtter som oppføringer
+    size_t buckets = 16;
+    while (buckets < 2 * capacity) {
+        buckets *= 2;
+    }
+    cache->buckets = calloc(buckets, sizeof(CacheEntry*));
+    cache->mask = buckets - 1;
+    cache->capacity = capacity;
+
+    if (dir != NULL) {
+        if (mkdir(dir, 0777) < 0 && errno != EEXIST) {
+            LOG_WARN("WARNING: Kan ikke lage cachekatalogen %s\n", dir);
+        }
+        cache->dir = strdup(dir);
+    }
+
+    if (cache->buckets == NULL || (dir != NULL && cache->dir == NULL)) {
+        mazeCacheDestroy(cache);
+        return NULL;
+    }
+    return cache;
+}
+
+void mazeCacheDestroy(MazeCache* cache) {
+    if (cache == NULL) {
+        return;
+    }
+    CacheEntry* entry = cache->newest;
+    while (entry != NULL) {
+        CacheEntry* older = entry->older;
+        free(entry->cells);
+        free(entry);
+        entry = older;
+    }
+    free(cache->buckets);
+    free(cache->dir);
+    free(cache);
+}
+
+void mazeCacheGetStats(const MazeCache* cache, MazeCacheStats* stats) {
+    *stats = cache->stats;
+}
+
+
+static void lru_unlink(MazeCache* cache, CacheEntry* entry) {
+    if (entry->newer != NULL) entry->newer->older = entry->older;
+    else cache->newest = entry->older;
+    if (entry->older != NULL) entry->older->newer = entry->newer;
+    else cache->oldest = entry->newer;
+}
+
+static void lru_push(MazeCache* cache, CacheEntry* entry) {
+    entry->newer = NULL;
+    entry->older = cache->newest;
+    if (cache->newest != NULL) cache->newest->newer = entry;
+    cache->newest = entry;
+    if (cache->oldest == NULL) cache->oldest = entry;
+}
+
+static CacheEntry* table_find(MazeCache* cache, uint64_t key) {
+    for (CacheEntry* e = cache->buckets[key & cache->mask]; e != NULL; e = e->chain) {
+        if (e->key == key) return e;
+    }
+    return NULL;
+}
+
+static void table_remove(MazeCache* cache, CacheEntry* entry) {
+    CacheEntry** link = &cache->buckets[entry->key & cache->mask];
+    while (*link != entry) {
+        link = &(*link)->chain;
+    }
+    *link = entry->chain;
+}
+
+// Setter inn en ny oppføring (som eies av cachen etterpå), og kaster
+// den som er brukt minst nylig når cachen er full
+static void cache_insert(MazeCache* cache, CacheEntry* entry) {
+    CacheEntry* old = table_find(cache, entry->key);
+    if (old != NULL) {
+        table_remove(cache, old);
+        lru_unlink(cache, old);
+        free(old->cells);
+        free(old);
+        cache->count--;
+    }
+
+    if (cache->count >= cache->capacity && cache->oldest != NULL) {
+        CacheEntry* victim = cache->oldest;
+        table_remove(cache, victim);
+        lru_unlink(cache, victim);
+        free(victim->cells);
+        free(victim);
+        cache->count--;
+        cache->stats.evictions++;
+    }
+
+    size_t b = entry->key & cache->mask;
+    entry->chain = cache->buckets[b];
+    cache->buckets[b] = entry;
+    lru_push(cache, entry);
+    cache->count++;
+}
+
+// Oppføringen må høre til denne labyrinten; ellers er det en
+// hashkollisjon eller en ødelagt fil
+static int entry_matches(const CacheEntry* entry, const Maze* maze) {
+    if (entry->edgeLen != maze->edgeLen) return 0;
+    if (entry->start != maze->startY * maze->edgeLen + maze->startX) return 0;
+    if (entry->end != maze->endY * maze->edgeLen + maze->endX) return 0;
+    return 1;
+}
+
+
+static void disk_path(const MazeCache* cache, uint64_t key, char* path, size_t len) {
+    snprintf(path, len, "%s/%016llx.path", cache->dir, (unsigned long long)key);
+}
+
+static CacheEntry* disk_load(MazeCache* cache, uint64_t key, const Maze* maze) {
+    char path[4096];
+    disk_path(cache, key, path, sizeof(path));
+    FILE* f = fopen(path, "rb");
+    if (f == NULL) {
+        return NULL;
+    }
+
+    uint32_t head[5];
+    CacheEntry* entry = NULL;
+    if (fread(head, sizeof(uint32_t), 5, f) != 5 || ntohl(head[0]) != CACHE_MAGIC) {
+        goto out;
+    }
+    entry = calloc(1, sizeof(CacheEntry));
+    if (entry == NULL) {
+        goto out;
+    }
+    entry->key = key;
+    entry->edgeLen = ntohl(head[1]);
+    entry->start = ntohl(head[2]);
+    entry->end = ntohl(head[3]);
+    entry->count = ntohl(head[4]);
+
+    if (!entry_matches(entry, maze) || entry->count > maze->size) {
+        goto bad;
+    }
+    entry->cells = malloc((entry->count ? entry->count : 1) * sizeof(uint32_t));
+    if (entry->cells == NULL || fread(entry->cells, sizeof(uint32_t), entry->count, f) != entry->count) {
+        goto bad;
+    }
+    for (uint32_t i = 0; i < entry->count; i++) {
+        entry->cells[i] = ntohl(entry->cells[i]);
+        if (entry->cells[i] >= maze->size) goto bad;
+    }
+    goto out;
+
+bad:
+    LOG_WARN("WARNING: Ser bort fra ugyldig cachefil %s\n", path);
+    free(entry->cells);
+    free(entry);
+    entry = NULL;
+out:
+    fclose(f);
+    return entry;
+}
+
+// Skriver til en midlertidig fil og gir den riktig navn til slutt, så en
+// annen prosess aldri ser en halvskrevet oppføring
+static int disk_store(MazeCache* cache, const CacheEntry* entry) {
+    char path[4096];
+    char tmp[4096 + 32];
+    disk_path(cache, entry->key, path, sizeof(path));
+    snprintf(tmp, sizeof(tmp), "%s.%d.tmp", path, (int)getpid());
+
+    FILE* f = fopen(tmp, "wb");
+    if (f == NULL) {
+        return -1;
+    }
+
+    uint32_t head[5] = {htonl(CACHE_MAGIC), htonl(entry->edgeLen), htonl(entry->start),
+                        htonl(entry->end), htonl(entry->count)};
+    int ok = fwrite(head, sizeof(uint32_t), 5, f) == 5;
+    for (uint32_t i = 0; ok && i < entry->count; i++) {
+        uint32_t cell = htonl(entry->cells[i]);
+        ok = fwrite(&cell, sizeof(cell), 1, f) == 1;
+    }
+    if (fclose(f) != 0) {
+        ok = 0;
+    }
+    if (!ok || rename(tmp, path) < 0) {
+        unlink(tmp);
+        return -1;
+    }
+    return 0;
+}
+
+
+int mazeCacheLookup(MazeCache* cache, uint64_t key, Maze* maze) {
+    CacheEntry* entry = table_find(cache, key);
+    if (entry != NULL && !entry_matches(entry, maze)) {
+        entry = NULL;
+    }
+
+    CacheEntry* loaded = NULL;
+    if (entry != NULL) {
+        lru_unlink(cache, entry);
+        lru_push(cache, entry);
+    } else if (cache->dir != NULL && (loaded = disk_load(cache, key, maze)) != NULL) {
+        entry = loaded;
+        cache->stats.diskHits++;
+    }
+
+    if (entry == NULL) {
+        cache->stats.misses++;
+        return -1;
+    }
+
+    // Spiller av stien rett inn i cellene
+    int count = (int)entry->count;
+    for (uint32_t i = 0; i < entry->count; i++) {
+        maze->maze[entry->cells[i]] |= mark;
+    }
+    cache->stats.hits++;
+
+    if (loaded != NULL && cache->capacity > 0) {
+        cache_insert(cache, loaded);
+    } else if (loaded != NULL) {
+        free(loaded->cells);
+        free(loaded);
+    }
+    return count;
+}
+
+int mazeCacheStore(MazeCache* cache, uint64_t key, const Maze* maze) {
+    uint32_t count = 0;
+    for (uint32_t i = 0; i < maze->size; i++) {
+        if (maze->maze[i] & mark) count++;
+    }
+
+    CacheEntry* entry = calloc(1, sizeof(CacheEntry));
+    uint32_t* cells = malloc((count ? count : 1) * sizeof(uint32_t));
+    if (entry == NULL || cells == NULL) {
+        free(entry);
+        free(cells);
+        return -1;
+    }
+
+    uint32_t n = 0;
+    for (uint32_t i = 0; i < maze->size; i++) {
+        if (maze->maze[i] & mark) cells[n++] = i;
+    }
+    entry->key = key;
+    entry->edgeLen = maze->edgeLen;
+    entry->start = maze->startY * maze->edgeLen + maze->startX;
+    entry->end = maze->endY * maze->edgeLen + maze->endX;
+    entry->count = count;
+    entry->cells = cells;
+
+    int result = 0;
+    if (cache->dir != NULL) {
+        if (disk_store(cache, entry) == 0) {
+            cache->stats.diskWrites++;
+        } else {
+            LOG_WARN("WARNING: Kunne ikke skrive løsningen til %s\n", cache->dir);
+            result = -1;
+        }
+    }
+
+    if (cache->capacity > 0) {
+        cache_insert(cache, entry);
+    } else {
+        free(cells);
+        free(entry);
+    }
+    return result;
+}
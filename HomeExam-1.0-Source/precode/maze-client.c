@@ -2,11 +2,11 @@
 #include <stdlib.h>
 #include <string.h>
 #include <sys/select.h>
+#include <unistd.h>
 
 #include "l4sap.h"
 #include "maze.h"
-
-#define MAZE_HEADER_LEN (6*sizeof(uint32_t))
+#include "maze-pipeline.h"
 
 static int maxi( int a, int b )
 {
@@ -16,38 +16,393 @@ static int maxi( int a, int b )
 
 void usage( const char* name )
 {
-    fprintf( stderr, "Usage: %s <serverip> <port> <maze-seed>\n"
+    fprintf( stderr, "Usage: %s [-m] [-w <window>] [-a <strategy>] [-t <threads>] [-p] [-d]\n"
+                     "       [-v <x>,<y>,<w>,<h> | -O <width>] [-o <image>] [-k]\n"
+                     "       [-s <file>] [-q <depth>] [-c <entries>] [-C <dir>]\n"
+                     "       <serverip> <port> <maze-seeds>\n"
+                     "   or: %s [solver and plot options] -f <file>\n"
+                     "       -m       - use the L4 message interface, for mazes that do not\n"
+                     "                  fit into one packet (the server must support it)\n"
+                     "       window   - optional, number of L4 packets in flight (default 1)\n"
+                     "       strategy - optional, maze solver: bfs, bidir, astar or parallel (default bfs)\n"
+                     "       threads  - optional, threads for the parallel solver (default all CPUs)\n"
+                     "       -p       - precompute the passability mask before solving\n"
+                     "       -d       - fill dead ends before solving\n"
+                     "       -v       - plot only the w x h cells from (x,y)\n"
+                     "       -O       - plot a downsampled overview at most width characters wide\n"
+                     "       image    - optional, write the solved maze to this file as PNG (*.png)\n"
+                     "                  or PBM (any other name)\n"
+                     "       -k       - solve on the packed maze (BFS, 4 bits per cell); the\n"
+                     "                  packed solver has no other strategies, so -k cannot\n"
+                     "                  be combined with -a (other than bfs), -t, -p or -d\n"
+                     "       -s       - save the received maze to a maze file\n"
+                     "       -f       - solve a maze file instead of asking the server\n"
+                     "       entries  - optional, number of solutions to cache in memory\n"
+                     "       dir      - optional, directory that keeps cached solutions between runs\n"
+                     "       depth    - optional, requests in flight when solving several mazes\n"
+                     "                  (default 1, which is all that the stock maze-server takes)\n"
                      "       serverip - IPv4 address of the server in dotted decimal notation\n"
                      "       port     - The server's port\n"
-                     "       maze-seed - random number generator seed\n", name );
+                     "       maze-seeds - random number generator seed, or a comma-separated list\n"
+                     "                  of seeds and ranges like 1,5,10-20. Several mazes are\n"
+                     "                  requested, solved and answered in a pipeline over one\n"
+                     "                  connection, without plots, -m, -o, -k or -s\n", name, name );
     exit( -1 );
 }
 
+/* Send one L5 message, either as a single L4 packet or with the
+ * message interface.
+ */
+static long send_message( L4SAP* l4, int msg_mode, const uint8_t* data, size_t len )
+{
+    if( msg_mode ) return l4sap_send_msg( l4, data, len );
+    return l4sap_send( l4, data, (int)len );
+}
+
+/* Solve the maze, either directly on the received cells or on the
+ * packed form, whose marks are then copied back into the cells.
+ */
+static void solve( Maze* maze, const MazeOptions* solver, int packed, MazeStats* stats )
+{
+    if( !packed )
+    {
+        mazeSolveWith( maze, solver, stats );
+        return;
+    }
+
+    PackedMaze* p = mazePack( maze );
+    if( p == NULL )
+    {
+        fprintf( stderr, "%s: Could not allocate a packed maze, solving unpacked\n", __FUNCTION__ );
+        mazeSolveWith( maze, solver, stats );
+        return;
+    }
+    mazeSolvePacked( p, stats );
+    mazeUnpackMarks( p, maze );
+    mazePackedFree( p );
+}
+
+/* What to do with a maze once it has been received or loaded.
+ */
+typedef struct Settings Settings;
+
+struct Settings
+{
+    MazeOptions solver;
+    uint32_t    view[4];
+    uint32_t    overview;
+    const char* image;
+    int         packed;
+    MazeCache*  cache;
+};
+
+/* Plot, solve and export a maze according to the settings.
+ */
+static void process_maze( Maze* maze, const Settings* settings )
+{
+    /* A cached solution is marked straight into the cells, without
+     * plotting or solving.
+     */
+    uint64_t key = 0;
+    if( settings->cache != NULL )
+    {
+        key = mazeHash( maze );
+        int length = mazeCacheLookup( settings->cache, key, maze );
+        if( length >= 0 )
+        {
+            fprintf( stderr, "%s: Path of %d cells from the cache\n", __FUNCTION__, length );
+            if( settings->image != NULL && mazeExportFile( maze, settings->image ) < 0 )
+            {
+                fprintf( stderr, "%s: Could not write the image %s\n", __FUNCTION__, settings->image );
+            }
+            return;
+        }
+    }
+
+    if( settings->overview > 0 )
+        mazePlotOverview( maze, stdout, settings->overview );
+    else
+        mazePlotViewport( maze, stdout, settings->view[0], settings->view[1],
+                          settings->view[2], settings->view[3] );
+
+    MazeStats stats;
+    solve( maze, &settings->solver, settings->packed, &stats );
+    fprintf( stderr, "%s: Path of %d cells, %llu cells expanded, %llu pruned in %.6f s\n",
+             __FUNCTION__, stats.pathLength,
+             (unsigned long long)stats.expanded,
+             (unsigned long long)stats.pruned, stats.seconds );
+
+    if( settings->cache != NULL && stats.pathLength >= 0 )
+        mazeCacheStore( settings->cache, key, maze );
+
+    if( settings->image != NULL && mazeExportFile( maze, settings->image ) < 0 )
+    {
+        fprintf( stderr, "%s: Could not write the image %s\n", __FUNCTION__, settings->image );
+    }
+}
+
+/* Parse a seed list like "1,5,10-20" into a new array. Returns the
+ * number of seeds, or -1 if the list is malformed.
+ */
+static int parse_seeds( const char* list, long** seeds )
+{
+    int   count    = 0;
+    int   capacity = 16;
+    long* out      = (long*)malloc( capacity * sizeof(long) );
+    if( out == NULL ) return -1;
+
+    const char* p = list;
+    while( 1 )
+    {
+        char* end;
+        long first = strtol( p, &end, 10 );
+        long last  = first;
+        if( end == p ) break;
+        if( *end == '-' )
+        {
+            p = end + 1;
+            last = strtol( p, &end, 10 );
+            if( end == p || last < first ) break;
+        }
+
+        for( long seed = first; seed <= last; seed++ )
+        {
+            if( count == capacity )
+            {
+                long* bigger = (long*)realloc( out, 2 * capacity * sizeof(long) );
+                if( bigger == NULL )
+                {
+                    free( out );
+                    return -1;
+                }
+                out = bigger;
+                capacity *= 2;
+            }
+            out[count++] = seed;
+        }
+
+        if( *end == '\0' )
+        {
+            *seeds = out;
+            return count;
+        }
+        if( *end != ',' ) break;
+        p = end + 1;
+    }
+
+    free( out );
+    return -1;
+}
+
+/* Request, solve and answer several mazes over one connection.
+ */
+static int process_seeds( L4SAP* l4, const long* seeds, int count,
+                          const Settings* settings, int depth )
+{
+    MazePipelineConfig config = { settings->solver, depth, 4, settings->cache };
+    MazePipelineStats  stats;
+
+    int result = mazePipelineRun( l4, seeds, count, &config, &stats );
+    fprintf( stderr, "%s: Solved %d of %d mazes (%d received, %d answered) in %.3f s, %.1f mazes/s\n",
+             __FUNCTION__, stats.solved, count, stats.received, stats.answered, stats.seconds,
+             stats.seconds > 0 ? stats.answered / stats.seconds : 0.0 );
+    if( result < -1 )
+    {
+        fprintf( stderr, "%s: The connection failed (%d)\n", __FUNCTION__, result );
+    }
+    return result == 0 ? 0 : -1;
+}
+
+/* Print the cache counters and destroy the cache.
+ */
+static void close_cache( MazeCache* cache )
+{
+    if( cache == NULL ) return;
+
+    MazeCacheStats stats;
+    mazeCacheGetStats( cache, &stats );
+    fprintf( stderr, "%s: Cache %llu hits (%llu from disk), %llu misses, %llu evictions\n",
+             __FUNCTION__, (unsigned long long)stats.hits, (unsigned long long)stats.diskHits,
+             (unsigned long long)stats.misses, (unsigned long long)stats.evictions );
+    mazeCacheDestroy( cache );
+}
+
+/* Solve a maze from a file without contacting a server.
+ */
+static int process_file( const char* path, const Settings* settings )
+{
+    MazeFile* file = mazeFileOpen( path, 0 );
+    if( file == NULL )
+    {
+        fprintf( stderr, "%s: Could not load a maze from %s\n", __FUNCTION__, path );
+        return -1;
+    }
+
+    process_maze( &file->maze, settings );
+    mazeFileClose( file );
+    return 0;
+}
+
 int main( int argc, char *argv[] )
 {
-    if( argc != 4 ) usage( argv[0] );
+    int msg_mode = 0;
+    int window   = 1;
+    int depth    = 1;
+    Settings settings  = { .solver = { .strategy = MAZE_BFS }, .view = { 0, 0, UINT32_MAX, UINT32_MAX } };
+    const char* load   = NULL;
+    const char* save   = NULL;
+    long cache_entries = 0;
+    const char* cache_dir = NULL;
+    int opt;
+    while( ( opt = getopt( argc, argv, "mw:a:t:pdv:O:o:kf:s:q:c:C:" ) ) != -1 )
+    {
+        switch( opt )
+        {
+        case 'm' :
+            msg_mode = 1;
+            break;
+        case 'w' :
+            window = atoi( optarg );
+            break;
+        case 'a' :
+            if( mazeStrategyFromName( optarg, &settings.solver.strategy ) < 0 ) usage( argv[0] );
+            break;
+        case 't' :
+            settings.solver.threads = atoi( optarg );
+            break;
+        case 'p' :
+            settings.solver.flags |= MAZE_OPT_PASSMASK;
+            break;
+        case 'd' :
+            settings.solver.flags |= MAZE_OPT_DEADEND;
+            break;
+        case 'v' :
+            if( sscanf( optarg, "%u,%u,%u,%u", &settings.view[0], &settings.view[1],
+                        &settings.view[2], &settings.view[3] ) != 4 )
+                usage( argv[0] );
+            break;
+        case 'O' :
+            settings.overview = (uint32_t)strtoul( optarg, NULL, 10 );
+            break;
+        case 'o' :
+            settings.image = optarg;
+            break;
+        case 'k' :
+            settings.packed = 1;
+            break;
+        case 'f' :
+            load = optarg;
+            break;
+        case 's' :
+            save = optarg;
+            break;
+        case 'q' :
+            depth = atoi( optarg );
+            if( depth < 1 ) usage( argv[0] );
+            break;
+        case 'c' :
+            cache_entries = atol( optarg );
+            if( cache_entries < 0 ) usage( argv[0] );
+            break;
+        case 'C' :
+            cache_dir = optarg;
+            break;
+        default :
+            usage( argv[0] );
+        }
+    }
+
+    if( load != NULL && argc - optind != 0 ) usage( argv[0] );
+    if( load == NULL && argc - optind != 3 ) usage( argv[0] );
 
-    L4SAP* l4 = l4sap_create( argv[1], atoi(argv[2]) );
+    /* The packed solver is BFS only and would ignore the other options */
+    if( settings.packed && ( settings.solver.strategy != MAZE_BFS || settings.solver.threads != 0 ||
+                             settings.solver.flags != 0 ) )
+        usage( argv[0] );
+
+    long* seeds = NULL;
+    int   seed_count = 1;
+    if( load == NULL )
+    {
+        seed_count = parse_seeds( argv[optind+2], &seeds );
+        if( seed_count < 1 ) usage( argv[0] );
+        if( seed_count > 1 && ( msg_mode || settings.image != NULL || save != NULL || settings.packed ) )
+            usage( argv[0] );
+    }
+
+    if( cache_entries > 0 || cache_dir != NULL )
+    {
+        settings.cache = mazeCacheCreate( (size_t)cache_entries, cache_dir );
+        if( settings.cache == NULL )
+        {
+            fprintf( stderr, "%s: Could not create the solution cache\n", __FUNCTION__ );
+            free( seeds );
+            return -1;
+        }
+    }
+
+    if( load != NULL )
+    {
+        int result = process_file( load, &settings );
+        close_cache( settings.cache );
+        return result;
+    }
+
+    L4SAP* l4 = l4sap_create( argv[optind], atoi(argv[optind+1]) );
     if( !l4 )
     {
         fprintf( stderr, "%s: Failed to create server\n", __FUNCTION__ );
+        close_cache( settings.cache );
+        free( seeds );
+        return -1;
+    }
+
+    if( window > 1 && l4sap_set_window( l4, window ) < 0 )
+    {
+        fprintf( stderr, "%s: Failed to enable window mode\n", __FUNCTION__ );
+        l4sap_destroy( l4 );
+        close_cache( settings.cache );
+        free( seeds );
         return -1;
     }
 
-    long maze_seed = strtol( argv[3], NULL, 10 );
+    if( seed_count > 1 )
+    {
+        int result = process_seeds( l4, seeds, seed_count, &settings, depth );
+        l4sap_destroy( l4 );
+        close_cache( settings.cache );
+        free( seeds );
+        return result;
+    }
+
+    long maze_seed = seeds[0];
+    free( seeds );
 
-    char buffer[1024];
-    snprintf( buffer, 1024, "MAZE %ld", maze_seed );
+    /* Without -m a maze arrives in a single packet. With -m the buffer
+     * grows to the size of the message.
+     */
+    size_t capacity = L4Payloadsize;
+    char*  buffer   = (char*)malloc( capacity );
+    if( buffer == NULL )
+    {
+        fprintf( stderr, "%s: Could not allocate a receive buffer\n", __FUNCTION__ );
+        l4sap_destroy( l4 );
+        return -1;
+    }
+    snprintf( buffer, capacity, "MAZE %ld", maze_seed );
 
     fprintf( stderr, "%s: Client sends: %s\n", __FUNCTION__, buffer );
 
-    int retval = l4sap_send( l4, (uint8_t*)buffer, strlen(buffer)+1 );
+    long retval = send_message( l4, msg_mode, (uint8_t*)buffer, strlen(buffer)+1 );
     if( retval < 0 )
     {
         fprintf( stderr, "%s: Failed to send data\n", __FUNCTION__ );
     }
 
-    retval = l4sap_recv( l4, (uint8_t*)buffer, 1024 );
+    if( msg_mode )
+        retval = l4sap_recv_msg_alloc( l4, (uint8_t**)&buffer, &capacity );
+    else
+        retval = l4sap_recv( l4, (uint8_t*)buffer, capacity );
     if( retval < 0 )
     {
         fprintf( stderr, "%s: Failed to receive data (error)\n", __FUNCTION__ );
@@ -58,7 +413,7 @@ int main( int argc, char *argv[] )
     }
     else
     {
-        fprintf( stderr, "%s: Received a message of length %d\n", __FUNCTION__, retval );
+        fprintf( stderr, "%s: Received a message of length %ld\n", __FUNCTION__, retval );
 
         if( retval < 8 )
         {
@@ -66,61 +421,35 @@ int main( int argc, char *argv[] )
         }
         else
         {
-            Maze* maze = (Maze*)malloc( sizeof(Maze) );
-            if( maze == NULL )
+            /* The maze is solved in place in the receive buffer, which
+             * already holds the header for the answer. The solvers index
+             * the grid with the header values, so a header that does not
+             * match the message is never used.
+             */
+            Maze maze;
+            if( mazeParseHeader( &maze, buffer, retval ) < 0 )
             {
-                fprintf( stderr, "%s: Could not allocate a Maze structure\n", __FUNCTION__ );
+                fprintf( stderr,
+                         "%s: Message of length %ld has an invalid maze header, not processing\n",
+                         __FUNCTION__, retval );
             }
             else
             {
-                uint32_t* header = (uint32_t*)buffer;
-                maze->edgeLen = ntohl( header[0] );
-                maze->size    = ntohl( header[1] );
-                if( retval != maze->size + MAZE_HEADER_LEN )
-                {
-                    fprintf( stderr,
-                             "%s: Message size should be %d, but it is %d, not processing\n",
-                             __FUNCTION__, (int)(maze->size + MAZE_HEADER_LEN), retval );
-                }
-                else
+                if( save != NULL && mazeFileSave( &maze, save ) < 0 )
                 {
-                    maze->startX = ntohl( header[2] );
-                    maze->startY = ntohl( header[3] );
-                    maze->endX   = ntohl( header[4] );
-                    maze->endY   = ntohl( header[5] );
-                    maze->maze   = (char*)malloc( maze->size );
-                    if( maze->maze == NULL )
-                    {
-                        fprintf( stderr, "%s: Could not allocate a Maze data\n", __FUNCTION__ );
-                    }
-                    else
-                    {
-                        memcpy( maze->maze, &buffer[MAZE_HEADER_LEN], maze->size );
-
-                        mazePlot( maze );
-
-                        mazeSolve( maze );
-
-                        uint32_t* header = (uint32_t*)buffer;
-                        header[0] = htonl( maze->edgeLen );
-                        header[1] = htonl( maze->size );
-                        header[2] = htonl( maze->startX );
-                        header[3] = htonl( maze->startY );
-                        header[4] = htonl( maze->endX );
-                        header[5] = htonl( maze->endY );
-                        memcpy( &buffer[MAZE_HEADER_LEN], maze->maze, maze->size );
-
-                        l4sap_send( l4, (uint8_t*)buffer, maze->size + MAZE_HEADER_LEN );
-
-                        free( maze->maze );
-                    }
+                    fprintf( stderr, "%s: Could not save the maze to %s\n", __FUNCTION__, save );
                 }
-                free( maze );
+
+                process_maze( &maze, &settings );
+
+                send_message( l4, msg_mode, (uint8_t*)buffer, maze.size + MAZE_HEADER_LEN );
             }
         }
     }
 
-    l4sap_send( l4, (uint8_t*)"QUIT", 5 );
+    send_message( l4, msg_mode, (uint8_t*)"QUIT", 5 );
 
     l4sap_destroy( l4 );
+    close_cache( settings.cache );
+    free( buffer );
 }
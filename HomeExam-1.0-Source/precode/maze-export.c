@@ -0,0 +1,351 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "maze.h"
+
+/* The image has the same layout as the plot from mazePlot: a grid of
+ * (2*edgeLen+1) x (2*edgeLen+1) positions where odd lines and columns
+ * are cells and even ones are walls. Each position is classified, one
+ * line at a time, and turned into pixels, so memory use is proportional
+ * to one scanline.
+ */
+
+enum
+{
+    PIXEL_OPEN = 0,
+    PIXEL_WALL = 1,
+    PIXEL_PATH = 2,
+    PIXEL_END  = 3
+};
+
+static inline char cell_at( const struct Maze* maze, uint32_t x, uint32_t y )
+{
+    return maze->maze[ (size_t)y * maze->edgeLen + x ];
+}
+
+static inline int is_marked( const struct Maze* maze, uint32_t x, uint32_t y )
+{
+    return ( cell_at( maze, x, y ) & mark ) != 0;
+}
+
+/* Classify every position of grid line gy into line[].
+ */
+static void classify_line( const struct Maze* maze, uint32_t gy, uint8_t* line )
+{
+    uint32_t edge    = maze->edgeLen;
+    uint32_t columns = 2 * edge + 1;
+
+    if( gy & 1 )
+    {
+        uint32_t y = gy / 2;
+        for( uint32_t gx = 0; gx < columns; gx++ )
+        {
+            uint32_t x = gx / 2;
+            if( gx & 1 )
+            {
+                if( ( x == maze->startX && y == maze->startY ) ||
+                    ( x == maze->endX   && y == maze->endY ) )
+                    line[gx] = PIXEL_END;
+                else
+                    line[gx] = is_marked( maze, x, y ) ? PIXEL_PATH : PIXEL_OPEN;
+                continue;
+            }
+
+            int west = x > 0    && ( cell_at( maze, x - 1, y ) & right );
+            int east = x < edge && ( cell_at( maze, x, y )     & left );
+            if( !west && !east )
+                line[gx] = PIXEL_WALL;
+            else if( x > 0 && x < edge && is_marked( maze, x - 1, y ) && is_marked( maze, x, y ) )
+                line[gx] = PIXEL_PATH;
+            else
+                line[gx] = PIXEL_OPEN;
+        }
+        return;
+    }
+
+    uint32_t y = gy / 2;
+    for( uint32_t gx = 0; gx < columns; gx++ )
+    {
+        uint32_t x = gx / 2;
+        if( !( gx & 1 ) )
+        {
+            line[gx] = PIXEL_WALL;
+            continue;
+        }
+
+        int north = y > 0    && ( cell_at( maze, x, y - 1 ) & down );
+        int south = y < edge && ( cell_at( maze, x, y )     & up );
+        if( !north && !south )
+            line[gx] = PIXEL_WALL;
+        else if( y > 0 && y < edge && is_marked( maze, x, y - 1 ) && is_marked( maze, x, y ) )
+            line[gx] = PIXEL_PATH;
+        else
+            line[gx] = PIXEL_OPEN;
+    }
+}
+
+/* PBM (P4) has only black and white, so every grid position becomes a
+ * 3x3 block: walls are black, open positions white, the path a black
+ * dot in the centre and start and end a black cross.
+ */
+#define PBM_SCALE 3
+
+static int pbm_pixel( uint8_t kind, int sx, int sy )
+{
+    switch( kind )
+    {
+    case PIXEL_WALL : return 1;
+    case PIXEL_PATH : return sx == 1 && sy == 1;
+    case PIXEL_END  : return sx == 1 || sy == 1;
+    default         : return 0;
+    }
+}
+
+static int export_pbm( const struct Maze* maze, FILE* out, uint8_t* line )
+{
+    uint32_t columns = 2 * maze->edgeLen + 1;
+    uint32_t width   = columns * PBM_SCALE;
+    size_t   bytes   = ( width + 7 ) / 8;
+
+    uint8_t* packed = (uint8_t*)malloc( bytes );
+    if( packed == NULL ) return -1;
+
+    fprintf( out, "P4\n%u %u\n", width, width );
+
+    for( uint32_t gy = 0; gy < columns; gy++ )
+    {
+        classify_line( maze, gy, line );
+        for( int sy = 0; sy < PBM_SCALE; sy++ )
+        {
+            memset( packed, 0, bytes );
+            for( uint32_t px = 0; px < width; px++ )
+            {
+                if( pbm_pixel( line[px / PBM_SCALE], px % PBM_SCALE, sy ) )
+                    packed[px >> 3] |= 0x80 >> ( px & 7 );
+            }
+            if( fwrite( packed, 1, bytes, out ) != bytes )
+            {
+                free( packed );
+                return -1;
+            }
+        }
+    }
+
+    free( packed );
+    return 0;
+}
+
+/* PNG with a four-colour palette and 2 bits per pixel, one pixel per
+ * grid position. The image data is a zlib stream of stored (not
+ * compressed) deflate blocks, so no zlib is needed. Every scanline is
+ * written as its own IDAT chunk. The CRC-32 table for the chunks
+ * (polynomial 0xedb88320, reflected) is computed in advance, so several
+ * threads can export at the same time.
+ */
+static const uint32_t crc_table[256] =
+{
+    0x00000000, 0x77073096, 0xee0e612c, 0x990951ba, 0x076dc419, 0x706af48f,
+    0xe963a535, 0x9e6495a3, 0x0edb8832, 0x79dcb8a4, 0xe0d5e91e, 0x97d2d988,
+    0x09b64c2b, 0x7eb17cbd, 0xe7b82d07, 0x90bf1d91, 0x1db71064, 0x6ab020f2,
+    0xf3b97148, 0x84be41de, 0x1adad47d, 0x6ddde4eb, 0xf4d4b551, 0x83d385c7,
+    0x136c9856, 0x646ba8c0, 0xfd62f97a, 0x8a65c9ec, 0x14015c4f, 0x63066cd9,
+    0xfa0f3d63, 0x8d080df5, 0x3b6e20c8, 0x4c69105e, 0xd56041e4, 0xa2677172,
+    0x3c03e4d1, 0x4b04d447, 0xd20d85fd, 0xa50ab56b, 0x35b5a8fa, 0x42b2986c,
+    0xdbbbc9d6, 0xacbcf940, 0x32d86ce3, 0x45df5c75, 0xdcd60dcf, 0xabd13d59,
+    0x26d930ac, 0x51de003a, 0xc8d75180, 0xbfd06116, 0x21b4f4b5, 0x56b3c423,
+    0xcfba9599, 0xb8bda50f, 0x2802b89e, 0x5f058808, 0xc60cd9b2, 0xb10be924,
+    0x2f6f7c87, 0x58684c11, 0xc1611dab, 0xb6662d3d, 0x76dc4190, 0x01db7106,
+    0x98d220bc, 0xefd5102a, 0x71b18589, 0x06b6b51f, 0x9fbfe4a5, 0xe8b8d433,
+    0x7807c9a2, 0x0f00f934, 0x9609a88e, 0xe10e9818, 0x7f6a0dbb, 0x086d3d2d,
+    0x91646c97, 0xe6635c01, 0x6b6b51f4, 0x1c6c6162, 0x856530d8, 0xf262004e,
+    0x6c0695ed, 0x1b01a57b, 0x8208f4c1, 0xf50fc457, 0x65b0d9c6, 0x12b7e950,
+    0x8bbeb8ea, 0xfcb9887c, 0x62dd1ddf, 0x15da2d49, 0x8cd37cf3, 0xfbd44c65,
+    0x4db26158, 0x3ab551ce, 0xa3bc0074, 0xd4bb30e2, 0x4adfa541, 0x3dd895d7,
+    0xa4d1c46d, 0xd3d6f4fb, 0x4369e96a, 0x346ed9fc, 0xad678846, 0xda60b8d0,
+    0x44042d73, 0x33031de5, 0xaa0a4c5f, 0xdd0d7cc9, 0x5005713c, 0x270241aa,
+    0xbe0b1010, 0xc90c2086, 0x5768b525, 0x206f85b3, 0xb966d409, 0xce61e49f,
+    0x5edef90e, 0x29d9c998, 0xb0d09822, 0xc7d7a8b4, 0x59b33d17, 0x2eb40d81,
+    0xb7bd5c3b, 0xc0ba6cad, 0xedb88320, 0x9abfb3b6, 0x03b6e20c, 0x74b1d29a,
+    0xead54739, 0x9dd277af, 0x04db2615, 0x73dc1683, 0xe3630b12, 0x94643b84,
+    0x0d6d6a3e, 0x7a6a5aa8, 0xe40ecf0b, 0x9309ff9d, 0x0a00ae27, 0x7d079eb1,
+    0xf00f9344, 0x8708a3d2, 0x1e01f268, 0x6906c2fe, 0xf762575d, 0x806567cb,
+    0x196c3671, 0x6e6b06e7, 0xfed41b76, 0x89d32be0, 0x10da7a5a, 0x67dd4acc,
+    0xf9b9df6f, 0x8ebeeff9, 0x17b7be43, 0x60b08ed5, 0xd6d6a3e8, 0xa1d1937e,
+    0x38d8c2c4, 0x4fdff252, 0xd1bb67f1, 0xa6bc5767, 0x3fb506dd, 0x48b2364b,
+    0xd80d2bda, 0xaf0a1b4c, 0x36034af6, 0x41047a60, 0xdf60efc3, 0xa867df55,
+    0x316e8eef, 0x4669be79, 0xcb61b38c, 0xbc66831a, 0x256fd2a0, 0x5268e236,
+    0xcc0c7795, 0xbb0b4703, 0x220216b9, 0x5505262f, 0xc5ba3bbe, 0xb2bd0b28,
+    0x2bb45a92, 0x5cb36a04, 0xc2d7ffa7, 0xb5d0cf31, 0x2cd99e8b, 0x5bdeae1d,
+    0x9b64c2b0, 0xec63f226, 0x756aa39c, 0x026d930a, 0x9c0906a9, 0xeb0e363f,
+    0x72076785, 0x05005713, 0x95bf4a82, 0xe2b87a14, 0x7bb12bae, 0x0cb61b38,
+    0x92d28e9b, 0xe5d5be0d, 0x7cdcefb7, 0x0bdbdf21, 0x86d3d2d4, 0xf1d4e242,
+    0x68ddb3f8, 0x1fda836e, 0x81be16cd, 0xf6b9265b, 0x6fb077e1, 0x18b74777,
+    0x88085ae6, 0xff0f6a70, 0x66063bca, 0x11010b5c, 0x8f659eff, 0xf862ae69,
+    0x616bffd3, 0x166ccf45, 0xa00ae278, 0xd70dd2ee, 0x4e048354, 0x3903b3c2,
+    0xa7672661, 0xd06016f7, 0x4969474d, 0x3e6e77db, 0xaed16a4a, 0xd9d65adc,
+    0x40df0b66, 0x37d83bf0, 0xa9bcae53, 0xdebb9ec5, 0x47b2cf7f, 0x30b5ffe9,
+    0xbdbdf21c, 0xcabac28a, 0x53b39330, 0x24b4a3a6, 0xbad03605, 0xcdd70693,
+    0x54de5729, 0x23d967bf, 0xb3667a2e, 0xc4614ab8, 0x5d681b02, 0x2a6f2b94,
+    0xb40bbe37, 0xc30c8ea1, 0x5a05df1b, 0x2d02ef8d
+};
+
+static uint32_t crc_update( uint32_t crc, const uint8_t* data, size_t len )
+{
+    for( size_t i = 0; i < len; i++ )
+        crc = crc_table[ ( crc ^ data[i] ) & 0xff ] ^ ( crc >> 8 );
+    return crc;
+}
+
+static uint32_t adler_update( uint32_t adler, const uint8_t* data, size_t len )
+{
+    uint32_t a = adler & 0xffff;
+    uint32_t b = adler >> 16;
+    while( len > 0 )
+    {
+        /* 5552 bytes is the most that cannot overflow b before the modulo */
+        size_t n = len < 5552 ? len : 5552;
+        len -= n;
+        while( n-- > 0 )
+        {
+            a += *data++;
+            b += a;
+        }
+        a %= 65521;
+        b %= 65521;
+    }
+    return ( b << 16 ) | a;
+}
+
+static inline void put_be32( uint8_t* p, uint32_t v )
+{
+    p[0] = v >> 24;
+    p[1] = v >> 16;
+    p[2] = v >> 8;
+    p[3] = v;
+}
+
+static int png_chunk( FILE* out, const char* type, const uint8_t* data, size_t len )
+{
+    uint8_t head[8];
+    uint8_t tail[4];
+
+    put_be32( head, (uint32_t)len );
+    memcpy( head + 4, type, 4 );
+    uint32_t crc = crc_update( 0xffffffffu, head + 4, 4 );
+    crc = crc_update( crc, data, len );
+    put_be32( tail, ~crc );
+
+    if( fwrite( head, 1, 8, out ) != 8 ) return -1;
+    if( len > 0 && fwrite( data, 1, len, out ) != len ) return -1;
+    if( fwrite( tail, 1, 4, out ) != 4 ) return -1;
+    return 0;
+}
+
+#define STORED_MAX 65535
+
+static int export_png( const struct Maze* maze, FILE* out, uint8_t* line )
+{
+    static const uint8_t signature[8] = { 0x89, 'P', 'N', 'G', '\r', '\n', 0x1a, '\n' };
+    static const uint8_t palette[12]  = { 0xff, 0xff, 0xff,    /* open  */
+                                          0x00, 0x00, 0x00,    /* wall  */
+                                          0xe0, 0x20, 0x20,    /* path  */
+                                          0x20, 0xa0, 0x20 };  /* A, B  */
+
+    uint32_t columns  = 2 * maze->edgeLen + 1;
+    size_t   rowbytes = 1 + ( (size_t)columns * 2 + 7 ) / 8;  /* filter byte + pixels */
+    size_t   blocks   = ( rowbytes + STORED_MAX - 1 ) / STORED_MAX;
+
+    /* zlib header + stored block headers + the row */
+    uint8_t* idat = (uint8_t*)malloc( 2 + blocks * 5 + rowbytes );
+    uint8_t* row  = (uint8_t*)malloc( rowbytes );
+    if( idat == NULL || row == NULL )
+    {
+        free( idat );
+        free( row );
+        return -1;
+    }
+
+    uint8_t ihdr[13];
+    put_be32( ihdr, columns );
+    put_be32( ihdr + 4, columns );
+    ihdr[8]  = 2;   /* bit depth */
+    ihdr[9]  = 3;   /* palette */
+    ihdr[10] = 0;
+    ihdr[11] = 0;
+    ihdr[12] = 0;
+
+    int err = 0;
+    if( fwrite( signature, 1, 8, out ) != 8 ) err = -1;
+    if( !err ) err = png_chunk( out, "IHDR", ihdr, sizeof(ihdr) );
+    if( !err ) err = png_chunk( out, "PLTE", palette, sizeof(palette) );
+
+    uint32_t adler = 1;
+    for( uint32_t gy = 0; gy < columns && !err; gy++ )
+    {
+        classify_line( maze, gy, line );
+
+        memset( row, 0, rowbytes );
+        for( uint32_t gx = 0; gx < columns; gx++ )
+            row[ 1 + gx / 4 ] |= line[gx] << ( 6 - 2 * ( gx % 4 ) );
+        adler = adler_update( adler, row, rowbytes );
+
+        size_t n = 0;
+        if( gy == 0 )
+        {
+            idat[n++] = 0x78;   /* deflate, 32K window */
+            idat[n++] = 0x01;   /* no preset dictionary, fastest */
+        }
+        for( size_t off = 0; off < rowbytes; off += STORED_MAX )
+        {
+            size_t len = rowbytes - off < STORED_MAX ? rowbytes - off : STORED_MAX;
+            idat[n++] = 0x00;   /* BFINAL=0, BTYPE=stored */
+            idat[n++] = len & 0xff;
+            idat[n++] = len >> 8;
+            idat[n++] = ~len & 0xff;
+            idat[n++] = ( ~len >> 8 ) & 0xff;
+            memcpy( idat + n, row + off, len );
+            n += len;
+        }
+        err = png_chunk( out, "IDAT", idat, n );
+    }
+
+    if( !err )
+    {
+        /* empty final block and the Adler-32 of all the rows */
+        uint8_t last[9] = { 0x01, 0x00, 0x00, 0xff, 0xff };
+        put_be32( last + 5, adler );
+        err = png_chunk( out, "IDAT", last, sizeof(last) );
+    }
+    if( !err ) err = png_chunk( out, "IEND", NULL, 0 );
+
+    free( idat );
+    free( row );
+    return err;
+}
+
+int mazeExport( const struct Maze* maze, FILE* out, MazeImageFormat format )
+{
+    uint8_t* line = (uint8_t*)malloc( 2 * (size_t)maze->edgeLen + 1 );
+    if( line == NULL ) return -1;
+
+    int err = format == MAZE_IMAGE_PNG ? export_png( maze, out, line )
+                                       : export_pbm( maze, out, line );
+    free( line );
+    if( err == 0 && fflush( out ) != 0 ) err = -1;
+    return err;
+}
+
+int mazeExportFile( const struct Maze* maze, const char* path )
+{
+    size_t len = strlen( path );
+    MazeImageFormat format = MAZE_IMAGE_PBM;
+    if( len >= 4 && strcmp( path + len - 4, ".png" ) == 0 ) format = MAZE_IMAGE_PNG;
+
+    FILE* out = fopen( path, "wb" );
+    if( out == NULL ) return -1;
+
+    int err = mazeExport( maze, out, format );
+    if( fclose( out ) != 0 ) err = -1;
+    return err;
+}
@@ -0,0 +1,116 @@
+#include <stdlib.h>
+#include <string.h>
+#include <stdint.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <arpa/inet.h>
+
+#include "maze.h"
+#include "log.h"
+
+// Filformatet er det samme som på nettet: seks uint32 i
+// nettverksrekkefølge (edgeLen, size, startX, startY, endX, endY) og
+// deretter size celler. Cellene leses aldri inn, maze->maze peker rett
+// inn i mappingen.
+
+MazeFile* mazeFileOpen(const char* path, int writable) {
+    int fd = open(path, writable ? O_RDWR : O_RDONLY);
+    if (fd < 0) {
+        LOG_WARN("WARNING: Kan ikke åpne %s\n", path);
+        return NULL;
+    }
+
+    struct stat st;
+    if (fstat(fd, &st) < 0 || (size_t)st.st_size < MAZE_HEADER_LEN) {
+        LOG_WARN("WARNING: %s er for liten til å være en labyrint\n", path);
+        close(fd);
+        return NULL;
+    }
+
+    // Uten writable er mappingen privat: søket kan merke cellene, men
+    // endringene havner aldri i filen
+    size_t length = (size_t)st.st_size;
+    void* map = mmap(NULL, length, PROT_READ | PROT_WRITE,
+                     writable ? MAP_SHARED : MAP_PRIVATE, fd, 0);
+    close(fd);
+    if (map == MAP_FAILED) {
+        LOG_WARN("WARNING: mmap av %s feilet\n", path);
+        return NULL;
+    }
+
+    MazeFile* file = malloc(sizeof(MazeFile));
+    if (file == NULL) {
+        munmap(map, length);
+        return NULL;
+    }
+    file->map = map;
+    file->length = length;
+    file->writable = writable;
+
+    // Sjekker at headeren henger sammen med filstørrelsen
+    if (mazeParseHeader(&file->maze, (char*)map, length) < 0) {
+        LOG_WARN("WARNING: %s har en ugyldig labyrint-header\n", path);
+        mazeFileClose(file);
+        return NULL;
+    }
+
+    // Søkene går gjennom cellene i rekkefølge og hopper rundt, så vi ber
+    // kjernen lese inn alt med en gang
+    madvise(map, length, MADV_WILLNEED);
+
+    return file;
+}
+
+int mazeFileClose(MazeFile* file) {
+    if (file == NULL) {
+        return 0;
+    }
+
+    int result = 0;
+    if (file->writable && msync(file->map, file->length, MS_SYNC) < 0) {
+        result = -1;
+    }
+    if (munmap(file->map, file->length) < 0) {
+        result = -1;
+    }
+    free(file);
+    return result;
+}
+
+int mazeFileSave(const Maze* maze, const char* path) {
+    size_t length = MAZE_HEADER_LEN + (size_t)maze->size;
+
+    int fd = open(path, O_RDWR | O_CREAT | O_TRUNC, 0644);
+    if (fd < 0) {
+        return -1;
+    }
+    if (ftruncate(fd, (off_t)length) < 0) {
+        close(fd);
+        return -1;
+    }
+
+    void* map = mmap(NULL, length, PROT_READ | PROT_WRITE, MAP_SHARED, fd, 0);
+    close(fd);
+    if (map == MAP_FAILED) {
+        return -1;
+    }
+
+    uint32_t header[6];
+    header[0] = htonl(maze->edgeLen);
+    header[1] = htonl(maze->size);
+    header[2] = htonl(maze->startX);
+    header[3] = htonl(maze->startY);
+    header[4] = htonl(maze->endX);
+    header[5] = htonl(maze->endY);
+    memcpy(map, header, MAZE_HEADER_LEN);
+    memcpy((char*)map + MAZE_HEADER_LEN, maze->maze, maze->size);
+
+    int result = 0;
+    if (msync(map, length, MS_SYNC) < 0) {
+        result = -1;
+    }
+    munmap(map, length);
+    return result;
+}
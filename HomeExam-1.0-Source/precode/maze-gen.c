@@ -0,0 +1,163 @@
+#include <stdlib.h>
+#include <string.h>
+#include <stdint.h>
+
+#include "maze.h"
+
+// Labyrintgenerator med Ellers algoritme: labyrinten bygges én rad om
+// gangen, og bare settet hver celle i raden tilhører huskes. Det gir en
+// perfekt labyrint (nøyaktig én vei mellom to celler) med O(edgeLen)
+// minne i tillegg til selve rutenettet.
+//
+// Tilfeldighetene kommer fra splitmix64, så samme frø gir samme labyrint
+// på alle plattformer. Det er ikke den samme labyrinten som maze-server
+// lager for samme frø; den algoritmen er ikke kjent.
+
+typedef struct Rng Rng;
+struct Rng {
+    uint64_t state;
+    uint64_t bits; // ubrukte tilfeldige bit
+    int nbits;
+};
+
+static uint64_t rng_next(Rng* rng) {
+    uint64_t z = (rng->state += 0x9e3779b97f4a7c15ull);
+    z = (z ^ (z >> 30)) * 0xbf58476d1ce4e5b9ull;
+    z = (z ^ (z >> 27)) * 0x94d049bb133111ebull;
+    return z ^ (z >> 31);
+}
+
+static int rng_coin(Rng* rng) {
+    if (rng->nbits == 0) {
+        rng->bits = rng_next(rng);
+        rng->nbits = 64;
+    }
+    int bit = rng->bits & 1;
+    rng->bits >>= 1;
+    rng->nbits--;
+    return bit;
+}
+
+// Union-find over settene i én rad. Merkelappene ligger i [0, 2*edgeLen)
+static uint32_t set_find(uint32_t* parent, uint32_t a) {
+    while (parent[a] != a) {
+        parent[a] = parent[parent[a]];
+        a = parent[a];
+    }
+    return a;
+}
+
+static void open_wall(Maze* maze, uint32_t cell, uint32_t next, char dir, char back) {
+    maze->maze[cell] |= dir;
+    maze->maze[next] |= back;
+}
+
+Maze* mazeGenerate(uint32_t edgeLen, long seed) {
+    if (edgeLen == 0 || (uint64_t)edgeLen * edgeLen > UINT32_MAX) {
+        return NULL;
+    }
+
+    Maze* maze = malloc(sizeof(Maze));
+    if (maze == NULL) {
+        return NULL;
+    }
+    maze->edgeLen = edgeLen;
+    maze->size = edgeLen * edgeLen;
+    maze->maze = calloc(maze->size, 1);
+
+    uint32_t labels = 2 * edgeLen;
+    uint32_t* label = malloc(edgeLen * sizeof(uint32_t)); // settet til hver celle i raden
+    uint32_t* parent = malloc(labels * sizeof(uint32_t));
+    uint32_t* renamed = malloc(labels * sizeof(uint32_t)); // rot -> ny merkelapp
+    uint8_t* has_down = malloc(labels);
+    uint8_t* down_open = malloc(edgeLen);
+
+    if (maze->maze == NULL || label == NULL || parent == NULL || renamed == NULL ||
+        has_down == NULL || down_open == NULL) {
+        free(maze->maze);
+        free(maze);
+        maze = NULL;
+        goto out;
+    }
+
+    Rng rng = {(uint64_t)seed, 0, 0};
+
+    for (uint32_t x = 0; x < edgeLen; x++) {
+        label[x] = x;
+    }
+
+    for (uint32_t y = 0; y < edgeLen; y++) {
+        uint32_t row = y * edgeLen;
+        int last = (y + 1 == edgeLen);
+
+        for (uint32_t i = 0; i < labels; i++) {
+            parent[i] = i;
+        }
+
+        // Slår sammen naboer i ulike sett tilfeldig (alle i siste rad)
+        for (uint32_t x = 0; x + 1 < edgeLen; x++) {
+            uint32_t a = set_find(parent, label[x]);
+            uint32_t b = set_find(parent, label[x + 1]);
+            if (a != b && (last || rng_coin(&rng))) {
+                parent[b] = a;
+                open_wall(maze, row + x, row + x + 1, right, left);
+            }
+        }
+        if (last) break;
+
+        // Minst én celle i hvert sett må få vei ned. Først tilfeldig, så
+        // tvinges den siste cellen i hvert sett som ikke har fått det
+        memset(has_down, 0, labels);
+        for (uint32_t x = 0; x < edgeLen; x++) {
+            down_open[x] = rng_coin(&rng);
+            if (down_open[x]) {
+                has_down[set_find(parent, label[x])] = 1;
+            }
+        }
+        for (uint32_t x = edgeLen; x-- > 0;) {
+            uint32_t root = set_find(parent, label[x]);
+            if (!has_down[root]) {
+                down_open[x] = 1;
+                has_down[root] = 1;
+            }
+        }
+
+        // Neste rad: celler med vei ned beholder settet (med ny, kompakt
+        // merkelapp), resten får nye sett
+        for (uint32_t i = 0; i < labels; i++) {
+            renamed[i] = UINT32_MAX;
+        }
+        uint32_t used = 0;
+        for (uint32_t x = 0; x < edgeLen; x++) {
+            if (!down_open[x]) continue;
+            uint32_t root = set_find(parent, label[x]);
+            if (renamed[root] == UINT32_MAX) {
+                renamed[root] = used++;
+            }
+        }
+        for (uint32_t x = 0; x < edgeLen; x++) {
+            if (down_open[x]) {
+                label[x] = renamed[set_find(parent, label[x])];
+                open_wall(maze, row + x, row + edgeLen + x, down, up);
+            } else {
+                label[x] = used++;
+            }
+        }
+    }
+
+    // Start og slutt trekkes fra samme tallrekke, og er ulike når det går
+    maze->startX = rng_next(&rng) % edgeLen;
+    maze->startY = rng_next(&rng) % edgeLen;
+    do {
+        maze->endX = rng_next(&rng) % edgeLen;
+        maze->endY = rng_next(&rng) % edgeLen;
+    } while (maze->size > 1 && maze->endX == maze->startX && maze->endY == maze->startY);
+
+out:
+    free(label);
+    free(parent);
+    free(renamed);
+    free(has_down);
+    free(down_open);
+    return maze;
+}
@@ -0,0 +1,245 @@
+#include <stdlib.h>
+#include <string.h>
+#include <stdint.h>
+
+#include "maze.h"
+
+// Passerbarhetsmaske: bit d er satt i pass[i] bare hvis cellen har
+// retningsbiten, naboen har den motsatte biten og naboen ligger inne i
+// labyrinten. Da kan søket teste én byte per steg uten grensesjekker.
+//
+// Hver rad beregnes fra raden over og raden under. Første og siste rad
+// får en rad med nuller som nabo, så opp/ned forsvinner der av seg selv,
+// mens første og siste kolonne gjøres skalart.
+
+static inline uint8_t pass_cell(const uint8_t* above, const uint8_t* row, const uint8_t* below,
+                                uint32_t x, uint32_t edge) {
+    uint8_t c = row[x];
+    uint8_t out = 0;
+
+    if (x > 0 && (row[x - 1] & right)) out |= c & left;
+    if (x + 1 < edge && (row[x + 1] & left)) out |= c & right;
+    if (above[x] & down) out |= c & up;
+    if (below[x] & up) out |= c & down;
+
+    return out;
+}
+
+static void pass_row_scalar(const uint8_t* above, const uint8_t* row, const uint8_t* below,
+                            uint8_t* out, uint32_t from, uint32_t edge) {
+    for (uint32_t x = from; x < edge; x++) {
+        out[x] = pass_cell(above, row, below, x, edge);
+    }
+}
+
+#if defined(__x86_64__)
+#include <immintrin.h>
+
+// Samme regel for 16 celler om gangen. Naboens motsatte bit flyttes til
+// riktig plass med skift på 16-bits ord; bitene som lekker mellom bytene
+// fjernes av masken etterpå
+static uint32_t pass_row_sse2(const uint8_t* above, const uint8_t* row, const uint8_t* below,
+                              uint8_t* out, uint32_t edge) {
+    const __m128i L = _mm_set1_epi8(left);
+    const __m128i R = _mm_set1_epi8(right);
+    const __m128i U = _mm_set1_epi8(up);
+    const __m128i D = _mm_set1_epi8(down);
+
+    uint32_t x = 1;
+    for (; x + 16 < edge; x += 16) {
+        __m128i c = _mm_loadu_si128((const __m128i*)(row + x));
+        __m128i w = _mm_loadu_si128((const __m128i*)(row + x - 1));
+        __m128i e = _mm_loadu_si128((const __m128i*)(row + x + 1));
+        __m128i n = _mm_loadu_si128((const __m128i*)(above + x));
+        __m128i s = _mm_loadu_si128((const __m128i*)(below + x));
+
+        __m128i open = _mm_and_si128(_mm_srli_epi16(w, 1), L);
+        open = _mm_or_si128(open, _mm_and_si128(_mm_slli_epi16(e, 1), R));
+        open = _mm_or_si128(open, _mm_and_si128(_mm_srli_epi16(n, 1), U));
+        open = _mm_or_si128(open, _mm_and_si128(_mm_slli_epi16(s, 1), D));
+
+        _mm_storeu_si128((__m128i*)(out + x), _mm_and_si128(c, open));
+    }
+    return x;
+}
+
+__attribute__((target("avx2")))
+static uint32_t pass_row_avx2(const uint8_t* above, const uint8_t* row, const uint8_t* below,
+                              uint8_t* out, uint32_t edge) {
+    const __m256i L = _mm256_set1_epi8(left);
+    const __m256i R = _mm256_set1_epi8(right);
+    const __m256i U = _mm256_set1_epi8(up);
+    const __m256i D = _mm256_set1_epi8(down);
+
+    uint32_t x = 1;
+    for (; x + 32 < edge; x += 32) {
+        __m256i c = _mm256_loadu_si256((const __m256i*)(row + x));
+        __m256i w = _mm256_loadu_si256((const __m256i*)(row + x - 1));
+        __m256i e = _mm256_loadu_si256((const __m256i*)(row + x + 1));
+        __m256i n = _mm256_loadu_si256((const __m256i*)(above + x));
+        __m256i s = _mm256_loadu_si256((const __m256i*)(below + x));
+
+        __m256i open = _mm256_and_si256(_mm256_srli_epi16(w, 1), L);
+        open = _mm256_or_si256(open, _mm256_and_si256(_mm256_slli_epi16(e, 1), R));
+        open = _mm256_or_si256(open, _mm256_and_si256(_mm256_srli_epi16(n, 1), U));
+        open = _mm256_or_si256(open, _mm256_and_si256(_mm256_slli_epi16(s, 1), D));
+
+        _mm256_storeu_si256((__m256i*)(out + x), _mm256_and_si256(c, open));
+    }
+    return x;
+}
+#endif
+
+static MazeSimd pass_select(MazeSimd simd) {
+#if defined(__x86_64__)
+    // Ingen mellomlagring i en static: masker kan lages fra flere
+    // tråder samtidig, og oppslaget er billig
+    int has_avx2 = __builtin_cpu_supports("avx2");
+    if (simd == MAZE_SIMD_AUTO) {
+        return has_avx2 ? MAZE_SIMD_AVX2 : MAZE_SIMD_SSE2;
+    }
+    if (simd == MAZE_SIMD_AVX2 && !has_avx2) {
+        return MAZE_SIMD_SSE2;
+    }
+    return simd;
+#else
+    (void)simd;
+    return MAZE_SIMD_SCALAR;
+#endif
+}
+
+int mazePassMask(const Maze* maze, uint8_t* pass, MazeSimd simd) {
+    uint32_t edge = maze->edgeLen;
+    const uint8_t* grid = (const uint8_t*)maze->maze;
+
+    // Nabo-raden over første og under siste rad. Små labyrinter (alle
+    // som får plass i én pakke) klarer seg med stakken, så masken kan
+    // lages for hver labyrint uten malloc
+    uint8_t zero_row[1024] = {0};
+    uint8_t* zero = edge <= sizeof(zero_row) ? zero_row : calloc(edge, 1);
+    if (zero == NULL) {
+        return -1;
+    }
+
+    simd = pass_select(simd);
+
+    for (uint32_t y = 0; y < edge; y++) {
+        const uint8_t* row = grid + (size_t)y * edge;
+        const uint8_t* above = y > 0 ? row - edge : zero;
+        const uint8_t* below = y + 1 < edge ? row + edge : zero;
+        uint8_t* out = pass + (size_t)y * edge;
+
+        // Første kolonne gjøres alltid skalart, siden den mangler nabo til venstre
+        uint32_t x = 0;
+        if (edge > 0) {
+            out[0] = pass_cell(above, row, below, 0, edge);
+            x = 1;
+        }
+
+#if defined(__x86_64__)
+        if (simd == MAZE_SIMD_AVX2) {
+            x = pass_row_avx2(above, row, below, out, edge);
+        } else if (simd == MAZE_SIMD_SSE2) {
+            x = pass_row_sse2(above, row, below, out, edge);
+        }
+#endif
+        pass_row_scalar(above, row, below, out, x, edge);
+    }
+
+    if (zero != zero_row) {
+        free(zero);
+    }
+    return (int)simd;
+}
+
+// Antall åpne retninger i en maskebyte
+static inline int pass_degree(uint8_t bits) {
+    return __builtin_popcount(bits & (left | right | up | down));
+}
+
+// Naboen i den eneste åpne retningen, og biten den har tilbake til cell
+static inline uint32_t pass_only_neighbour(uint8_t bits, uint32_t cell, uint32_t edge, uint8_t* back) {
+    if (bits & left)  { *back = right; return cell - 1; }
+    if (bits & right) { *back = left;  return cell + 1; }
+    if (bits & up)    { *back = down;  return cell - edge; }
+    *back = up;
+    return cell + edge;
+}
+
+// Dobler stakken. Fra arenaen må innholdet kopieres, og den gamle
+// plassen blir liggende til neste reset
+static uint32_t* stack_grow(MazeArena* arena, uint32_t* stack, size_t capacity) {
+    if (arena == NULL) {
+        return realloc(stack, capacity * 2 * sizeof(uint32_t));
+    }
+    uint32_t* bigger = mazeArenaAlloc(arena, capacity * 2 * sizeof(uint32_t));
+    if (bigger != NULL) {
+        memcpy(bigger, stack, capacity * sizeof(uint32_t));
+    }
+    return bigger;
+}
+
+// Blindveifylling: celler med høyst én åpen retning (unntatt start og
+// slutt) fjernes fra masken, og naboen mister retningen tilbake. Blir
+// naboen selv en blindvei, legges den på stakken. I en perfekt labyrint
+// står bare korridoren fra start til slutt igjen
+long mazeFillDeadEndsWith(const Maze* maze, uint8_t* pass, MazeArena* arena) {
+    uint32_t edge = maze->edgeLen;
+    uint32_t start = maze->startY * edge + maze->startX;
+    uint32_t end = maze->endY * edge + maze->endX;
+
+    size_t capacity = 1024;
+    size_t count = 0;
+    uint32_t* stack = arena != NULL ? mazeArenaAlloc(arena, capacity * sizeof(uint32_t))
+                                    : malloc(capacity * sizeof(uint32_t));
+    if (stack == NULL) {
+        return -1;
+    }
+
+    // Hver celle legges på stakken høyst én gang: enten her, eller når
+    // graden faller fra 2 til 1
+    for (uint32_t i = 0; i < maze->size; i++) {
+        if (i == start || i == end || pass_degree(pass[i]) > 1) continue;
+
+        if (count == capacity) {
+            uint32_t* bigger = stack_grow(arena, stack, capacity);
+            if (bigger == NULL) {
+                if (arena == NULL) {
+                    free(stack);
+                }
+                return -1;
+            }
+            stack = bigger;
+            capacity *= 2;
+        }
+        stack[count++] = i;
+    }
+
+    long pruned = 0;
+    while (count > 0) {
+        uint32_t cell = stack[--count];
+        uint8_t bits = pass[cell];
+        pruned++;
+
+        if (pass_degree(bits) == 0) continue;
+
+        uint8_t back;
+        uint32_t next = pass_only_neighbour(bits, cell, edge, &back);
+        pass[cell] = 0;
+        pass[next] &= ~back;
+
+        if (next != start && next != end && pass_degree(pass[next]) == 1) {
+            // Cellen vi nettopp tok av stakken gir plass til naboen
+            stack[count++] = next;
+        }
+    }
+
+    if (arena == NULL) {
+        free(stack);
+    }
+    return pruned;
+}
+
+long mazeFillDeadEnds(const Maze* maze, uint8_t* pass) {
+    return mazeFillDeadEndsWith(maze, pass, NULL);
+}
@@ -0,0 +1,155 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "l4reactor.h"
+#include "maze.h"
+
+/* One maze request in flight. The buffer must outlive every send and
+ * receive that the reactor performs for the session.
+ */
+typedef struct MazeJob MazeJob;
+
+struct MazeJob
+{
+    long seed;
+    int  done;
+    int  solved;
+    char buffer[1024];
+};
+
+void usage( const char* name )
+{
+    fprintf( stderr, "Usage: %s <serverip> <port> <maze-seed> <count>\n"
+                     "       serverip  - IPv4 address of the servers in dotted decimal notation\n"
+                     "       port      - The first server's port; server i listens on port+i\n"
+                     "       maze-seed - random number generator seed of the first maze\n"
+                     "       count     - number of mazes to solve at the same time\n", name );
+    exit( -1 );
+}
+
+static void quit_sent( L4Session* session, int result, void* arg )
+{
+    (void)session;
+    (void)result;
+    MazeJob* job = (MazeJob*)arg;
+    job->done = 1;
+}
+
+static void finish( L4Session* session, MazeJob* job )
+{
+    l4reactor_send( session, (uint8_t*)"QUIT", 5, quit_sent, job );
+}
+
+static void solution_sent( L4Session* session, int result, void* arg )
+{
+    MazeJob* job = (MazeJob*)arg;
+    if( result < 0 )
+    {
+        fprintf( stderr, "%s: seed %ld: failed to send solution\n", __FUNCTION__, job->seed );
+    }
+    else
+    {
+        job->solved = 1;
+    }
+    finish( session, job );
+}
+
+/* Solves the maze in job->buffer in place and returns the length of the
+ * reply, or -1 if the message does not contain a valid maze or the maze
+ * has no path.
+ */
+static int solve_in_place( MazeJob* job, int len )
+{
+    Maze maze;
+    if( mazeParseHeader( &maze, job->buffer, len ) < 0 ) return -1;
+
+    if( mazeSolve( &maze ) < 0 ) return -1;
+    return len;
+}
+
+static void maze_received( L4Session* session, int result, void* arg )
+{
+    MazeJob* job = (MazeJob*)arg;
+    if( result <= 0 )
+    {
+        fprintf( stderr, "%s: seed %ld: failed to receive maze\n", __FUNCTION__, job->seed );
+        job->done = 1;
+        return;
+    }
+
+    int len = solve_in_place( job, result );
+    if( len < 0 )
+    {
+        fprintf( stderr, "%s: seed %ld: message of length %d is not a maze with a path\n",
+                 __FUNCTION__, job->seed, result );
+        finish( session, job );
+        return;
+    }
+
+    l4reactor_send( session, (uint8_t*)job->buffer, len, solution_sent, job );
+}
+
+static void request_sent( L4Session* session, int result, void* arg )
+{
+    MazeJob* job = (MazeJob*)arg;
+    if( result < 0 )
+    {
+        fprintf( stderr, "%s: seed %ld: failed to send request\n", __FUNCTION__, job->seed );
+        job->done = 1;
+        return;
+    }
+    l4reactor_recv( session, (uint8_t*)job->buffer, sizeof(job->buffer), maze_received, job );
+}
+
+int main( int argc, char *argv[] )
+{
+    if( argc != 5 ) usage( argv[0] );
+
+    int  port  = atoi( argv[2] );
+    long seed  = strtol( argv[3], NULL, 10 );
+    int  count = atoi( argv[4] );
+    if( count < 1 ) usage( argv[0] );
+
+    L4Reactor* reactor = l4reactor_create( );
+    if( !reactor )
+    {
+        fprintf( stderr, "%s: Failed to create reactor\n", __FUNCTION__ );
+        return -1;
+    }
+
+    MazeJob* jobs = calloc( count, sizeof(MazeJob) );
+    if( !jobs )
+    {
+        fprintf( stderr, "%s: Could not allocate jobs\n", __FUNCTION__ );
+        l4reactor_destroy( reactor );
+        return -1;
+    }
+
+    for( int i=0; i<count; i++ )
+    {
+        L4SAP* l4 = l4sap_create( argv[1], port+i );
+        L4Session* session = l4 ? l4reactor_add( reactor, l4, &jobs[i] ) : NULL;
+        if( !session )
+        {
+            fprintf( stderr, "%s: Failed to create session %d\n", __FUNCTION__, i );
+            jobs[i].done = 1;
+            continue;
+        }
+
+        jobs[i].seed = seed + i;
+        snprintf( jobs[i].buffer, sizeof(jobs[i].buffer), "MAZE %ld", jobs[i].seed );
+        fprintf( stderr, "%s: Client sends: %s to port %d\n", __FUNCTION__, jobs[i].buffer, port+i );
+        l4reactor_send( session, (uint8_t*)jobs[i].buffer, strlen(jobs[i].buffer)+1, request_sent, &jobs[i] );
+    }
+
+    l4reactor_run( reactor );
+
+    int solved = 0;
+    for( int i=0; i<count; i++ ) solved += jobs[i].solved;
+    fprintf( stderr, "%s: Solved %d of %d mazes\n", __FUNCTION__, solved, count );
+
+    l4reactor_destroy( reactor );
+    free( jobs );
+    return solved == count ? 0 : -1;
+}
@@ -0,0 +1,72 @@
+#include <stdlib.h>
+#include <string.h>
+#include <stdint.h>
+
+#include "maze.h"
+
+// Pakket labyrint: retningsbitene left/right/up/down ligger på plass 1-4
+// i en vanlig celle, så nibbelen er bare cellen skiftet én plass ned.
+// mark og tmark tas ikke med; besøkt og sti ligger i egne bitsett.
+
+static inline uint8_t wire_to_nibble(char cell) {
+    return ((uint8_t)cell >> 1) & 0xf;
+}
+
+PackedMaze* mazePack(const Maze* maze) {
+    PackedMaze* packed = malloc(sizeof(PackedMaze));
+    if (packed == NULL) {
+        return NULL;
+    }
+
+    packed->edgeLen = maze->edgeLen;
+    packed->size = maze->size;
+    packed->startX = maze->startX;
+    packed->startY = maze->startY;
+    packed->endX = maze->endX;
+    packed->endY = maze->endY;
+
+    size_t words = ((size_t)maze->size + 63) / 64;
+    packed->walls = malloc(((size_t)maze->size + 1) / 2);
+    packed->visited = calloc(words, sizeof(uint64_t));
+    packed->path = calloc(words, sizeof(uint64_t));
+    if (packed->walls == NULL || packed->visited == NULL || packed->path == NULL) {
+        mazePackedFree(packed);
+        return NULL;
+    }
+
+    // To celler per byte, partall celle i den nederste nibbelen
+    uint32_t i = 0;
+    for (; i + 1 < maze->size; i += 2) {
+        packed->walls[i >> 1] = wire_to_nibble(maze->maze[i]) |
+                                (uint8_t)(wire_to_nibble(maze->maze[i + 1]) << 4);
+    }
+    if (i < maze->size) {
+        packed->walls[i >> 1] = wire_to_nibble(maze->maze[i]);
+    }
+
+    return packed;
+}
+
+void mazeUnpackMarks(const PackedMaze* packed, Maze* maze) {
+    size_t words = ((size_t)packed->size + 63) / 64;
+
+    // Hopper over tomme ord, stien er som regel en liten del av labyrinten
+    for (size_t w = 0; w < words; w++) {
+        uint64_t bits = packed->path[w];
+        while (bits != 0) {
+            int b = __builtin_ctzll(bits);
+            maze->maze[w * 64 + b] |= mark;
+            bits &= bits - 1;
+        }
+    }
+}
+
+void mazePackedFree(PackedMaze* packed) {
+    if (packed == NULL) {
+        return;
+    }
+    free(packed->walls);
+    free(packed->visited);
+    free(packed->path);
+    free(packed);
+}
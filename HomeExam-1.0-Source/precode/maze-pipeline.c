@@ -0,0 +1,454 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <fcntl.h>
+#include <poll.h>
+#include <pthread.h>
+#include <sys/time.h>
+
+#include "maze-pipeline.h"
+#include "log.h"
+
+// En labyrint på vei gjennom pipelinen. Den løses på plass i bufferet,
+// som så sendes tilbake uendret i størrelse. Jobbene kommer fra en
+// FramePool som lages i mazePipelineRun, og tas fra poolen i én tråd og
+// gis tilbake i en annen
+typedef struct PipeJob PipeJob;
+struct PipeJob {
+    long seed;
+    int len;
+    int solved;
+    uint8_t buffer[L4Payloadsize];
+};
+
+// Begrenset FIFO-kø mellom to trinn. Når køen er lukket, feiler push
+// med en gang, mens pop tømmer det som er igjen før den gir NULL
+typedef struct PipeQueue PipeQueue;
+struct PipeQueue {
+    pthread_mutex_t lock;
+    pthread_cond_t not_empty;
+    pthread_cond_t not_full;
+    PipeJob** jobs;
+    int capacity;
+    int head;
+    int count;
+    int closed;
+};
+
+typedef struct Pipeline Pipeline;
+struct Pipeline {
+    L4SAP* l4;
+    const long* seeds;
+    int count;
+    const MazePipelineConfig* config;
+
+    // l4_lock beskytter L4SAP-en og feltene under. Mottakstråden
+    // signaliserer l4_progress hver gang den har behandlet det som kom
+    // inn, så sendetråden kan prøve igjen når vinduet var fullt
+    pthread_mutex_t l4_lock;
+    pthread_cond_t l4_progress;
+    int error; // første feil, 0 hvis alt går bra
+    int quit_sent; // QUIT ligger i sendevinduet
+    int finished; // QUIT er kvittert, eller peer har avsluttet etter QUIT
+
+    // Vekker mottakstråden fra poll() når sendetråden har brukt L4SAP-en,
+    // siden den kan ha lest rammer som ligger igjen i L4-bufferet
+    int wake[2];
+
+    PipeQueue solve_queue;
+    PipeQueue send_queue;
+    MazePipelineStats stats;
+
+    // Ingen malloc per labyrint: jobbene kommer fra poolen, og løsetrinnet
+    // bruker arenaen (nullstilt etter hver labyrint) til arbeidsminnet
+    FramePool* jobs;
+    MazeArena* arena;
+    MazeOptions solver; // config->solver med arena satt
+};
+
+
+static int queue_init(PipeQueue* q, int capacity) {
+    q->jobs = malloc(capacity * sizeof(PipeJob*));
+    if (q->jobs == NULL) {
+        return -1;
+    }
+    pthread_mutex_init(&q->lock, NULL);
+    pthread_cond_init(&q->not_empty, NULL);
+    pthread_cond_init(&q->not_full, NULL);
+    q->capacity = capacity;
+    q->head = 0;
+    q->count = 0;
+    q->closed = 0;
+    return 0;
+}
+
+// Jobbene som ligger igjen eies av poolen, og frigjøres med den
+static void queue_destroy(PipeQueue* q) {
+    pthread_cond_destroy(&q->not_full);
+    pthread_cond_destroy(&q->not_empty);
+    pthread_mutex_destroy(&q->lock);
+    free(q->jobs);
+}
+
+// Blokkerer mens køen er full. Returnerer -1 hvis køen er lukket;
+// da eier kalleren fortsatt jobben
+static int queue_push(PipeQueue* q, PipeJob* job) {
+    pthread_mutex_lock(&q->lock);
+    while (q->count == q->capacity && !q->closed) {
+        pthread_cond_wait(&q->not_full, &q->lock);
+    }
+    if (q->closed) {
+        pthread_mutex_unlock(&q->lock);
+        return -1;
+    }
+    q->jobs[(q->head + q->count) % q->capacity] = job;
+    q->count++;
+    pthread_cond_signal(&q->not_empty);
+    pthread_mutex_unlock(&q->lock);
+    return 0;
+}
+
+static PipeJob* queue_pop(PipeQueue* q) {
+    pthread_mutex_lock(&q->lock);
+    while (q->count == 0 && !q->closed) {
+        pthread_cond_wait(&q->not_empty, &q->lock);
+    }
+    PipeJob* job = NULL;
+    if (q->count > 0) {
+        job = q->jobs[q->head];
+        q->head = (q->head + 1) % q->capacity;
+        q->count--;
+        pthread_cond_signal(&q->not_full);
+    }
+    pthread_mutex_unlock(&q->lock);
+    return job;
+}
+
+static void queue_close(PipeQueue* q) {
+    pthread_mutex_lock(&q->lock);
+    q->closed = 1;
+    pthread_cond_broadcast(&q->not_empty);
+    pthread_cond_broadcast(&q->not_full);
+    pthread_mutex_unlock(&q->lock);
+}
+
+
+static void pipeline_wake(Pipeline* p) {
+    char byte = 0;
+    if (write(p->wake[1], &byte, 1) < 0) {
+        // Pipen er full, så mottakstråden er allerede vekket
+    }
+}
+
+// Stopper alle trinnene. Kalles med l4_lock
+static void pipeline_fail(Pipeline* p, int error) {
+    if (p->error == 0) {
+        LOG_WARN("PIPELINE: stopper med feil %d\n", error);
+        p->error = error;
+    }
+    pthread_cond_broadcast(&p->l4_progress);
+    queue_close(&p->solve_queue);
+    queue_close(&p->send_queue);
+    pipeline_wake(p);
+}
+
+// Legger én pakke i sendevinduet, og venter på plass om det er fullt
+static int pipeline_send(Pipeline* p, const uint8_t* data, int len) {
+    pthread_mutex_lock(&p->l4_lock);
+    while (p->error == 0) {
+        int result = l4sap_send_nb(p->l4, data, len);
+        if (result >= 0) {
+            pthread_mutex_unlock(&p->l4_lock);
+            pipeline_wake(p);
+            return 0;
+        }
+        if (result != L4_WOULD_BLOCK) {
+            pipeline_fail(p, result);
+            break;
+        }
+        pthread_cond_wait(&p->l4_progress, &p->l4_lock);
+    }
+    pthread_mutex_unlock(&p->l4_lock);
+    return -1;
+}
+
+
+// Mottakstrinnet: eneste tråd som venter på nettverket. Tar imot
+// labyrintene i samme rekkefølge som forespørslene, og holder L4-entiteten
+// i gang (ACKer og retransmisjoner) helt til QUIT er kvittert
+static void* receive_stage(void* arg) {
+    Pipeline* p = arg;
+    PipeJob* job = NULL;
+    int received = 0;
+
+    struct pollfd fds[2];
+    fds[0].fd = p->l4->l2sap->socket;
+    fds[0].events = POLLIN;
+    fds[1].fd = p->wake[0];
+    fds[1].events = POLLIN;
+
+    pthread_mutex_lock(&p->l4_lock);
+    while (p->error == 0 && !p->finished) {
+        if (job == NULL && received < p->count) {
+            job = framepool_get(p->jobs);
+            if (job == NULL) {
+                pipeline_fail(p, -1);
+                break;
+            }
+        }
+
+        // Uten jobb (alle labyrintene er mottatt) behandles bare ACKer
+        int result = job != NULL ? l4sap_recv_nb(p->l4, job->buffer, L4Payloadsize)
+                                 : l4sap_recv_nb(p->l4, NULL, 0);
+        pthread_cond_broadcast(&p->l4_progress);
+
+        if (result >= 0 && job != NULL) {
+            job->len = result;
+            job->seed = p->seeds[received++];
+            job->solved = 0;
+            p->stats.received = received;
+            pthread_mutex_unlock(&p->l4_lock);
+
+            int pushed = queue_push(&p->solve_queue, job);
+            if (pushed < 0) {
+                framepool_put(p->jobs, job);
+            }
+            job = NULL;
+            if (received == p->count) {
+                queue_close(&p->solve_queue);
+            }
+
+            pthread_mutex_lock(&p->l4_lock);
+            continue;
+        }
+        if ((result == L4_QUIT || result == L4_SEND_FAILED) && p->quit_sent) {
+            // Serveren avslutter på QUIT, og kan sende RESET eller bare
+            // forsvinne før vi har fått acken; alt annet er allerede besvart
+            p->finished = 1;
+            break;
+        }
+        if (result != L4_WOULD_BLOCK) {
+            pipeline_fail(p, result); // L4_QUIT, L4_SEND_FAILED eller -1
+            break;
+        }
+
+        struct timeval remaining;
+        int armed = l4sap_timer_nb(p->l4, &remaining);
+        if (armed == L4_SEND_FAILED && p->quit_sent) {
+            p->finished = 1;
+            break;
+        }
+        if (armed == L4_SEND_FAILED) {
+            pipeline_fail(p, armed);
+            break;
+        }
+        int wait_ms = -1;
+        if (armed == 1) {
+            wait_ms = (int)((remaining.tv_sec * 1000000L + remaining.tv_usec + 999) / 1000);
+        }
+
+        pthread_mutex_unlock(&p->l4_lock);
+        if (poll(fds, 2, wait_ms) < 0) {
+            perror("Error in poll");
+        }
+        if (fds[1].revents & POLLIN) {
+            char drain[64];
+            while (read(p->wake[0], drain, sizeof(drain)) > 0);
+        }
+        pthread_mutex_lock(&p->l4_lock);
+    }
+    pthread_mutex_unlock(&p->l4_lock);
+
+    framepool_put(p->jobs, job);
+    return NULL;
+}
+
+
+// Tolker bufferet som en labyrint (samme format som maze-client) og
+// løser den på plass
+static int solve_job(Pipeline* p, PipeJob* job) {
+    Maze maze;
+    if (mazeParseHeader(&maze, (char*)job->buffer, job->len) < 0) {
+        return -1;
+    }
+
+    // Et treff i cachen merker stien uten å løse
+    uint64_t key = 0;
+    if (p->config->cache != NULL) {
+        key = mazeHash(&maze);
+        int length = mazeCacheLookup(p->config->cache, key, &maze);
+        if (length >= 0) {
+            LOG_INFO("PIPELINE: seed %ld: vei på %d celler fra cachen\n", job->seed, length);
+            return 0;
+        }
+    }
+
+    MazeStats stats;
+    int length = mazeSolveWith(&maze, &p->solver, &stats);
+    mazeArenaReset(p->arena);
+    if (length < 0) {
+        return -1;
+    }
+    if (p->config->cache != NULL) {
+        mazeCacheStore(p->config->cache, key, &maze);
+    }
+    LOG_INFO("PIPELINE: seed %ld: vei på %d celler, %llu ekspandert, %.6f s\n",
+             job->seed, stats.pathLength, (unsigned long long)stats.expanded, stats.seconds);
+    return 0;
+}
+
+// Løsetrinnet: løser i mottaksrekkefølge, så svarene kommer i samme
+// rekkefølge som forespørslene
+static void* solve_stage(void* arg) {
+    Pipeline* p = arg;
+    PipeJob* job;
+
+    while ((job = queue_pop(&p->solve_queue)) != NULL) {
+        if (solve_job(p, job) == 0) {
+            job->solved = 1;
+            p->stats.solved++;
+        } else {
+            LOG_WARN("PIPELINE: seed %ld: meldingen på %d bytes er ikke en labyrint med vei\n",
+                     job->seed, job->len);
+        }
+        if (queue_push(&p->send_queue, job) < 0) {
+            framepool_put(p->jobs, job);
+            break;
+        }
+    }
+    return NULL;
+}
+
+
+// Sendetrinnet: holder opptil depth forespørsler ute, og sender hver
+// løsning (eller labyrinten uløst, så serveren får et svar) før neste
+// forespørsel når depth er 1
+static void* send_stage(void* arg) {
+    Pipeline* p = arg;
+    int depth = p->config->depth > 0 ? p->config->depth : 1;
+    int requested = 0;
+    int answered = 0;
+
+    while (answered < p->count) {
+        while (requested < p->count && requested - answered < depth) {
+            char request[32];
+            int len = snprintf(request, sizeof(request), "MAZE %ld", p->seeds[requested]);
+            if (pipeline_send(p, (uint8_t*)request, len + 1) < 0) {
+                return NULL;
+            }
+            requested++;
+        }
+
+        PipeJob* job = queue_pop(&p->send_queue);
+        if (job == NULL) {
+            return NULL; // feil i et annet trinn
+        }
+        int sent = pipeline_send(p, job->buffer, job->len);
+        framepool_put(p->jobs, job);
+        if (sent < 0) {
+            return NULL;
+        }
+        p->stats.answered = ++answered;
+    }
+
+    pthread_mutex_lock(&p->l4_lock);
+    p->quit_sent = 1;
+    pthread_mutex_unlock(&p->l4_lock);
+    if (pipeline_send(p, (uint8_t*)"QUIT", 5) < 0) {
+        return NULL;
+    }
+
+    // Venter til alt er kvittert før mottakstråden får stoppe
+    pthread_mutex_lock(&p->l4_lock);
+    while (p->error == 0 && !p->finished && l4sap_outstanding(p->l4) > 0) {
+        pthread_cond_wait(&p->l4_progress, &p->l4_lock);
+    }
+    p->finished = 1;
+    pthread_mutex_unlock(&p->l4_lock);
+    pipeline_wake(p);
+    return NULL;
+}
+
+
+int mazePipelineRun( L4SAP* l4, const long* seeds, int count,
+                     const MazePipelineConfig* config, MazePipelineStats* stats )
+{
+    Pipeline p;
+    memset(&p, 0, sizeof(p));
+    p.l4 = l4;
+    p.seeds = seeds;
+    p.count = count;
+    p.config = config;
+
+    int queue_len = config->queueLen > 0 ? config->queueLen : 4;
+    if (pipe(p.wake) < 0) {
+        perror("Error creating wake pipe");
+        return -1;
+    }
+    fcntl(p.wake[0], F_SETFL, O_NONBLOCK);
+    fcntl(p.wake[1], F_SETFL, O_NONBLOCK);
+
+    // Hver kø kan være full, og hvert av de tre trinnene kan holde en
+    // jobb i tillegg, så poolen går aldri tom
+    p.jobs = framepool_create(sizeof(PipeJob), 2 * queue_len + 3);
+    p.arena = mazeArenaCreate(0);
+    p.solver = config->solver;
+    p.solver.arena = p.arena;
+    if (p.jobs == NULL || p.arena == NULL ||
+        queue_init(&p.solve_queue, queue_len) < 0 || queue_init(&p.send_queue, queue_len) < 0) {
+        LOG_ERROR("Error mallocing pipeline queues\n");
+        if (p.solve_queue.jobs != NULL) {
+            queue_destroy(&p.solve_queue);
+        }
+        framepool_destroy(p.jobs);
+        mazeArenaDestroy(p.arena);
+        close(p.wake[0]);
+        close(p.wake[1]);
+        return -1;
+    }
+    pthread_mutex_init(&p.l4_lock, NULL);
+    pthread_cond_init(&p.l4_progress, NULL);
+
+    struct timeval t0, t1;
+    gettimeofday(&t0, NULL);
+
+    // Hvis en tråd ikke kan startes, stoppes de som kjører med pipeline_fail
+    void* (*stages[3])(void*) = {receive_stage, solve_stage, send_stage};
+    pthread_t threads[3];
+    int started = 0;
+    for (; started < 3; started++) {
+        if (pthread_create(&threads[started], NULL, stages[started], &p) != 0) {
+            LOG_ERROR("Error starting pipeline thread %d\n", started);
+            pthread_mutex_lock(&p.l4_lock);
+            pipeline_fail(&p, -1);
+            pthread_mutex_unlock(&p.l4_lock);
+            break;
+        }
+    }
+    for (int i = 0; i < started; i++) {
+        pthread_join(threads[i], NULL);
+    }
+
+    gettimeofday(&t1, NULL);
+    p.stats.seconds = (t1.tv_sec - t0.tv_sec) + (t1.tv_usec - t0.tv_usec) / 1e6;
+    if (stats != NULL) {
+        *stats = p.stats;
+    }
+
+    int result = p.error;
+    if (result == 0 && p.stats.solved < count) {
+        result = -1;
+    }
+
+    pthread_cond_destroy(&p.l4_progress);
+    pthread_mutex_destroy(&p.l4_lock);
+    queue_destroy(&p.send_queue);
+    queue_destroy(&p.solve_queue);
+    LOG_DEBUG("PIPELINE: arenaen brukte %lu blokker\n", mazeArenaMallocs(p.arena));
+    mazeArenaDestroy(p.arena);
+    framepool_destroy(p.jobs);
+    close(p.wake[0]);
+    close(p.wake[1]);
+    return result;
+}
@@ -0,0 +1,58 @@
+#ifndef MAZE_PIPELINE_H
+#define MAZE_PIPELINE_H
+
+#include "l4sap.h"
+#include "maze.h"
+
+/* Solves many mazes over one long-lived L4SAP. The work is split into
+ * three stages, each on its own thread, connected by bounded queues:
+ *
+ *   receive - sends nothing, but drives the L4 entity: it receives the
+ *             mazes, processes ACKs and retransmits on timeout;
+ *   solve   - solves the mazes in the order they arrived;
+ *   send    - sends the "MAZE <seed>" requests and the solutions.
+ *
+ * The L4SAP is shared by the receive and send stages under a mutex and
+ * is driven only through the non-blocking interface (l4sap_send_nb,
+ * l4sap_recv_nb and l4sap_timer_nb), so it must not have been used with
+ * the blocking functions before. Mazes must fit into one L4 packet.
+ *
+ * depth is the number of requests that may be outstanding, i.e. sent
+ * but not yet answered with a solution. The stock maze-server takes the
+ * next request only after it has received the solution to the previous
+ * one, so against it depth must be 1: the stages then still overlap
+ * solving with the ACK traffic, but not with the next maze. A server
+ * that queues requests can be kept busy with a larger depth.
+ */
+typedef struct MazePipelineConfig MazePipelineConfig;
+
+struct MazePipelineConfig
+{
+    MazeOptions solver;
+    int         depth;     /* requests in flight, at least 1 */
+    int         queueLen;  /* capacity of each queue between stages */
+    MazeCache*  cache;     /* solutions to reuse, or NULL; used only by the solve stage */
+};
+
+typedef struct MazePipelineStats MazePipelineStats;
+
+struct MazePipelineStats
+{
+    int    received;  /* mazes received */
+    int    solved;    /* mazes with a path */
+    int    answered;  /* solutions sent */
+    double seconds;   /* wall time from the first request to the QUIT */
+};
+
+/* Requests, solves and answers the mazes for seeds[0..count-1] in that
+ * order, then sends "QUIT". The caller keeps ownership of l4 and must
+ * destroy it afterwards, also on error.
+ *
+ * Returns 0 when every maze was answered, -1 if a maze was not valid or
+ * had no path, or an L4 error code (L4_SEND_FAILED, L4_QUIT) if the
+ * connection failed.
+ */
+int mazePipelineRun( L4SAP* l4, const long* seeds, int count,
+                     const MazePipelineConfig* config, MazePipelineStats* stats );
+
+#endif
@@ -4,48 +4,136 @@
 
 #include "maze.h"
 
-void mazePlot( const struct Maze* maze )
+/* The plot is a grid of (2*edgeLen+1) lines and columns. Odd lines and
+ * columns are cells, even ones are walls, and the corners between four
+ * cells are always walls. Every character can be computed from at most
+ * two cells, so the plot is produced one line at a time into a buffer of
+ * the viewport's width and written with a single fwrite per line.
+ */
+
+static inline char cell_at( const struct Maze* maze, uint32_t x, uint32_t y )
+{
+    return maze->maze[ (size_t)y * maze->edgeLen + x ];
+}
+
+static char cell_char( const struct Maze* maze, uint32_t x, uint32_t y )
+{
+    if( x == maze->startX && y == maze->startY ) return 'A';
+    if( x == maze->endX   && y == maze->endY   ) return 'B';
+    if( cell_at( maze, x, y ) & mark ) return 'o';
+    return ' ';
+}
+
+/* Character at line gy and column gx of the full plot.
+ */
+static char plot_char( const struct Maze* maze, uint32_t gx, uint32_t gy )
+{
+    uint32_t edge = maze->edgeLen;
+
+    if( gy & 1 )
+    {
+        uint32_t y = gy / 2;
+        if( gx & 1 ) return cell_char( maze, gx / 2, y );
+
+        /* wall between the cells left and right of column gx */
+        uint32_t x = gx / 2;
+        if( x > 0    && ( cell_at( maze, x - 1, y ) & right ) ) return ' ';
+        if( x < edge && ( cell_at( maze, x, y )     & left  ) ) return ' ';
+        return 'X';
+    }
+
+    if( gx & 1 )
+    {
+        /* wall between the cells above and below line gy */
+        uint32_t x = gx / 2;
+        uint32_t y = gy / 2;
+        if( y > 0    && ( cell_at( maze, x, y - 1 ) & down ) ) return ' ';
+        if( y < edge && ( cell_at( maze, x, y )     & up   ) ) return ' ';
+    }
+    return 'X';
+}
+
+int mazePlotViewport( const struct Maze* maze, FILE* out,
+                      uint32_t x0, uint32_t y0, uint32_t width, uint32_t height )
 {
-    int gridLen = maze->edgeLen * 2 + 1;
+    uint32_t edge = maze->edgeLen;
+    if( x0 >= edge || y0 >= edge ) return -1;
+    if( width  > edge - x0 ) width  = edge - x0;
+    if( height > edge - y0 ) height = edge - y0;
 
-    char* grid = malloc( gridLen * gridLen );
-    for( int y=0; y<gridLen; y++ )
-        for( int x=0; x<gridLen; x++ )
-            grid[y*gridLen+x] = 'X';
+    uint32_t columns = 2 * width + 1;
+    char* line = (char*)malloc( columns + 1 );
+    if( line == NULL ) return -1;
 
-    for( int row=0; row<maze->edgeLen; row++ )
+    for( uint32_t gy = 2 * y0; gy <= 2 * ( y0 + height ); gy++ )
     {
-        for( int col=0; col<maze->edgeLen; col++ )
+        for( uint32_t i = 0; i < columns; i++ )
+        {
+            line[i] = plot_char( maze, 2 * x0 + i, gy );
+        }
+        line[columns] = '\n';
+        if( fwrite( line, 1, columns + 1, out ) != columns + 1 )
         {
-            grid[ (row*2+1) * gridLen + (col*2+1) ] = ' ';
-            char val = maze->maze[ row*maze->edgeLen + col ];
-            if( val & left  ) grid[ (row*2+1+0) * gridLen + (col*2+1-1) ] = ' ';
-            if( val & right ) grid[ (row*2+1+0) * gridLen + (col*2+1+1) ] = ' ';
-            if( val & up    ) grid[ (row*2+1-1) * gridLen + (col*2+1+0) ] = ' ';
-            if( val & down  ) grid[ (row*2+1+1) * gridLen + (col*2+1+0) ] = ' ';
-
-            if( val & mark  )
-                grid[ (row*2+1) * gridLen + (col*2+1) ] = 'o';
+            free( line );
+            return -1;
         }
     }
+    fputc( '\n', out );
+
+    free( line );
+    return 0;
+}
+
+int mazePlotOverview( const struct Maze* maze, FILE* out, uint32_t maxWidth )
+{
+    uint32_t edge = maze->edgeLen;
+    if( maxWidth < 1 ) maxWidth = 1;
+
+    /* Each character stands for a block of block x block cells. */
+    uint32_t block   = ( edge + maxWidth - 1 ) / maxWidth;
+    if( block < 1 ) block = 1;
+    uint32_t columns = ( edge + block - 1 ) / block;
+
+    char* line = (char*)malloc( columns + 3 );
+    if( line == NULL ) return -1;
 
-    int col = maze->startX;
-    int row = maze->startY;
-    grid[ (row*2+1) * gridLen + (col*2+1) ] = 'A';
-    col = maze->endX;
-    row = maze->endY;
-    grid[ (row*2+1) * gridLen + (col*2+1) ] = 'B';
+    for( uint32_t i = 0; i < columns + 2; i++ ) line[i] = 'X';
+    line[columns + 2] = '\n';
+    fwrite( line, 1, columns + 3, out );
 
-    for( int y=0; y<gridLen; y++ )
+    for( uint32_t by = 0; by < edge; by += block )
     {
-        for( int x=0; x<gridLen; x++ )
+        line[0] = 'X';
+        for( uint32_t i = 1; i <= columns; i++ ) line[i] = ' ';
+        line[columns + 1] = 'X';
+
+        /* Path marks first, so that A and B win within their block. */
+        for( uint32_t y = by; y < by + block && y < edge; y++ )
+        {
+            for( uint32_t x = 0; x < edge; x++ )
+            {
+                if( cell_at( maze, x, y ) & mark ) line[1 + x / block] = 'o';
+            }
+        }
+        if( maze->startY >= by && maze->startY < by + block ) line[1 + maze->startX / block] = 'A';
+        if( maze->endY   >= by && maze->endY   < by + block ) line[1 + maze->endX   / block] = 'B';
+
+        if( fwrite( line, 1, columns + 3, out ) != columns + 3 )
         {
-            printf( "%c", grid[y*gridLen+x] );
+            free( line );
+            return -1;
         }
-        printf( "\n" );
     }
-    printf( "\n" );
 
-    free( grid );
+    for( uint32_t i = 0; i < columns + 2; i++ ) line[i] = 'X';
+    fwrite( line, 1, columns + 3, out );
+    fputc( '\n', out );
+
+    free( line );
+    return 0;
 }
 
+void mazePlot( const struct Maze* maze )
+{
+    mazePlotViewport( maze, stdout, 0, 0, maze->edgeLen, maze->edgeLen );
+}
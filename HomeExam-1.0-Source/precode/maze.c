@@ -1,9 +1,16 @@
 #include <stdio.h>
 #include <stdlib.h>
+#include <string.h>
 #include <unistd.h>
 #include <limits.h>
+#include <stdint.h>
+#include <time.h>
+#include <pthread.h>
+#include <stdatomic.h>
+#include <arpa/inet.h>
 
 #include "maze.h"
+#include "log.h"
 
 // Hjelpefunksjon for å få tilgang til en celle i labyrinten
 static inline int maze_index(const Maze* m, int x, int y) {
@@ -15,70 +22,938 @@ void markSolution(Maze* maze, int x, int y) {
     maze->maze[maze_index(maze, x, y)] |= mark;
 }
 
-// Rekursiv DFS med tilbakeføring for å finne den korteste stien
-static int dfs(Maze* maze, int x, int y, int endX, int endY, int pathLength, int* minPathLength) {
-    // Hvis vi har kommet til slutten, merk og returner
-    if (x == endX && y == endY) {
-        markSolution(maze, x, y);
+// De fire retningene, i samme rekkefølge som den gamle DFS-en
+// (ned, opp, venstre, høyre). Indeksen er det som lagres i
+// foreldre-tabellen, og retning i ^ 1 er den motsatte
+#define DIR_DOWN  0
+#define DIR_UP    1
+#define DIR_LEFT  2
+#define DIR_RIGHT 3
+
+static const int dir_bit[4] = {down, up, left, right};
+
+// Besøkt-bitsett: én bit per celle
+static inline int visited_test(const uint64_t* visited, uint32_t i) {
+    return (visited[i >> 6] >> (i & 63)) & 1;
+}
+
+static inline void visited_set(uint64_t* visited, uint32_t i) {
+    visited[i >> 6] |= (uint64_t)1 << (i & 63);
+}
+
+// Foreldre-tabell: 2 bit per celle med retningen vi kom fra
+static inline void parent_set(uint8_t* parent, uint32_t i, int dir) {
+    parent[i >> 2] |= (uint8_t)(dir << ((i & 3) * 2));
+}
+
+static inline int parent_get(const uint8_t* parent, uint32_t i) {
+    return (parent[i >> 2] >> ((i & 3) * 2)) & 3;
+}
+
+// Naboen i retning d, om veien dit er åpen fra begge sider og
+// naboen ligger innenfor labyrinten. Med passerbarhetsmaske (se
+// mazePassMask) er alt dette allerede sjekket, og én byte holder
+static inline int maze_step(const Maze* maze, const uint8_t* pass, uint32_t cell, int d, uint32_t* next) {
+    uint32_t edge = maze->edgeLen;
+
+    if (pass != NULL) {
+        if (!(pass[cell] & dir_bit[d])) return 0;
+        switch (d) {
+            case DIR_DOWN:  *next = cell + edge; break;
+            case DIR_UP:    *next = cell - edge; break;
+            case DIR_LEFT:  *next = cell - 1;    break;
+            default:        *next = cell + 1;    break;
+        }
         return 1;
     }
 
-    char* cell = &maze->maze[maze_index(maze, x, y)];
+    if (!(maze->maze[cell] & dir_bit[d])) return 0;
 
-    // Merk denne cellen som besøkt midlertidig
-    if (*cell & tmark) return 0; // Vi har vært her før
-    *cell |= tmark;
+    switch (d) {
+        case DIR_DOWN:  if (cell / edge + 1 >= edge) return 0; *next = cell + edge; break;
+        case DIR_UP:    if (cell < edge) return 0;             *next = cell - edge; break;
+        case DIR_LEFT:  if (cell % edge == 0) return 0;        *next = cell - 1;    break;
+        default:        if (cell % edge + 1 >= edge) return 0; *next = cell + 1;    break;
+    }
 
-    // Prøv alle retninger (først ned, deretter andre retninger)
-    int dx[] = {0, 0, -1, 1};  // ned, opp, venstre, høyre
-    int dy[] = {1, -1, 0, 0};
-    int dir[] = {down, up, left, right};
-    int opp[] = {up, down, right, left};
+    return (maze->maze[*next] & dir_bit[d ^ 1]) != 0;
+}
 
-    int foundSolution = 0;
-    for (int i = 0; i < 4; ++i) {
-        int nx = x + dx[i];
-        int ny = y + dy[i];
+// Følger foreldre-tabellen fra cell til stop og merker alle cellene
+// (stop inkludert). Returnerer antall merkede celler
+static int mark_path(Maze* maze, const uint8_t* parent, uint32_t cell, uint32_t stop) {
+    uint32_t edge = maze->edgeLen;
+    int length = 1;
 
-        // Sjekk om vi er innenfor grensene
-        if (nx < 0 || ny < 0 || nx >= (int)maze->edgeLen || ny >= (int)maze->edgeLen)
-            continue;
+    maze->maze[cell] |= mark;
+    while (cell != stop) {
+        switch (parent_get(parent, cell)) {
+            case DIR_DOWN:  cell += edge; break;
+            case DIR_UP:    cell -= edge; break;
+            case DIR_LEFT:  cell -= 1;    break;
+            default:        cell += 1;    break;
+        }
+        maze->maze[cell] |= mark;
+        length++;
+    }
 
-        char thisCell = *cell;
-        char nextCell = maze->maze[maze_index(maze, nx, ny)];
+    return length;
+}
+
+static inline uint32_t maze_start(const Maze* maze) {
+    return (uint32_t)maze_index(maze, maze->startX, maze->startY);
+}
+
+static inline uint32_t maze_end(const Maze* maze) {
+    return (uint32_t)maze_index(maze, maze->endX, maze->endY);
+}
 
-        // Sjekk om det er en vei i denne retningen
-        if ((thisCell & dir[i]) && (nextCell & opp[i])) {
-            // DFS til neste celle
-            if (dfs(maze, nx, ny, endX, endY, pathLength + 1, minPathLength)) {
-                markSolution(maze, x, y); // Denne cellen er på løsningen
-                foundSolution = 1;
+// Arbeidsminne fra arenaen når løseren har fått en (MazeOptions.arena),
+// ellers fra heapen. scratch_free frigjør bare det som kom fra heapen;
+// resten blir liggende til kalleren nullstiller arenaen
+static void* scratch_calloc(MazeArena* arena, size_t count, size_t size) {
+    if (arena == NULL) {
+        return calloc(count, size);
+    }
+    void* p = mazeArenaAlloc(arena, count * size);
+    if (p != NULL) {
+        memset(p, 0, count * size);
+    }
+    return p;
+}
+
+static inline void scratch_free(MazeArena* arena, void* p) {
+    if (arena == NULL) {
+        free(p);
+    }
+}
+
+static inline uint64_t* visited_alloc(const Maze* maze, MazeArena* arena) {
+    return scratch_calloc(arena, ((size_t)maze->size + 63) / 64, sizeof(uint64_t));
+}
+
+static inline uint8_t* parent_alloc(const Maze* maze, MazeArena* arena) {
+    return scratch_calloc(arena, ((size_t)maze->size + 3) / 4, 1);
+}
+
+// Ringkø av celleindekser som dobles når den blir full.
+// Hver celle legges inn høyst én gang, så den blir aldri større enn labyrinten
+typedef struct Frontier Frontier;
+struct Frontier {
+    uint32_t* cells;
+    uint32_t capacity; // alltid en toerpotens
+    uint32_t head;
+    uint32_t count;
+    MazeArena* arena; // NULL: cells er fra malloc
+};
+
+static int frontier_push(Frontier* f, uint32_t cell) {
+    if (f->count == f->capacity) {
+        if (f->capacity > UINT32_MAX / 2) {
+            return -1;
+        }
+        uint32_t capacity = f->capacity * 2;
+        uint32_t* cells;
+        if (f->arena != NULL) {
+            // Den gamle plassen blir liggende i arenaen til neste reset
+            cells = mazeArenaAlloc(f->arena, (size_t)capacity * sizeof(uint32_t));
+            if (cells != NULL) {
+                memcpy(cells, f->cells, (size_t)f->capacity * sizeof(uint32_t));
+            }
+        } else {
+            cells = realloc(f->cells, (size_t)capacity * sizeof(uint32_t));
+        }
+        if (cells == NULL) {
+            return -1;
+        }
+        // Elementene som lå før head flyttes til slutten av den nye plassen
+        uint32_t wrapped = f->head;
+        for (uint32_t i = 0; i < wrapped; i++) {
+            cells[f->capacity + i] = cells[i];
+        }
+        f->cells = cells;
+        f->capacity = capacity;
+    }
+    f->cells[(f->head + f->count) & (f->capacity - 1)] = cell;
+    f->count++;
+    return 0;
+}
+
+static int frontier_init(Frontier* f, MazeArena* arena) {
+    f->capacity = 1024;
+    f->head = 0;
+    f->count = 0;
+    f->arena = arena;
+    f->cells = arena != NULL ? mazeArenaAlloc(arena, f->capacity * sizeof(uint32_t))
+                             : malloc(f->capacity * sizeof(uint32_t));
+    return f->cells != NULL ? 0 : -1;
+}
+
+static inline void frontier_free(Frontier* f) {
+    scratch_free(f->arena, f->cells);
+}
+
+static uint32_t frontier_pop(Frontier* f) {
+    uint32_t cell = f->cells[f->head];
+    f->head = (f->head + 1) & (f->capacity - 1);
+    f->count--;
+    return cell;
+}
+
+// Bredde-først-søk fra start. Første gang slutten nås har vi den korteste
+// stien, og den følges baklengs via foreldre-tabellen og merkes med mark.
+// Returnerer antall celler på stien, eller -1 om ingen sti finnes
+static int solve_bfs(Maze* maze, const uint8_t* pass, MazeArena* arena, MazeStats* stats) {
+    uint32_t start = maze_start(maze);
+    uint32_t end = maze_end(maze);
+
+    uint64_t* visited = visited_alloc(maze, arena);
+    uint8_t* parent = parent_alloc(maze, arena);
+    Frontier frontier;
+
+    int length = -1;
+    if (frontier_init(&frontier, arena) < 0 || visited == NULL || parent == NULL) {
+        LOG_ERROR("ERROR: Fikk ikke minne til å løse labyrinten\n");
+        goto out;
+    }
+
+    visited_set(visited, start);
+    frontier_push(&frontier, start);
+
+    int found = (start == end);
+    while (!found && frontier.count > 0) {
+        uint32_t cell = frontier_pop(&frontier);
+        stats->expanded++;
+
+        for (int d = 0; d < 4; d++) {
+            uint32_t next;
+            if (!maze_step(maze, pass, cell, d, &next)) continue;
+            if (visited_test(visited, next)) continue;
+
+            visited_set(visited, next);
+            parent_set(parent, next, d ^ 1); // retningen tilbake mot forelderen
+
+            if (next == end) {
+                found = 1;
                 break;
             }
+            if (frontier_push(&frontier, next) < 0) {
+                LOG_ERROR("ERROR: Fikk ikke minne til BFS-køen\n");
+                goto out;
+            }
         }
     }
 
-    // Tilbakefør dersom vi ikke har funnet løsning i denne veien
-    if (!foundSolution) {
-        *cell &= ~tmark;
+    if (found) {
+        length = mark_path(maze, parent, end, start);
     }
 
-    return foundSolution;
+out:
+    scratch_free(arena, visited);
+    scratch_free(arena, parent);
+    frontier_free(&frontier);
+    return length;
 }
 
-// Maze solve funksjon
-void mazeSolve(Maze* maze) {
+// Nabo i pakket form, med samme regler som maze_step
+static inline int packed_step(const PackedMaze* packed, uint32_t cell, int d, uint32_t* next) {
+    uint32_t edge = packed->edgeLen;
+    uint8_t bit = dir_bit[d] >> 1;
+    if (!(mazePackedCell(packed, cell) & bit)) return 0;
+
+    switch (d) {
+        case DIR_DOWN:  if (cell / edge + 1 >= edge) return 0; *next = cell + edge; break;
+        case DIR_UP:    if (cell < edge) return 0;             *next = cell - edge; break;
+        case DIR_LEFT:  if (cell % edge == 0) return 0;        *next = cell - 1;    break;
+        default:        if (cell % edge + 1 >= edge) return 0; *next = cell + 1;    break;
+    }
+
+    return (mazePackedCell(packed, *next) & (dir_bit[d ^ 1] >> 1)) != 0;
+}
+
+// Samme BFS som solve_bfs, men på nibbler, og stien havner i packed->path
+int mazeSolvePacked(PackedMaze* packed, MazeStats* stats) {
+    uint32_t edge = packed->edgeLen;
+    uint32_t start = packed->startY * edge + packed->startX;
+    uint32_t end = packed->endY * edge + packed->endX;
+    size_t words = ((size_t)packed->size + 63) / 64;
+
+    MazeStats local;
+    if (stats == NULL) {
+        stats = &local;
+    }
+    memset(stats, 0, sizeof(*stats));
+    stats->pathLength = -1;
+
+    struct timespec begin, done;
+    clock_gettime(CLOCK_MONOTONIC, &begin);
+
+    memset(packed->visited, 0, words * sizeof(uint64_t));
+    memset(packed->path, 0, words * sizeof(uint64_t));
+
+    uint8_t* parent = calloc(((size_t)packed->size + 3) / 4, 1);
+    Frontier frontier = {NULL, 0, 0, 0, NULL};
+
+    int length = -1;
+    if (frontier_init(&frontier, NULL) < 0 || parent == NULL) {
+        LOG_ERROR("ERROR: Fikk ikke minne til å løse labyrinten\n");
+        goto out;
+    }
+
+    visited_set(packed->visited, start);
+    frontier_push(&frontier, start);
+
+    int found = (start == end);
+    while (!found && frontier.count > 0) {
+        uint32_t cell = frontier_pop(&frontier);
+        stats->expanded++;
+
+        for (int d = 0; d < 4; d++) {
+            uint32_t next;
+            if (!packed_step(packed, cell, d, &next)) continue;
+            if (visited_test(packed->visited, next)) continue;
+
+            visited_set(packed->visited, next);
+            parent_set(parent, next, d ^ 1);
+
+            if (next == end) {
+                found = 1;
+                break;
+            }
+            if (frontier_push(&frontier, next) < 0) {
+                LOG_ERROR("ERROR: Fikk ikke minne til BFS-køen\n");
+                goto out;
+            }
+        }
+    }
+
+    if (found) {
+        uint32_t cell = end;
+        length = 1;
+        visited_set(packed->path, cell);
+        while (cell != start) {
+            switch (parent_get(parent, cell)) {
+                case DIR_DOWN:  cell += edge; break;
+                case DIR_UP:    cell -= edge; break;
+                case DIR_LEFT:  cell -= 1;    break;
+                default:        cell += 1;    break;
+            }
+            visited_set(packed->path, cell);
+            length++;
+        }
+    } else {
+        LOG_WARN("WARNING: Fant ingen løsning på labyrinten!\n");
+    }
+
+out:
+    free(parent);
+    frontier_free(&frontier);
+
+    clock_gettime(CLOCK_MONOTONIC, &done);
+    stats->seconds = (double)(done.tv_sec - begin.tv_sec) + (done.tv_nsec - begin.tv_nsec) / 1e9;
+    stats->pathLength = length;
+    return length;
+}
+
+// Utvider ett helt nivå av den ene siden i det toveis søket.
+// Returnerer 1 hvis siden møtte den andre (cellen på denne siden i *near og
+// naboen som den andre siden har besøkt i *far), 0 ellers og -1 ved minnefeil
+static int bidir_level(Maze* maze, const uint8_t* pass, Frontier* frontier, uint64_t* own, const uint64_t* other,
+                       uint8_t* parent, uint32_t* near, uint32_t* far, MazeStats* stats) {
+    uint32_t level = frontier->count;
+
+    for (uint32_t i = 0; i < level; i++) {
+        uint32_t cell = frontier_pop(frontier);
+        stats->expanded++;
+
+        for (int d = 0; d < 4; d++) {
+            uint32_t next;
+            if (!maze_step(maze, pass, cell, d, &next)) continue;
+
+            if (visited_test(other, next)) {
+                *near = cell;
+                *far = next;
+                return 1;
+            }
+            if (visited_test(own, next)) continue;
+
+            visited_set(own, next);
+            parent_set(parent, next, d ^ 1);
+            if (frontier_push(frontier, next) < 0) {
+                return -1;
+            }
+        }
+    }
+
+    return 0;
+}
+
+// Toveis BFS: søker fra start og slutt samtidig, og utvider hele nivåer
+// av den siden som har minst front. En celle blir aldri besøkt av begge
+// sidene, så én foreldre-tabell holder. Stien blir start..near + far..end
+static int solve_bidir(Maze* maze, const uint8_t* pass, MazeArena* arena, MazeStats* stats) {
+    uint32_t start = maze_start(maze);
+    uint32_t end = maze_end(maze);
+
+    uint64_t* from_start = visited_alloc(maze, arena);
+    uint64_t* from_end = visited_alloc(maze, arena);
+    uint8_t* parent = parent_alloc(maze, arena);
+    Frontier front_start = {NULL, 0, 0, 0, NULL};
+    Frontier front_end = {NULL, 0, 0, 0, NULL};
+
+    int length = -1;
+    if (frontier_init(&front_start, arena) < 0 || frontier_init(&front_end, arena) < 0 ||
+        from_start == NULL || from_end == NULL || parent == NULL) {
+        LOG_ERROR("ERROR: Fikk ikke minne til å løse labyrinten\n");
+        goto out;
+    }
+
+    if (start == end) {
+        length = mark_path(maze, parent, start, start);
+        goto out;
+    }
+
+    visited_set(from_start, start);
+    visited_set(from_end, end);
+    frontier_push(&front_start, start);
+    frontier_push(&front_end, end);
+
+    uint32_t near = 0;
+    uint32_t far = 0;
+    int met = 0;
+    while (!met && front_start.count > 0 && front_end.count > 0) {
+        if (front_start.count <= front_end.count) {
+            met = bidir_level(maze, pass, &front_start, from_start, from_end, parent, &near, &far, stats);
+        } else {
+            met = bidir_level(maze, pass, &front_end, from_end, from_start, parent, &near, &far, stats);
+            // Bytter om så near alltid er på startsiden
+            uint32_t tmp = near;
+            near = far;
+            far = tmp;
+        }
+        if (met < 0) {
+            LOG_ERROR("ERROR: Fikk ikke minne til BFS-køen\n");
+            goto out;
+        }
+    }
+
+    if (met) {
+        length = mark_path(maze, parent, near, start) + mark_path(maze, parent, far, end);
+    }
+
+out:
+    scratch_free(arena, from_start);
+    scratch_free(arena, from_end);
+    scratch_free(arena, parent);
+    frontier_free(&front_start);
+    frontier_free(&front_end);
+    return length;
+}
+
+// Element i A*-heapen. Samme celle kan ligge der flere ganger; bare den
+// første som tas ut brukes, resten hoppes over fordi cellen er lukket
+typedef struct HeapNode HeapNode;
+struct HeapNode {
+    uint32_t f; // g + Manhattan-avstand til slutten
+    uint32_t g; // steg fra start
+    uint32_t cell;
+    uint8_t dir; // retningen tilbake til forelderen
+};
+
+typedef struct Heap Heap;
+struct Heap {
+    HeapNode* nodes;
+    size_t count;
+    size_t capacity;
+    MazeArena* arena; // NULL: nodes er fra malloc
+};
+
+// Minste f først, og ved lik f den som har kommet lengst
+static inline int heap_less(const HeapNode* a, const HeapNode* b) {
+    return a->f < b->f || (a->f == b->f && a->g > b->g);
+}
+
+static int heap_push(Heap* h, HeapNode node) {
+    if (h->count == h->capacity) {
+        size_t capacity = h->capacity ? h->capacity * 2 : 1024;
+        HeapNode* nodes;
+        if (h->arena != NULL) {
+            nodes = mazeArenaAlloc(h->arena, capacity * sizeof(HeapNode));
+            if (nodes != NULL && h->count > 0) {
+                memcpy(nodes, h->nodes, h->count * sizeof(HeapNode));
+            }
+        } else {
+            nodes = realloc(h->nodes, capacity * sizeof(HeapNode));
+        }
+        if (nodes == NULL) {
+            return -1;
+        }
+        h->nodes = nodes;
+        h->capacity = capacity;
+    }
+
+    size_t i = h->count++;
+    while (i > 0) {
+        size_t above = (i - 1) / 2;
+        if (!heap_less(&node, &h->nodes[above])) break;
+        h->nodes[i] = h->nodes[above];
+        i = above;
+    }
+    h->nodes[i] = node;
+    return 0;
+}
+
+static HeapNode heap_pop(Heap* h) {
+    HeapNode top = h->nodes[0];
+    HeapNode last = h->nodes[--h->count];
+
+    size_t i = 0;
+    while (1) {
+        size_t child = 2 * i + 1;
+        if (child >= h->count) break;
+        if (child + 1 < h->count && heap_less(&h->nodes[child + 1], &h->nodes[child])) {
+            child++;
+        }
+        if (!heap_less(&h->nodes[child], &last)) break;
+        h->nodes[i] = h->nodes[child];
+        i = child;
+    }
+    if (h->count > 0) {
+        h->nodes[i] = last;
+    }
+    return top;
+}
+
+static inline uint32_t manhattan(const Maze* maze, uint32_t cell) {
+    uint32_t x = cell % maze->edgeLen;
+    uint32_t y = cell / maze->edgeLen;
+    uint32_t dx = x > maze->endX ? x - maze->endX : maze->endX - x;
+    uint32_t dy = y > maze->endY ? y - maze->endY : maze->endY - y;
+    return dx + dy;
+}
+
+// A* med Manhattan-avstand som heuristikk. Den er konsistent, så første
+// gang en celle tas ut av heapen har den kortest mulig g, og det er da
+// foreldre-retningen lagres
+static int solve_astar(Maze* maze, const uint8_t* pass, MazeArena* arena, MazeStats* stats) {
+    uint32_t start = maze_start(maze);
+    uint32_t end = maze_end(maze);
+
+    uint64_t* closed = visited_alloc(maze, arena);
+    uint8_t* parent = parent_alloc(maze, arena);
+    Heap heap = {NULL, 0, 0, arena};
+
+    int length = -1;
+    HeapNode first = {manhattan(maze, start), 0, start, 0};
+    if (closed == NULL || parent == NULL || heap_push(&heap, first) < 0) {
+        LOG_ERROR("ERROR: Fikk ikke minne til å løse labyrinten\n");
+        goto out;
+    }
+
+    while (heap.count > 0) {
+        HeapNode node = heap_pop(&heap);
+        if (visited_test(closed, node.cell)) continue;
+
+        visited_set(closed, node.cell);
+        if (node.cell != start) {
+            parent_set(parent, node.cell, node.dir);
+        }
+        stats->expanded++;
+
+        if (node.cell == end) {
+            length = mark_path(maze, parent, end, start);
+            break;
+        }
+
+        for (int d = 0; d < 4; d++) {
+            uint32_t next;
+            if (!maze_step(maze, pass, node.cell, d, &next)) continue;
+            if (visited_test(closed, next)) continue;
+
+            HeapNode child = {node.g + 1 + manhattan(maze, next), node.g + 1, next, (uint8_t)(d ^ 1)};
+            if (heap_push(&heap, child) < 0) {
+                LOG_ERROR("ERROR: Fikk ikke minne til A*-heapen\n");
+                goto out;
+            }
+        }
+    }
+
+out:
+    scratch_free(arena, closed);
+    scratch_free(arena, parent);
+    scratch_free(arena, heap.nodes);
+    return length;
+}
+
+// Parallell BFS, nivå for nivå. Trådene henter biter av gjeldende front
+// med en atomisk teller, slik at de som blir ferdige først tar mer av
+// arbeidet. Besøkt-bitene settes med atomisk OR, og bare tråden som setter
+// biten skriver forelderen og legger cellen i neste front
+#define PARALLEL_CHUNK 256
+#define PARALLEL_LOCAL 512
+
+typedef struct ParallelBfs ParallelBfs;
+struct ParallelBfs {
+    Maze* maze;
+    const uint8_t* pass;
+    uint32_t end;
+    _Atomic uint64_t* visited;
+    _Atomic uint8_t* parent;
+
+    uint32_t* current; // fronten som utvides
+    size_t current_capacity;
+    uint32_t current_count;
+    uint32_t* next; // fronten som bygges
+    size_t next_capacity;
+    atomic_uint next_count;
+    atomic_uint claimed; // neste ubehandlede indeks i current
+
+    atomic_int found;
+    int done; // skrives bare mellom barrierene
+    int failed;
+    pthread_barrier_t barrier;
+
+    // NULL: frontene er fra malloc. Arenaen brukes bare av tråden som
+    // bytter front mellom barrierene, så det er aldri to om gangen
+    MazeArena* arena;
+
+    // Barrieren lages først når vi vet hvor mange tråder som kom i gang,
+    // så trådene venter her til den er klar
+    pthread_mutex_t gate;
+    pthread_cond_t gate_open;
+    int ready;
+};
+
+typedef struct ParallelWorker ParallelWorker;
+struct ParallelWorker {
+    ParallelBfs* bfs;
+    pthread_t thread;
+    uint64_t expanded;
+};
+
+// Flytter trådens lokale celler over i neste front
+static void parallel_flush(ParallelBfs* bfs, uint32_t* local, uint32_t* count) {
+    if (*count == 0) return;
+    uint32_t at = atomic_fetch_add(&bfs->next_count, *count);
+    memcpy(bfs->next + at, local, *count * sizeof(uint32_t));
+    *count = 0;
+}
+
+static void parallel_level(ParallelBfs* bfs, ParallelWorker* worker) {
+    uint32_t local[PARALLEL_LOCAL];
+    uint32_t local_count = 0;
+
+    while (1) {
+        uint32_t first = atomic_fetch_add(&bfs->claimed, PARALLEL_CHUNK);
+        if (first >= bfs->current_count) break;
+
+        uint32_t last = first + PARALLEL_CHUNK;
+        if (last > bfs->current_count) last = bfs->current_count;
+
+        for (uint32_t i = first; i < last; i++) {
+            uint32_t cell = bfs->current[i];
+            worker->expanded++;
+
+            for (int d = 0; d < 4; d++) {
+                uint32_t next;
+                if (!maze_step(bfs->maze, bfs->pass, cell, d, &next)) continue;
+
+                uint64_t bit = (uint64_t)1 << (next & 63);
+                if (atomic_load_explicit(&bfs->visited[next >> 6], memory_order_relaxed) & bit) continue;
+                if (atomic_fetch_or_explicit(&bfs->visited[next >> 6], bit, memory_order_relaxed) & bit) continue;
+
+                atomic_fetch_or_explicit(&bfs->parent[next >> 2],
+                                         (uint8_t)((d ^ 1) << ((next & 3) * 2)),
+                                         memory_order_relaxed);
+
+                if (next == bfs->end) {
+                    atomic_store(&bfs->found, 1);
+                    continue;
+                }
+
+                local[local_count++] = next;
+                if (local_count == PARALLEL_LOCAL) {
+                    parallel_flush(bfs, local, &local_count);
+                }
+            }
+        }
+    }
+
+    parallel_flush(bfs, local, &local_count);
+}
+
+// Gjøres av én tråd mellom to nivåer: bytter front og sørger for at neste
+// front har plass. Hver celle har høyst tre nye naboer. Så lenge fronten er
+// mindre enn en bit, utvider denne tråden nivåene alene, siden to barrierer
+// per nivå ellers koster mer enn selve arbeidet (f.eks. i en lang korridor)
+static void parallel_swap(ParallelBfs* bfs, ParallelWorker* worker) {
+    while (1) {
+        uint32_t* old = bfs->current;
+        size_t old_capacity = bfs->current_capacity;
+        bfs->current = bfs->next;
+        bfs->current_capacity = bfs->next_capacity;
+        bfs->current_count = atomic_load(&bfs->next_count);
+        bfs->next = old;
+        bfs->next_capacity = old_capacity;
+        atomic_store(&bfs->next_count, 0);
+        atomic_store(&bfs->claimed, 0);
+
+        if (atomic_load(&bfs->found) || bfs->current_count == 0) {
+            bfs->done = 1;
+            return;
+        }
+
+        size_t needed = (size_t)bfs->current_count * 3;
+        if (needed > bfs->next_capacity) {
+            // Neste front er tom, så ingenting må kopieres. Den gamle
+            // plassen i arenaen blir liggende til neste reset
+            uint32_t* bigger = bfs->arena != NULL ? mazeArenaAlloc(bfs->arena, needed * sizeof(uint32_t))
+                                                  : realloc(bfs->next, needed * sizeof(uint32_t));
+            if (bigger == NULL) {
+                bfs->failed = 1;
+                bfs->done = 1;
+                return;
+            }
+            bfs->next = bigger;
+            bfs->next_capacity = needed;
+        }
+
+        if (bfs->current_count >= PARALLEL_CHUNK) {
+            return;
+        }
+        parallel_level(bfs, worker);
+    }
+}
+
+static void* parallel_worker(void* arg) {
+    ParallelWorker* worker = arg;
+    ParallelBfs* bfs = worker->bfs;
+
+    pthread_mutex_lock(&bfs->gate);
+    while (!bfs->ready) {
+        pthread_cond_wait(&bfs->gate_open, &bfs->gate);
+    }
+    pthread_mutex_unlock(&bfs->gate);
+
+    while (1) {
+        pthread_barrier_wait(&bfs->barrier);
+        if (bfs->done) break;
+
+        parallel_level(bfs, worker);
+
+        if (pthread_barrier_wait(&bfs->barrier) == PTHREAD_BARRIER_SERIAL_THREAD) {
+            parallel_swap(bfs, worker);
+        }
+    }
+
+    return NULL;
+}
+
+static int solve_parallel(Maze* maze, const uint8_t* pass, int threads, MazeArena* arena, MazeStats* stats) {
+    if (threads <= 0) {
+        long online = sysconf(_SC_NPROCESSORS_ONLN);
+        threads = online > 0 ? (int)online : 1;
+    }
+    if (threads == 1) {
+        return solve_bfs(maze, pass, arena, stats);
+    }
+
+    uint32_t start = maze_start(maze);
+
+    ParallelBfs bfs;
+    memset(&bfs, 0, sizeof(bfs));
+    bfs.maze = maze;
+    bfs.pass = pass;
+    bfs.end = maze_end(maze);
+    bfs.arena = arena;
+    bfs.visited = scratch_calloc(arena, ((size_t)maze->size + 63) / 64, sizeof(_Atomic uint64_t));
+    bfs.parent = scratch_calloc(arena, ((size_t)maze->size + 3) / 4, sizeof(_Atomic uint8_t));
+    bfs.current_capacity = 1024;
+    bfs.next_capacity = 1024;
+    bfs.current = scratch_calloc(arena, bfs.current_capacity, sizeof(uint32_t));
+    bfs.next = scratch_calloc(arena, bfs.next_capacity, sizeof(uint32_t));
+    ParallelWorker* workers = scratch_calloc(arena, threads, sizeof(ParallelWorker));
+
+    int length = -1;
+    if (bfs.visited == NULL || bfs.parent == NULL || bfs.current == NULL ||
+        bfs.next == NULL || workers == NULL) {
+        LOG_ERROR("ERROR: Fikk ikke minne til å løse labyrinten\n");
+        goto out;
+    }
+
+    atomic_init(&bfs.next_count, 0);
+    atomic_init(&bfs.claimed, 0);
+    atomic_init(&bfs.found, start == bfs.end);
+    atomic_store(&bfs.visited[start >> 6], (uint64_t)1 << (start & 63));
+    bfs.current[0] = start;
+    bfs.current_count = 1;
+    bfs.done = (start == bfs.end);
+
+    pthread_mutex_init(&bfs.gate, NULL);
+    pthread_cond_init(&bfs.gate_open, NULL);
+
+    // Denne tråden er arbeider nummer 0
+    int started = 1;
+    for (int i = 0; i < threads; i++) {
+        workers[i].bfs = &bfs;
+    }
+    for (int i = 1; i < threads; i++) {
+        if (pthread_create(&workers[i].thread, NULL, parallel_worker, &workers[i]) != 0) {
+            LOG_WARN("WARNING: Fikk bare startet %d av %d tråder\n", started, threads);
+            break;
+        }
+        started++;
+    }
+
+    pthread_barrier_init(&bfs.barrier, NULL, started);
+    pthread_mutex_lock(&bfs.gate);
+    bfs.ready = 1;
+    pthread_cond_broadcast(&bfs.gate_open);
+    pthread_mutex_unlock(&bfs.gate);
+
+    parallel_worker(&workers[0]);
+
+    for (int i = 1; i < started; i++) {
+        pthread_join(workers[i].thread, NULL);
+    }
+    pthread_barrier_destroy(&bfs.barrier);
+    pthread_cond_destroy(&bfs.gate_open);
+    pthread_mutex_destroy(&bfs.gate);
+
+    for (int i = 0; i < started; i++) {
+        stats->expanded += workers[i].expanded;
+    }
+
+    if (bfs.failed) {
+        LOG_ERROR("ERROR: Fikk ikke minne til BFS-fronten\n");
+    } else if (atomic_load(&bfs.found)) {
+        length = mark_path(maze, (const uint8_t*)bfs.parent, bfs.end, start);
+    }
+
+out:
+    scratch_free(arena, bfs.visited);
+    scratch_free(arena, (void*)bfs.parent);
+    scratch_free(arena, bfs.current);
+    scratch_free(arena, bfs.next);
+    scratch_free(arena, workers);
+    return length;
+}
+
+static const char* strategy_name(MazeStrategy strategy) {
+    switch (strategy) {
+        case MAZE_BIDIR_BFS: return "bidir";
+        case MAZE_ASTAR:     return "astar";
+        case MAZE_PARALLEL_BFS: return "parallel";
+        default:             return "bfs";
+    }
+}
+
+int mazeSolveWith(Maze* maze, const MazeOptions* options, MazeStats* stats) {
+    MazeStrategy strategy = options != NULL ? options->strategy : MAZE_BFS;
+    MazeArena* arena = options != NULL ? options->arena : NULL;
+
+    MazeStats local;
+    if (stats == NULL) {
+        stats = &local;
+    }
+    stats->expanded = 0;
+    stats->pathLength = -1;
+    stats->seconds = 0.0;
+    stats->pruned = 0;
+
     // Debug: print start og slutt-koordinater
-    printf("DEBUG: Løser labyrint fra (%u, %u) til (%u, %u)\n",
-           maze->startX, maze->startY, maze->endX, maze->endY);
+    LOG_DEBUG("DEBUG: Løser labyrint fra (%u, %u) til (%u, %u) med %s\n",
+              maze->startX, maze->startY, maze->endX, maze->endY, strategy_name(strategy));
+
+    struct timespec begin, done;
+    clock_gettime(CLOCK_MONOTONIC, &begin);
+
+    // Masken regnes med i tiden, siden den må lages for hver labyrint
+    // Det samme gjelder blindveifyllingen, som jobber på masken
+    unsigned flags = options != NULL ? options->flags : 0;
+    uint8_t* pass = NULL;
+    if (flags & (MAZE_OPT_PASSMASK | MAZE_OPT_DEADEND)) {
+        pass = arena != NULL ? mazeArenaAlloc(arena, maze->size > 0 ? maze->size : 1)
+                             : malloc(maze->size > 0 ? maze->size : 1);
+        if (pass == NULL || mazePassMask(maze, pass, MAZE_SIMD_AUTO) < 0) {
+            LOG_WARN("WARNING: Fikk ikke laget passerbarhetsmaske, søker uten\n");
+            scratch_free(arena, pass);
+            pass = NULL;
+        }
+    }
+    if (pass != NULL && (flags & MAZE_OPT_DEADEND)) {
+        long pruned = mazeFillDeadEndsWith(maze, pass, arena);
+        if (pruned < 0) {
+            // Masken kan være halvveis fylt, men er fortsatt riktig
+            LOG_WARN("WARNING: Fikk ikke minne til blindveifylling\n");
+        } else {
+            stats->pruned = (uint64_t)pruned;
+            LOG_DEBUG("DEBUG: Blindveifylling fjernet %ld celler\n", pruned);
+        }
+    }
 
-    int minPathLength = maze->size;
-    int success = dfs(maze, maze->startX, maze->startY, maze->endX, maze->endY, 0, &minPathLength);
+    int length;
+    switch (strategy) {
+        case MAZE_BIDIR_BFS: length = solve_bidir(maze, pass, arena, stats); break;
+        case MAZE_ASTAR:     length = solve_astar(maze, pass, arena, stats); break;
+        case MAZE_PARALLEL_BFS:
+            length = solve_parallel(maze, pass, options->threads, arena, stats);
+            break;
+        default:             length = solve_bfs(maze, pass, arena, stats); break;
+    }
+    scratch_free(arena, pass);
+
+    clock_gettime(CLOCK_MONOTONIC, &done);
+    stats->seconds = (double)(done.tv_sec - begin.tv_sec) + (done.tv_nsec - begin.tv_nsec) / 1e9;
+    stats->pathLength = length;
 
-    if (!success) {
-        fprintf(stderr, "WARNING: Fant ingen løsning på labyrinten!\n");
+    if (length < 0) {
+        LOG_WARN("WARNING: Fant ingen løsning på labyrinten!\n");
+    } else {
+        LOG_DEBUG("DEBUG: Korteste sti er %d celler, %llu celler utvidet på %.6f s\n",
+                  length, (unsigned long long)stats->expanded, stats->seconds);
     }
 
     // Debug: print hvor mange bytes labyrinten består av
-    printf("DEBUG: maze->size = %u bytes\n", maze->size);
+    LOG_DEBUG("DEBUG: maze->size = %u bytes\n", maze->size);
+
+    return length;
+}
+
+int mazeParseHeader(Maze* maze, char* buffer, size_t len) {
+    if (len < MAZE_HEADER_LEN) {
+        return -1;
+    }
+
+    uint32_t header[6];
+    memcpy(header, buffer, sizeof(header));
+    maze->edgeLen = ntohl(header[0]);
+    maze->size = ntohl(header[1]);
+    maze->startX = ntohl(header[2]);
+    maze->startY = ntohl(header[3]);
+    maze->endX = ntohl(header[4]);
+    maze->endY = ntohl(header[5]);
+    maze->maze = buffer + MAZE_HEADER_LEN;
+
+    // Kvadratisk, riktig lengde, og start og slutt inne i labyrinten
+    if ((uint64_t)maze->edgeLen * maze->edgeLen != maze->size) return -1;
+    if (len != MAZE_HEADER_LEN + (size_t)maze->size) return -1;
+    if (maze->startX >= maze->edgeLen || maze->startY >= maze->edgeLen) return -1;
+    if (maze->endX >= maze->edgeLen || maze->endY >= maze->edgeLen) return -1;
+    return 0;
+}
+
+// Maze solve funksjon
+int mazeSolve(Maze* maze) {
+    return mazeSolveWith(maze, NULL, NULL);
+}
+
+int mazeStrategyFromName(const char* name, MazeStrategy* strategy) {
+    for (int s = MAZE_BFS; s <= MAZE_PARALLEL_BFS; s++) {
+        if (strcmp(name, strategy_name((MazeStrategy)s)) == 0) {
+            *strategy = (MazeStrategy)s;
+            return 0;
+        }
+    }
+    return -1;
 }
@@ -2,6 +2,7 @@
 #define MAZE_H
 
 #include <inttypes.h>
+#include <stdio.h>
 
 #define left   ( 0x1 << 1 )
 #define right  ( 0x1 << 2 )
@@ -11,6 +12,12 @@
 #define tmark  ( 0x1 << 5 )
 #define mark   ( 0x1 << 6 )
 
+/* Size of the header in front of the cells when a maze is sent over
+ * the network or stored in a file: edgeLen, size, startX, startY, endX
+ * and endY as uint32_t in network byte order.
+ */
+#define MAZE_HEADER_LEN (6*sizeof(uint32_t))
+
 typedef struct Maze Maze;
 
 struct Maze
@@ -46,10 +53,61 @@ struct Maze
     char* maze;
 };
 
+/* Read the MAZE_HEADER_LEN header at the start of buffer (len bytes, as
+ * received or mapped) into maze, and point maze->maze at the cells
+ * behind it. Returns 0, or -1 if the header does not describe a square
+ * maze of exactly len - MAZE_HEADER_LEN cells with start and end inside
+ * it. Every maze from the network or a file must pass this check before
+ * it is solved, since the solvers index the grid with the header values.
+ */
+int mazeParseHeader( struct Maze* maze, char* buffer, size_t len );
+
 /* Take a maze data structure and plot it to the screen.
  */
 void mazePlot( const struct Maze* maze );
 
+/* Plot only the cells from (x0,y0) that are width cells wide and height
+ * cells high, including the walls around them, exactly as they appear
+ * in the full plot. The plot is written one line at a time, so memory
+ * use is proportional to width. Returns 0, or -1 if the viewport lies
+ * outside the maze or writing fails.
+ */
+int mazePlotViewport( const struct Maze* maze, FILE* out,
+                      uint32_t x0, uint32_t y0, uint32_t width, uint32_t height );
+
+/* Plot a downsampled overview that is at most maxWidth characters wide
+ * (plus a frame). Each character stands for a square block of cells and
+ * shows 'A' or 'B' if the block contains the start or end, 'o' if it
+ * contains a marked cell, and ' ' otherwise. Walls are not shown.
+ * Returns 0, or -1 on error.
+ */
+int mazePlotOverview( const struct Maze* maze, FILE* out, uint32_t maxWidth );
+
+/* Image formats for mazeExport.
+ * MAZE_IMAGE_PBM - binary PBM (P4), 1 bit per pixel. Every position of
+ *                  the plot grid is a 3x3 block; the path is a dot in the
+ *                  middle of the block and start and end are crosses.
+ * MAZE_IMAGE_PNG - PNG with a four-colour palette, one pixel per position
+ *                  of the plot grid: white passages, black walls, red
+ *                  path, green start and end. The image data is stored
+ *                  uncompressed, so zlib is not needed.
+ */
+typedef enum MazeImageFormat
+{
+    MAZE_IMAGE_PBM = 0,
+    MAZE_IMAGE_PNG
+} MazeImageFormat;
+
+/* Write the maze as an image to out, one scanline at a time. Returns 0,
+ * or -1 if memory ran out or writing failed.
+ */
+int mazeExport( const struct Maze* maze, FILE* out, MazeImageFormat format );
+
+/* Like mazeExport, but to the file path, as PNG if the name ends in
+ * ".png" and as PBM otherwise.
+ */
+int mazeExportFile( const struct Maze* maze, const char* path );
+
 /* This function takes a maze data structure. It will search
  * for a path through the maze from (startX,startY) to (endX,endY)
  * and mark the path by adding the bit "mark" on the direct
@@ -60,8 +118,291 @@ void mazePlot( const struct Maze* maze );
  * is such a bit that you could use.
  * The strategy for finding the path is yours. A typical approach
  * would be DFS and recursion, but the choice is yours.
+ *
+ * This implementation uses an iterative breadth-first search, so the
+ * marked path is a shortest one. Besides the maze itself it needs
+ * about 3/8 byte per cell plus the BFS frontier. It returns the
+ * number of cells on the path (start and end included), or -1 if
+ * there is no path or memory ran out.
+ */
+int mazeSolve( struct Maze* maze );
+
+/* Search strategies for mazeSolveWith. All of them mark a shortest
+ * path.
+ * MAZE_BFS       - breadth-first search from the start (the default).
+ * MAZE_BIDIR_BFS - breadth-first search from both ends, expanding one
+ *                  level at a time on the side with the smaller
+ *                  frontier until the two searches meet.
+ * MAZE_ASTAR     - A* with the Manhattan distance to the end as
+ *                  heuristic.
+ * MAZE_PARALLEL_BFS - level-synchronous breadth-first search where
+ *                  MazeOptions.threads threads expand each level
+ *                  together (0 means one per online CPU).
+ */
+typedef enum MazeStrategy
+{
+    MAZE_BFS = 0,
+    MAZE_BIDIR_BFS,
+    MAZE_ASTAR,
+    MAZE_PARALLEL_BFS
+} MazeStrategy;
+
+/* Scratch memory for the solvers. Allocation bumps a pointer in the
+ * current block, and mazeArenaReset makes all of it free again at once.
+ * A new block is malloc'ed only when the current one is full; after a
+ * reset that followed such growth, the blocks are replaced by a single
+ * one that is large enough for everything, so solving mazes of the same
+ * size over and over stops calling malloc after the first one.
+ * An arena must only be used by one thread at a time.
+ */
+typedef struct MazeArena MazeArena;
+
+/* Create an arena whose first block holds at least initial bytes (0 for
+ * a small default). Returns NULL if memory ran out.
+ */
+MazeArena* mazeArenaCreate( size_t initial );
+
+/* bytes of uninitialised memory, aligned to 64 bytes, or NULL if memory
+ * ran out. It stays valid until the next mazeArenaReset.
+ */
+void* mazeArenaAlloc( MazeArena* arena, size_t bytes );
+
+/* Free everything allocated from the arena since the last reset. */
+void mazeArenaReset( MazeArena* arena );
+
+/* Number of blocks malloc'ed by the arena since it was created. It stops
+ * growing once the arena has reached its high-water mark.
+ */
+unsigned long mazeArenaMallocs( const MazeArena* arena );
+
+void mazeArenaDestroy( MazeArena* arena );
+
+typedef struct MazeOptions MazeOptions;
+
+struct MazeOptions
+{
+    MazeStrategy strategy;
+
+    /* number of threads for MAZE_PARALLEL_BFS, 0 for all CPUs */
+    int threads;
+
+    /* MAZE_OPT_* flags */
+    unsigned flags;
+
+    /* Scratch memory for the search, or NULL to use malloc. The solver
+     * takes what it needs, for every strategy and for the pass mask and
+     * dead-end filling, and leaves it to the caller to reset the arena
+     * between mazes. MAZE_PARALLEL_BFS still starts its threads for
+     * every maze. The packed solver (mazePack, mazeSolvePacked) does not
+     * use an arena.
+     */
+    MazeArena* arena;
+};
+
+/* Compute the passability mask (see mazePassMask) before the search,
+ * so that every step tests a single byte without bounds checks.
+ */
+#define MAZE_OPT_PASSMASK  ( 0x1 << 0 )
+
+/* Fill dead ends (see mazeFillDeadEnds) before the search. Implies
+ * MAZE_OPT_PASSMASK. Pruned cells are never visited or marked.
+ */
+#define MAZE_OPT_DEADEND   ( 0x1 << 1 )
+
+/* Filled in by mazeSolveWith.
+ */
+typedef struct MazeStats MazeStats;
+
+struct MazeStats
+{
+    /* cells taken off the frontier and expanded */
+    uint64_t expanded;
+
+    /* cells on the marked path, or -1 */
+    int pathLength;
+
+    /* wall-clock time spent in the solver */
+    double seconds;
+
+    /* cells removed by dead-end filling (MAZE_OPT_DEADEND) */
+    uint64_t pruned;
+};
+
+/* Like mazeSolve, but with a selectable strategy. options and stats
+ * may be NULL. Returns the path length like mazeSolve.
+ */
+int mazeSolveWith( struct Maze* maze, const MazeOptions* options, MazeStats* stats );
+
+/* Look up a strategy by the name "bfs", "bidir", "astar" or "parallel". Returns 0
+ * on success and -1 for an unknown name.
+ */
+int mazeStrategyFromName( const char* name, MazeStrategy* strategy );
+
+/* Implementations of mazePassMask.
+ */
+typedef enum MazeSimd
+{
+    MAZE_SIMD_AUTO = 0,
+    MAZE_SIMD_SCALAR,
+    MAZE_SIMD_SSE2,
+    MAZE_SIMD_AVX2
+} MazeSimd;
+
+/* Fill pass (maze->size bytes) with the passability mask of the maze:
+ * a direction bit is set in pass[i] only if cell i has it, the
+ * neighbour in that direction has the opposite bit, and the
+ * neighbour lies inside the maze. The mask is symmetric and has no
+ * bits pointing across the border.
+ * MAZE_SIMD_AUTO picks the widest implementation the CPU supports; a
+ * requested implementation that is not available falls back to a
+ * narrower one. Returns the MazeSimd value that was used, or -1 if
+ * memory ran out.
+ */
+int mazePassMask( const struct Maze* maze, uint8_t* pass, MazeSimd simd );
+
+/* Dead-end filling on a passability mask: repeatedly remove every cell
+ * other than start and end that has at most one open direction, and
+ * close the way back from its neighbour. What is left are the cells
+ * that lie on some path from start to end (in a perfect maze exactly
+ * the solution). Returns the number of cells removed, or -1 if memory
+ * ran out.
+ */
+long mazeFillDeadEnds( const struct Maze* maze, uint8_t* pass );
+
+/* Like mazeFillDeadEnds, but the work stack comes from arena (NULL for
+ * malloc) and stays there until the caller resets it.
+ */
+long mazeFillDeadEndsWith( const struct Maze* maze, uint8_t* pass, MazeArena* arena );
+
+/* Packed form of a maze for the solver. Only the four direction bits of
+ * each cell are kept, as a nibble (bit 0 left, bit 1 right, bit 2 up,
+ * bit 3 down); cell i is in the low nibble of walls[i/2] if i is even and
+ * in the high nibble otherwise. Visited cells and the path are separate
+ * bitsets with one bit per cell, so solving never writes to the cells.
+ */
+typedef struct PackedMaze PackedMaze;
+
+struct PackedMaze
+{
+    uint32_t edgeLen;
+    uint32_t size;
+    uint32_t startX;
+    uint32_t startY;
+    uint32_t endX;
+    uint32_t endY;
+
+    uint8_t*  walls;
+    uint64_t* visited;
+    uint64_t* path;
+};
+
+static inline uint8_t mazePackedCell( const PackedMaze* packed, uint32_t i )
+{
+    return ( packed->walls[i >> 1] >> ( ( i & 1 ) * 4 ) ) & 0xf;
+}
+
+/* Create the packed form of a maze in the wire format. Returns NULL if
+ * memory ran out.
+ */
+PackedMaze* mazePack( const struct Maze* maze );
+
+/* Set the mark bit on every cell of maze that is on the path of the
+ * solved packed maze. No other bits are changed.
  */
-void mazeSolve( struct Maze* maze );
+void mazeUnpackMarks( const PackedMaze* packed, struct Maze* maze );
+
+/* Breadth-first search on a packed maze. Marks a shortest path in
+ * packed->path and returns its length in cells, or -1. stats may be
+ * NULL.
+ */
+int mazeSolvePacked( PackedMaze* packed, MazeStats* stats );
+
+void mazePackedFree( PackedMaze* packed );
+
+/* A maze file has the same layout as a maze on the network: the
+ * MAZE_HEADER_LEN header followed by the cells. MazeFile maps the file
+ * into memory, and maze.maze points straight into the mapping, so the
+ * cells are never copied onto the heap.
+ */
+typedef struct MazeFile MazeFile;
+
+struct MazeFile
+{
+    Maze   maze;
+    void*  map;
+    size_t length;
+    int    writable;
+};
+
+/* Map the maze file at path. If writable is 0 the mapping is private,
+ * so solving marks the cells in memory only; otherwise the marks are
+ * written back to the file. Returns NULL if the file cannot be mapped or
+ * its header does not match its size.
+ */
+MazeFile* mazeFileOpen( const char* path, int writable );
+
+/* Unmap the file (after syncing it if it is writable) and free file.
+ * Returns 0, or -1 if syncing or unmapping failed.
+ */
+int mazeFileClose( MazeFile* file );
+
+/* Store maze in a maze file at path, through a shared mapping. Returns
+ * 0, or -1 on error.
+ */
+int mazeFileSave( const struct Maze* maze, const char* path );
+
+/* Generate a perfect maze (exactly one path between any two cells) with
+ * edgeLen x edgeLen cells using Eller's algorithm, which needs O(edgeLen)
+ * memory besides the grid. The same seed always gives the same maze,
+ * including the start and end cells, but not the same maze that
+ * maze-server sends for "MAZE <seed>". Returns NULL if memory ran out
+ * or edgeLen is 0 or too large; free the result with free(maze->maze)
+ * and free(maze).
+ */
+Maze* mazeGenerate( uint32_t edgeLen, long seed );
+
+/* Cache of solved mazes, keyed by mazeHash of the maze as it was
+ * received (header and unmarked cells). It keeps up to capacity
+ * solutions in memory and evicts the least recently used one. With a
+ * directory it also stores every solution there as <key>.path, so that
+ * later runs can find it. A cache is not thread-safe.
+ */
+typedef struct MazeCache MazeCache;
+
+typedef struct MazeCacheStats MazeCacheStats;
+
+struct MazeCacheStats
+{
+    uint64_t hits;       /* lookups that found a solution, in memory or on disk */
+    uint64_t misses;
+    uint64_t diskHits;   /* hits that had to read the directory */
+    uint64_t diskWrites;
+    uint64_t evictions;
+};
+
+/* XXH64 of the maze header in network byte order, used as the seed of
+ * the XXH64 of the cells. Must be computed before the maze is solved.
+ */
+uint64_t mazeHash( const struct Maze* maze );
+
+/* Create a cache for capacity solutions in memory (0 for disk only),
+ * stored in dir if dir is not NULL. The directory is created if it does
+ * not exist. Returns NULL if memory ran out.
+ */
+MazeCache* mazeCacheCreate( size_t capacity, const char* dir );
+void       mazeCacheDestroy( MazeCache* cache );
+
+/* On a hit, mark the stored path in maze->maze, exactly as the solver
+ * would have, and return its length. Returns -1 on a miss.
+ */
+int mazeCacheLookup( MazeCache* cache, uint64_t key, struct Maze* maze );
+
+/* Store the marked path of a solved maze under key (from mazeHash before
+ * solving). Returns 0, or -1 if it could not be written to the directory.
+ */
+int mazeCacheStore( MazeCache* cache, uint64_t key, const struct Maze* maze );
+
+void mazeCacheGetStats( const MazeCache* cache, MazeCacheStats* stats );
 
 #endif
 
@@ -0,0 +1,392 @@
+#include <errno.h>
+#include <poll.h>
+#include <signal.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/time.h>
+#include <unistd.h>
+#include <arpa/inet.h>
+#include <netinet/in.h>
+#include <sys/socket.h>
+
+/* A UDP proxy that sits between a client and a server on the same host
+ * and emulates a bad network. The client sends to the emulator's port
+ * instead of to the server; every datagram in either direction may be
+ * lost, corrupted (one bit flipped), duplicated, delayed and reordered,
+ * each with its own probability. Replies from the server go to the
+ * client address the emulator heard from last, so it serves one client
+ * at a time, like the L2 and L4 servers.
+ *
+ * Delayed datagrams wait in a queue sorted by the time they are due.
+ * A reordered datagram is held back reorder_ms longer than the others,
+ * so that the ones sent after it overtake it. Jitter alone can also
+ * reorder datagrams when it is larger than the gap between them.
+ */
+
+#define MAX_DATAGRAM 65536
+
+enum
+{
+    TO_SERVER = 0,
+    TO_CLIENT = 1
+};
+
+static const char* direction_names[] = { "client -> server", "server -> client" };
+
+typedef struct Packet Packet;
+
+struct Packet
+{
+    struct timeval due;
+    int            direction;
+    int            len;
+    Packet*        next;
+    uint8_t        data[];
+};
+
+typedef struct
+{
+    double loss;
+    double duplicate;
+    double reorder;
+    double corrupt;
+    long   delay_us;
+    long   jitter_us;
+    long   reorder_us;
+} Impairments;
+
+typedef struct
+{
+    unsigned long received;
+    unsigned long lost;
+    unsigned long corrupted;
+    unsigned long duplicated;
+    unsigned long reordered;
+    unsigned long forwarded;
+    unsigned long bytes;
+} Counters;
+
+static Packet*  queue = NULL;
+static Counters counters[2];
+
+static volatile sig_atomic_t stop = 0;
+
+static void on_signal( int sig )
+{
+    (void)sig;
+    stop = 1;
+}
+
+void usage( const char* name )
+{
+    fprintf( stderr, "Usage: %s [-l <loss>] [-u <dup>] [-r <reorder>] [-c <corrupt>]\n"
+                     "       %*s [-D <delay>] [-J <jitter>] [-R <holdback>] [-s <seed>] [-t <idle>]\n"
+                     "       %*s <port> <serverip> <serverport>\n"
+                     "       loss       - optional, probability that a datagram is lost, between 0 and 1\n"
+                     "       dup        - optional, probability that a datagram is sent twice\n"
+                     "       reorder    - optional, probability that a datagram is held back\n"
+                     "       corrupt    - optional, probability that one bit of a datagram is flipped\n"
+                     "       delay      - optional, one-way delay in milliseconds (default 0)\n"
+                     "       jitter     - optional, extra random delay of up to this many milliseconds\n"
+                     "       holdback   - optional, extra delay of a reordered datagram in ms (default 10)\n"
+                     "       seed       - optional, random number generator seed (default 1)\n"
+                     "       idle       - optional, exit after this many seconds without traffic\n"
+                     "       port       - The emulator's port, where the client sends to\n"
+                     "       serverip   - IPv4 address of the server in dotted decimal notation\n"
+                     "       serverport - The server's port\n",
+                     name, (int)strlen(name), "", (int)strlen(name), "" );
+    exit( -1 );
+}
+
+static double probability( const char* arg, const char* name )
+{
+    double p = atof( arg );
+    if( p < 0.0 || p > 1.0 )
+    {
+        fprintf( stderr, "The %s probability must be between 0 and 1\n", name );
+        exit( -1 );
+    }
+    return p;
+}
+
+static void add_us( struct timeval* tv, long us )
+{
+    struct timeval d;
+    d.tv_sec  = us / 1000000;
+    d.tv_usec = us % 1000000;
+    timeradd( tv, &d, tv );
+}
+
+/* Insert behind all packets that are due at the same time or earlier,
+ * so that packets with equal delay keep their order.
+ */
+static void enqueue( Packet* p )
+{
+    Packet** pos = &queue;
+    while( *pos != NULL && !timercmp( &p->due, &(*pos)->due, < ) )
+    {
+        pos = &(*pos)->next;
+    }
+    p->next = *pos;
+    *pos = p;
+}
+
+static int schedule( const Impairments* imp, int direction, const uint8_t* data, int len,
+                     const struct timeval* now, int holdback )
+{
+    Packet* p = (Packet*)malloc( sizeof(Packet) + len );
+    if( p == NULL ) return -1;
+
+    p->direction = direction;
+    p->len       = len;
+    memcpy( p->data, data, len );
+
+    long delay = imp->delay_us;
+    if( imp->jitter_us > 0 ) delay += (long)( drand48() * imp->jitter_us );
+    if( holdback ) delay += imp->reorder_us;
+
+    p->due = *now;
+    add_us( &p->due, delay );
+    enqueue( p );
+    return 0;
+}
+
+static void impair( const Impairments* imp, int direction, uint8_t* data, int len )
+{
+    Counters* c = &counters[direction];
+    struct timeval now;
+    gettimeofday( &now, NULL );
+
+    c->received++;
+
+    if( drand48() < imp->loss )
+    {
+        c->lost++;
+        return;
+    }
+
+    if( len > 0 && drand48() < imp->corrupt )
+    {
+        int bit = (int)( drand48() * len * 8 );
+        data[bit / 8] ^= 1 << ( bit % 8 );
+        c->corrupted++;
+    }
+
+    int holdback = drand48() < imp->reorder;
+    if( holdback ) c->reordered++;
+
+    if( schedule( imp, direction, data, len, &now, holdback ) < 0 )
+    {
+        c->lost++;
+        return;
+    }
+
+    if( drand48() < imp->duplicate )
+    {
+        if( schedule( imp, direction, data, len, &now, 0 ) == 0 ) c->duplicated++;
+    }
+}
+
+static int due_in_ms( const struct timeval* now )
+{
+    if( queue == NULL ) return -1;
+
+    struct timeval d;
+    if( !timercmp( &queue->due, now, > ) ) return 0;
+    timersub( &queue->due, now, &d );
+    return (int)( d.tv_sec * 1000 + ( d.tv_usec + 999 ) / 1000 );
+}
+
+static void print_counters( void )
+{
+    for( int d = TO_SERVER; d <= TO_CLIENT; d++ )
+    {
+        const Counters* c = &counters[d];
+        fprintf( stderr, "%s: received %lu, lost %lu, corrupted %lu, duplicated %lu, "
+                         "reordered %lu, forwarded %lu (%lu bytes)\n",
+                 direction_names[d], c->received, c->lost, c->corrupted,
+                 c->duplicated, c->reordered, c->forwarded, c->bytes );
+    }
+}
+
+int main( int argc, char *argv[] )
+{
+    Impairments imp;
+    memset( &imp, 0, sizeof(imp) );
+    imp.reorder_us = 10000;
+
+    long seed = 1;
+    int  idle = 0;
+    int  opt;
+    while( ( opt = getopt( argc, argv, "l:u:r:c:D:J:R:s:t:" ) ) != -1 )
+    {
+        switch( opt )
+        {
+        case 'l' :
+            imp.loss = probability( optarg, "loss" );
+            break;
+        case 'u' :
+            imp.duplicate = probability( optarg, "duplication" );
+            break;
+        case 'r' :
+            imp.reorder = probability( optarg, "reordering" );
+            break;
+        case 'c' :
+            imp.corrupt = probability( optarg, "corruption" );
+            break;
+        case 'D' :
+            imp.delay_us = (long)( atof( optarg ) * 1000 );
+            break;
+        case 'J' :
+            imp.jitter_us = (long)( atof( optarg ) * 1000 );
+            break;
+        case 'R' :
+            imp.reorder_us = (long)( atof( optarg ) * 1000 );
+            break;
+        case 's' :
+            seed = atol( optarg );
+            break;
+        case 't' :
+            idle = atoi( optarg );
+            break;
+        default :
+            usage( argv[0] );
+        }
+    }
+
+    if( argc - optind != 3 ) usage( argv[0] );
+    if( imp.delay_us < 0 || imp.jitter_us < 0 || imp.reorder_us < 0 || idle < 0 ) usage( argv[0] );
+
+    srand48( seed );
+
+    struct sockaddr_in listen_addr;
+    memset( &listen_addr, 0, sizeof(listen_addr) );
+    listen_addr.sin_family      = AF_INET;
+    listen_addr.sin_port        = htons( atoi(argv[optind]) );
+    listen_addr.sin_addr.s_addr = htonl( INADDR_ANY );
+
+    struct sockaddr_in server_addr;
+    memset( &server_addr, 0, sizeof(server_addr) );
+    server_addr.sin_family = AF_INET;
+    server_addr.sin_port   = htons( atoi(argv[optind+2]) );
+    if( inet_pton( AF_INET, argv[optind+1], &server_addr.sin_addr ) != 1 )
+    {
+        fprintf( stderr, "%s: '%s' is not an IPv4 address\n", __FUNCTION__, argv[optind+1] );
+        return -1;
+    }
+
+    /* fds[TO_SERVER] receives from the client, fds[TO_CLIENT] from the server */
+    struct pollfd fds[2];
+    fds[TO_SERVER].fd = socket( AF_INET, SOCK_DGRAM, 0 );
+    fds[TO_CLIENT].fd = socket( AF_INET, SOCK_DGRAM, 0 );
+    if( fds[TO_SERVER].fd < 0 || fds[TO_CLIENT].fd < 0 )
+    {
+        perror( "socket" );
+        return -1;
+    }
+    if( bind( fds[TO_SERVER].fd, (struct sockaddr*)&listen_addr, sizeof(listen_addr) ) < 0 )
+    {
+        perror( "bind" );
+        return -1;
+    }
+    fds[TO_SERVER].events = POLLIN;
+    fds[TO_CLIENT].events = POLLIN;
+
+    struct sockaddr_in client_addr;
+    int have_client = 0;
+
+    /* No SA_RESTART, so that poll returns when the user presses Ctrl-C */
+    struct sigaction sa;
+    memset( &sa, 0, sizeof(sa) );
+    sa.sa_handler = on_signal;
+    sigaction( SIGINT, &sa, NULL );
+    sigaction( SIGTERM, &sa, NULL );
+
+    fprintf( stderr, "%s: Forwarding port %s to %s:%s\n", __FUNCTION__,
+             argv[optind], argv[optind+1], argv[optind+2] );
+
+    struct timeval last_traffic;
+    gettimeofday( &last_traffic, NULL );
+
+    static uint8_t buffer[MAX_DATAGRAM];
+
+    while( !stop )
+    {
+        struct timeval now;
+        gettimeofday( &now, NULL );
+
+        int timeout = due_in_ms( &now );
+        if( idle > 0 && queue == NULL )
+        {
+            struct timeval quiet;
+            timersub( &now, &last_traffic, &quiet );
+            if( quiet.tv_sec >= idle ) break;
+            timeout = 1000;
+        }
+
+        int ready = poll( fds, 2, timeout );
+        if( ready < 0 )
+        {
+            if( errno == EINTR ) continue;
+            perror( "poll" );
+            break;
+        }
+
+        for( int d = TO_SERVER; d <= TO_CLIENT && ready > 0; d++ )
+        {
+            if( !( fds[d].revents & POLLIN ) ) continue;
+
+            struct sockaddr_in from;
+            socklen_t fromlen = sizeof(from);
+            int len = recvfrom( fds[d].fd, buffer, sizeof(buffer), 0, (struct sockaddr*)&from, &fromlen );
+            if( len < 0 )
+            {
+                /* ICMP port unreachable from a peer that has gone away */
+                if( errno != ECONNREFUSED ) perror( "recvfrom" );
+                continue;
+            }
+
+            if( d == TO_SERVER )
+            {
+                client_addr = from;
+                have_client = 1;
+            }
+            gettimeofday( &last_traffic, NULL );
+            impair( &imp, d, buffer, len );
+        }
+
+        gettimeofday( &now, NULL );
+        while( queue != NULL && !timercmp( &queue->due, &now, > ) )
+        {
+            Packet* p = queue;
+            queue = p->next;
+
+            int sent = -1;
+            if( p->direction == TO_SERVER )
+                sent = sendto( fds[TO_CLIENT].fd, p->data, p->len, 0,
+                               (struct sockaddr*)&server_addr, sizeof(server_addr) );
+            else if( have_client )
+                sent = sendto( fds[TO_SERVER].fd, p->data, p->len, 0,
+                               (struct sockaddr*)&client_addr, sizeof(client_addr) );
+            if( sent == p->len )
+            {
+                counters[p->direction].forwarded++;
+                counters[p->direction].bytes += p->len;
+            }
+            free( p );
+        }
+    }
+
+    print_counters();
+
+    while( queue != NULL )
+    {
+        Packet* p = queue;
+        queue = p->next;
+        free( p );
+    }
+    close( fds[TO_SERVER].fd );
+    close( fds[TO_CLIENT].fd );
+    return 0;
+}
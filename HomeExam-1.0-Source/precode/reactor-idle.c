@@ -0,0 +1,169 @@
+#define _GNU_SOURCE /* RUSAGE_THREAD */
+
+#include <pthread.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <sys/resource.h>
+
+#include "l4reactor.h"
+
+/* Checks that a session whose peer has gone away does not keep the
+ * reactor busy while other sessions are still waiting.
+ *
+ * Two sessions run against two server threads on localhost:
+ *   reset - the server receives one packet and sends one RESET, which
+ *           ends the session's receive with L4_QUIT; then it destroys
+ *           its L4SAP, whose burst of RESETs stays in the socket of the
+ *           session that has already ended;
+ *   slow  - the server receives one packet and answers it after
+ *           SLOW_SERVER_US.
+ * l4reactor_run should sleep in epoll_wait while it waits for the slow
+ * server. The check fails if the reactor thread used more than
+ * MAX_CPU_US of CPU time, or if a session ended with the wrong result.
+ */
+
+#define RESET_DELAY_US  100000
+#define SLOW_SERVER_US 1000000
+#define MAX_CPU_US      200000
+
+void usage( const char* name )
+{
+    fprintf( stderr, "Usage: %s [-P <port>]\n"
+                     "       port - optional, first of the two local ports to use (default 5780)\n",
+                     name );
+    exit( -1 );
+}
+
+typedef struct
+{
+    L4SAP* l4;
+    int    slow;
+} Server;
+
+static void* server_main( void* arg )
+{
+    Server* server = (Server*)arg;
+    uint8_t buffer[L4Payloadsize];
+
+    int len = l4sap_recv( server->l4, buffer, L4Payloadsize );
+    if( !server->slow )
+    {
+        /* Let the client see the ACK and start receiving, end the
+         * session with one RESET, and send the burst from
+         * l4sap_destroy only after the session has ended.
+         */
+        usleep( RESET_DELAY_US );
+        struct L4Header reset = { L4_RESET, 0, 0, 0 };
+        l2sap_sendto( server->l4->l2sap, (uint8_t*)&reset, L4Headersize );
+        usleep( RESET_DELAY_US );
+    }
+    else if( len >= 0 )
+    {
+        usleep( SLOW_SERVER_US );
+        l4sap_send( server->l4, buffer, len );
+        /* Wait for the client's QUIT or RESET before destroying */
+        l4sap_recv( server->l4, buffer, L4Payloadsize );
+    }
+    l4sap_destroy( server->l4 );
+    return NULL;
+}
+
+typedef struct
+{
+    const char* name;
+    uint8_t     buffer[L4Payloadsize];
+    int         sent;
+    int         received;
+} Client;
+
+static void received( L4Session* session, int result, void* arg )
+{
+    (void)session;
+    Client* client = (Client*)arg;
+    client->received = result;
+    fprintf( stderr, "%s: session %s received %d\n", __FUNCTION__, client->name, result );
+}
+
+static void sent( L4Session* session, int result, void* arg )
+{
+    Client* client = (Client*)arg;
+    client->sent = result;
+    if( result < 0 ) return;
+    l4reactor_recv( session, client->buffer, L4Payloadsize, received, client );
+}
+
+static double cpu_us( void )
+{
+    struct rusage ru;
+    getrusage( RUSAGE_THREAD, &ru );
+    return ( ru.ru_utime.tv_sec + ru.ru_stime.tv_sec ) * 1e6
+         + ru.ru_utime.tv_usec + ru.ru_stime.tv_usec;
+}
+
+int main( int argc, char *argv[] )
+{
+    int port = 5780;
+    int opt;
+    while( ( opt = getopt( argc, argv, "P:" ) ) != -1 )
+    {
+        switch( opt )
+        {
+        case 'P' :
+            port = atoi( optarg );
+            break;
+        default :
+            usage( argv[0] );
+        }
+    }
+    if( argc - optind != 0 || port < 1 ) usage( argv[0] );
+
+    /* A hanging session must not hang the check */
+    alarm( 30 );
+
+    Server    servers[2] = { { l4sap_server_create( port ), 0 },
+                             { l4sap_server_create( port + 1 ), 1 } };
+    Client    clients[2] = { { .name = "reset" }, { .name = "slow" } };
+    pthread_t threads[2];
+
+    L4Reactor* reactor = l4reactor_create();
+    if( reactor == NULL || servers[0].l4 == NULL || servers[1].l4 == NULL )
+    {
+        fprintf( stderr, "%s: Failed to create the reactor or the servers\n", __FUNCTION__ );
+        return -1;
+    }
+
+    for( int i = 0; i < 2; i++ )
+    {
+        if( pthread_create( &threads[i], NULL, server_main, &servers[i] ) != 0 )
+        {
+            perror( "pthread_create" );
+            return -1;
+        }
+
+        L4SAP*     l4      = l4sap_create( "127.0.0.1", port + i );
+        L4Session* session = l4 != NULL ? l4reactor_add( reactor, l4, &clients[i] ) : NULL;
+        if( session == NULL )
+        {
+            fprintf( stderr, "%s: Failed to create session %s\n", __FUNCTION__, clients[i].name );
+            return -1;
+        }
+        l4reactor_send( session, (const uint8_t*)"HELLO", 6, sent, &clients[i] );
+    }
+
+    double cpu = cpu_us();
+    int    run = l4reactor_run( reactor );
+    cpu = cpu_us() - cpu;
+
+    l4reactor_destroy( reactor );
+    for( int i = 0; i < 2; i++ ) pthread_join( threads[i], NULL );
+
+    int ok = run == 0
+          && clients[0].sent == 6 && clients[0].received == L4_QUIT
+          && clients[1].sent == 6 && clients[1].received == 6
+          && cpu <= MAX_CPU_US;
+    printf( "reactor used %.0f us of CPU while waiting %d us for the slow server: %s\n",
+            cpu, SLOW_SERVER_US, ok ? "ok" : "FAIL" );
+    return ok ? 0 : 1;
+}
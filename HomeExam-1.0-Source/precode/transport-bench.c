@@ -0,0 +1,676 @@
+#include <libgen.h>
+#include <limits.h>
+#include <signal.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <unistd.h>
+#include <sys/resource.h>
+#include <sys/select.h>
+#include <sys/wait.h>
+
+#include "l4sap.h"
+
+/* Throughput and latency benchmark for the L4 layer.
+ *
+ * The same program is the server (-S) and the client. The client tells
+ * the server what to do with a control message before every run:
+ *
+ *   client                          server
+ *   "BENCH <pattern> <size> <count>" ->
+ *                                   <- "READY"
+ *   count messages of size bytes, by pattern
+ *   "DONE"                          ->
+ *                                   <- "STATS <retransmits> <cpu_us>"
+ *   ... more runs ...
+ *   "QUIT"                          ->
+ *
+ * The patterns are:
+ *   pingpong - the client sends a message and waits for the server to
+ *              echo it; the latency is the round trip of one message;
+ *   stream   - the client only sends; the latency is the time from
+ *              l4sap_send until the message is acknowledged, as seen
+ *              by the client when it next reads the socket;
+ *   duplex   - both send a message and then receive one, at the same
+ *              time; the latency is one send plus one receive.
+ *
+ * Without a server address, the client starts the server itself, and
+ * for every loss rate in the list it runs a net-emulator (from the same
+ * directory as this program) between them with that loss rate and the
+ * given delay. The results are written as JSON.
+ */
+
+typedef enum
+{
+    PATTERN_PINGPONG = 0,
+    PATTERN_STREAM   = 1,
+    PATTERN_DUPLEX   = 2
+} Pattern;
+
+static const char* pattern_names[] = { "pingpong", "stream", "duplex" };
+
+#define MAX_SIZES  16
+#define MAX_LOSSES 16
+
+typedef struct
+{
+    double        loss;
+    int           size;
+    int           messages;
+    double        seconds;
+    double        bytes;
+    double        p50_us;
+    double        p99_us;
+    double        p999_us;
+    double        max_us;
+    unsigned long client_retransmits;
+    unsigned long server_retransmits;
+    double        client_cpu_us;
+    double        server_cpu_us;
+} RunResult;
+
+static pid_t server_pid   = -1;
+static pid_t emulator_pid = -1;
+
+void usage( const char* name )
+{
+    fprintf( stderr, "Usage: %s [-p <pattern>] [-m <sizes>] [-n <count>] [-w <window>] [-c]\n"
+                     "       %*s [-l <losses>] [-D <delay>] [-P <port>] [-o <file>] [<serverip> <port>]\n"
+                     "       %s -S <port> [-w <window>] [-c]\n"
+                     "       pattern  - optional, pingpong, stream or duplex (default pingpong)\n"
+                     "       sizes    - optional, comma-separated message sizes in bytes, at most %d\n"
+                     "                  (default 64,256,1012)\n"
+                     "       count    - optional, messages per run (default 1000)\n"
+                     "       window   - optional, number of L4 packets in flight (default 1); the\n"
+                     "                  server must use the same window\n"
+                     "       -c       - optional, send frames with CRC32C instead of XOR checksums\n"
+                     "       losses   - optional, comma-separated loss probabilities between 0 and 1,\n"
+                     "                  each run through net-emulator (default 0, no emulator)\n"
+                     "       delay    - optional, one-way delay in milliseconds added by net-emulator\n"
+                     "       port     - optional, first of the two local ports to use (default 5700)\n"
+                     "       file     - optional, write the JSON result here instead of to stdout\n"
+                     "       serverip - optional, IPv4 address of a running '%s -S' server;\n"
+                     "                  losses and delay are then only recorded, not applied\n"
+                     "       -S       - run as server on the given port\n",
+                     name, (int)strlen(name), "", name, L4Payloadsize, name );
+    exit( -1 );
+}
+
+static double now( void )
+{
+    struct timespec ts;
+    clock_gettime( CLOCK_MONOTONIC, &ts );
+    return ts.tv_sec + ts.tv_nsec / 1e9;
+}
+
+static double cpu_us( void )
+{
+    struct rusage ru;
+    getrusage( RUSAGE_SELF, &ru );
+    return ( ru.ru_utime.tv_sec + ru.ru_stime.tv_sec ) * 1e6
+         + ru.ru_utime.tv_usec + ru.ru_stime.tv_usec;
+}
+
+static void stop_children( void )
+{
+    if( emulator_pid > 0 )
+    {
+        kill( emulator_pid, SIGTERM );
+        waitpid( emulator_pid, NULL, 0 );
+        emulator_pid = -1;
+    }
+    if( server_pid > 0 )
+    {
+        kill( server_pid, SIGTERM );
+        waitpid( server_pid, NULL, 0 );
+        server_pid = -1;
+    }
+}
+
+static void fail( const char* what, int retval )
+{
+    fprintf( stderr, "transport-bench: %s failed (%d)\n", what, retval );
+    stop_children();
+    exit( -1 );
+}
+
+static int parse_list( const char* arg, double* values, int max )
+{
+    int   n = 0;
+    char* copy = strdup( arg );
+    char* save = NULL;
+    for( char* tok = strtok_r( copy, ",", &save ); tok != NULL; tok = strtok_r( NULL, ",", &save ) )
+    {
+        if( n == max )
+        {
+            n = -1;
+            break;
+        }
+        values[n++] = atof( tok );
+    }
+    free( copy );
+    return n;
+}
+
+static int compare_double( const void* a, const void* b )
+{
+    double x = *(const double*)a;
+    double y = *(const double*)b;
+    return ( x > y ) - ( x < y );
+}
+
+/* Nearest-rank percentile of sorted values */
+static double percentile( const double* sorted, int n, double p )
+{
+    int rank = (int)( p * n + 0.999999 );
+    if( rank < 1 ) rank = 1;
+    if( rank > n ) rank = n;
+    return sorted[rank - 1];
+}
+
+/* ---------------------------------------------------------------- */
+/* server                                                           */
+/* ---------------------------------------------------------------- */
+
+static int server_run( L4SAP* l4 )
+{
+    uint8_t buffer[L4Payloadsize+1];
+    char    reply[64];
+
+    for( ;; )
+    {
+        int len = l4sap_recv( l4, buffer, L4Payloadsize );
+        if( len < 0 ) return len;
+        buffer[len] = 0;
+
+        if( strcmp( (char*)buffer, "QUIT" ) == 0 ) return 0;
+
+        char name[16];
+        int  size, count;
+        if( sscanf( (char*)buffer, "BENCH %15s %d %d", name, &size, &count ) != 3 )
+        {
+            fprintf( stderr, "%s: Unexpected message '%.40s'\n", __FUNCTION__, (char*)buffer );
+            continue;
+        }
+        int pattern = -1;
+        for( int p = 0; p < 3; p++ )
+        {
+            if( strcmp( name, pattern_names[p] ) == 0 ) pattern = p;
+        }
+        if( pattern < 0 || size < 1 || size > L4Payloadsize || count < 1 )
+        {
+            fprintf( stderr, "%s: Bad request '%.40s'\n", __FUNCTION__, (char*)buffer );
+            continue;
+        }
+
+        uint8_t data[L4Payloadsize];
+        memset( data, 0x5a, size );
+
+        unsigned long retransmits = l4sap_get_retransmits( l4 );
+        double        cpu         = cpu_us();
+
+        int retval = l4sap_send( l4, (uint8_t*)"READY", 6 );
+        if( retval < 0 ) return retval;
+
+        for( int i = 0; i < count; i++ )
+        {
+            if( pattern == PATTERN_DUPLEX )
+            {
+                retval = l4sap_send( l4, data, size );
+                if( retval < 0 ) return retval;
+            }
+
+            len = l4sap_recv( l4, buffer, L4Payloadsize );
+            if( len < 0 ) return len;
+
+            if( pattern == PATTERN_PINGPONG )
+            {
+                retval = l4sap_send( l4, buffer, len );
+                if( retval < 0 ) return retval;
+            }
+        }
+
+        len = l4sap_recv( l4, buffer, L4Payloadsize );
+        if( len < 0 ) return len;
+
+        snprintf( reply, sizeof(reply), "STATS %lu %.0f",
+                  l4sap_get_retransmits( l4 ) - retransmits, cpu_us() - cpu );
+        retval = l4sap_send( l4, (uint8_t*)reply, strlen(reply)+1 );
+        if( retval < 0 ) return retval;
+    }
+}
+
+static int server_main( int port, int window, int checksum, int ready_fd )
+{
+    L4SAP* l4 = l4sap_server_create( port );
+    if( !l4 )
+    {
+        fprintf( stderr, "%s: Failed to create server on port %d\n", __FUNCTION__, port );
+        return -1;
+    }
+    if( window > 1 && l4sap_set_window( l4, window ) < 0 )
+    {
+        fprintf( stderr, "%s: Failed to enable window mode\n", __FUNCTION__ );
+        l4sap_destroy( l4 );
+        return -1;
+    }
+    l2sap_set_checksum( l4->l2sap, checksum );
+
+    if( ready_fd >= 0 )
+    {
+        char c = 1;
+        if( write( ready_fd, &c, 1 ) != 1 ) perror( "write" );
+        close( ready_fd );
+    }
+
+    int retval = server_run( l4 );
+    l4sap_destroy( l4 );
+    return retval < 0 ? -1 : 0;
+}
+
+/* ---------------------------------------------------------------- */
+/* client                                                           */
+/* ---------------------------------------------------------------- */
+
+static void start_server( int port, int window, int checksum )
+{
+    int fds[2];
+    if( pipe( fds ) < 0 )
+    {
+        perror( "pipe" );
+        exit( -1 );
+    }
+
+    fflush( stdout );
+    server_pid = fork();
+    if( server_pid < 0 )
+    {
+        perror( "fork" );
+        exit( -1 );
+    }
+    if( server_pid == 0 )
+    {
+        close( fds[0] );
+        _exit( server_main( port, window, checksum, fds[1] ) < 0 ? 1 : 0 );
+    }
+
+    /* Wait until the server has bound its port */
+    char c;
+    close( fds[1] );
+    if( read( fds[0], &c, 1 ) != 1 ) fail( "starting the server", -1 );
+    close( fds[0] );
+}
+
+static void start_emulator( const char* self, int port, int server_port, double loss, double delay_ms )
+{
+    char path[PATH_MAX];
+    char copy[PATH_MAX];
+    snprintf( copy, sizeof(copy), "%s", self );
+    snprintf( path, sizeof(path), "%s/net-emulator", dirname( copy ) );
+
+    char port_arg[16], server_arg[16], loss_arg[32], delay_arg[32];
+    snprintf( port_arg,   sizeof(port_arg),   "%d", port );
+    snprintf( server_arg, sizeof(server_arg), "%d", server_port );
+    snprintf( loss_arg,   sizeof(loss_arg),   "%g", loss );
+    snprintf( delay_arg,  sizeof(delay_arg),  "%g", delay_ms );
+
+    fflush( stdout );
+    emulator_pid = fork();
+    if( emulator_pid < 0 )
+    {
+        perror( "fork" );
+        exit( -1 );
+    }
+    if( emulator_pid == 0 )
+    {
+        execl( path, path, "-l", loss_arg, "-D", delay_arg,
+               port_arg, "127.0.0.1", server_arg, (char*)NULL );
+        perror( path );
+        _exit( 1 );
+    }
+
+    /* net-emulator cannot tell us when it has bound its port. A datagram
+     * that arrives too early is lost and sent again by L4.
+     */
+    usleep( 100000 );
+}
+
+/* Stream mode keeps the send time of every message in latencies[] until
+ * its ACK is seen, and then replaces it with the latency. With a window,
+ * sent - l4sap_outstanding messages are acknowledged; without one,
+ * l4sap_send has already waited for the ACK. Returns the new number of
+ * acknowledged messages.
+ */
+static int stream_acked( L4SAP* l4, int sent, int acked, double* latencies )
+{
+    double t    = now();
+    int    done = sent - l4sap_outstanding( l4 );
+    for( ; acked < done; acked++ )
+    {
+        latencies[acked] = ( t - latencies[acked] ) * 1e6;
+    }
+    return acked;
+}
+
+/* Reads the ACKs that have already arrived, without blocking. The
+ * non-blocking functions are only used when there is a window, since
+ * they must not be mixed with stop-and-wait sends.
+ */
+static int stream_poll( L4SAP* l4 )
+{
+    if( l4sap_outstanding( l4 ) == 0 ) return 0;
+
+    int retval = l4sap_recv_nb( l4, NULL, 0 );
+    if( retval == L4_WOULD_BLOCK ) return 0;
+    return retval < 0 ? retval : 0;
+}
+
+/* Waits for the ACKs of the last messages in stream mode, retransmitting
+ * when the timer expires.
+ */
+static int stream_drain( L4SAP* l4, int count, int acked, double* latencies )
+{
+    while( acked < count )
+    {
+        struct timeval left;
+        int retval = l4sap_timer_nb( l4, &left );
+        if( retval < 0 ) return retval;
+
+        fd_set fds;
+        FD_ZERO( &fds );
+        FD_SET( l4->l2sap->socket, &fds );
+        if( select( l4->l2sap->socket + 1, &fds, NULL, NULL, retval == 1 ? &left : NULL ) < 0 )
+        {
+            perror( "select" );
+            return -1;
+        }
+
+        retval = stream_poll( l4 );
+        if( retval < 0 ) return retval;
+        acked = stream_acked( l4, count, acked, latencies );
+    }
+    return 0;
+}
+
+static int client_run( L4SAP* l4, Pattern pattern, int size, int count, double* latencies,
+                       RunResult* result )
+{
+    uint8_t buffer[L4Payloadsize+1];
+    uint8_t data[L4Payloadsize];
+    memset( data, 0xa5, size );
+
+    char request[64];
+    snprintf( request, sizeof(request), "BENCH %s %d %d", pattern_names[pattern], size, count );
+
+    int retval = l4sap_send( l4, (uint8_t*)request, strlen(request)+1 );
+    if( retval < 0 ) return retval;
+    int len = l4sap_recv( l4, buffer, L4Payloadsize );
+    if( len < 0 ) return len;
+
+    unsigned long retransmits = l4sap_get_retransmits( l4 );
+    double        cpu         = cpu_us();
+    double        start       = now();
+    int           acked       = 0;
+
+    for( int i = 0; i < count; i++ )
+    {
+        double t0 = now();
+
+        retval = l4sap_send( l4, data, size );
+        if( retval < 0 ) return retval;
+
+        if( pattern == PATTERN_STREAM )
+        {
+            latencies[i] = t0;
+            retval = stream_poll( l4 );
+            if( retval < 0 ) return retval;
+            acked = stream_acked( l4, i + 1, acked, latencies );
+            continue;
+        }
+
+        len = l4sap_recv( l4, buffer, L4Payloadsize );
+        if( len < 0 ) return len;
+
+        latencies[i] = ( now() - t0 ) * 1e6;
+    }
+
+    if( pattern == PATTERN_STREAM )
+    {
+        retval = stream_drain( l4, count, acked, latencies );
+        if( retval < 0 ) return retval;
+    }
+
+    /* The STATS reply comes after everything has been delivered */
+    retval = l4sap_send( l4, (uint8_t*)"DONE", 5 );
+    if( retval < 0 ) return retval;
+    len = l4sap_recv( l4, buffer, L4Payloadsize );
+    if( len < 0 ) return len;
+    buffer[len] = 0;
+
+    result->seconds            = now() - start;
+    result->client_cpu_us      = cpu_us() - cpu;
+    result->client_retransmits = l4sap_get_retransmits( l4 ) - retransmits;
+    if( sscanf( (char*)buffer, "STATS %lu %lf", &result->server_retransmits, &result->server_cpu_us ) != 2 )
+    {
+        fprintf( stderr, "%s: Unexpected reply '%.40s'\n", __FUNCTION__, (char*)buffer );
+        return -1;
+    }
+
+    result->size     = size;
+    result->messages = count;
+    result->bytes    = (double)size * count * ( pattern == PATTERN_STREAM ? 1 : 2 );
+
+    qsort( latencies, count, sizeof(double), compare_double );
+    result->p50_us  = percentile( latencies, count, 0.50 );
+    result->p99_us  = percentile( latencies, count, 0.99 );
+    result->p999_us = percentile( latencies, count, 0.999 );
+    result->max_us  = latencies[count - 1];
+    return 0;
+}
+
+static void write_json( FILE* out, Pattern pattern, int window, int checksum, int count,
+                        double delay_ms, const RunResult* results, int n )
+{
+    fprintf( out, "{\n" );
+    fprintf( out, "  \"benchmark\": \"transport\",\n" );
+    fprintf( out, "  \"pattern\": \"%s\",\n", pattern_names[pattern] );
+    fprintf( out, "  \"window\": %d,\n", window );
+    fprintf( out, "  \"checksum\": \"%s\",\n", checksum == L2_CHECKSUM_CRC32C ? "crc32c" : "xor" );
+    fprintf( out, "  \"count\": %d,\n", count );
+    fprintf( out, "  \"delay_ms\": %g,\n", delay_ms );
+    fprintf( out, "  \"runs\": [\n" );
+    for( int i = 0; i < n; i++ )
+    {
+        const RunResult* r = &results[i];
+        fprintf( out, "    {\n" );
+        fprintf( out, "      \"loss\": %g,\n", r->loss );
+        fprintf( out, "      \"size\": %d,\n", r->size );
+        fprintf( out, "      \"messages\": %d,\n", r->messages );
+        fprintf( out, "      \"seconds\": %.6f,\n", r->seconds );
+        fprintf( out, "      \"goodput_mb_per_sec\": %.6f,\n", r->bytes / r->seconds / 1e6 );
+        fprintf( out, "      \"messages_per_sec\": %.1f,\n", r->messages / r->seconds );
+        fprintf( out, "      \"latency_us\": { \"p50\": %.1f, \"p99\": %.1f, \"p99.9\": %.1f, \"max\": %.1f },\n",
+                 r->p50_us, r->p99_us, r->p999_us, r->max_us );
+        fprintf( out, "      \"retransmits\": { \"client\": %lu, \"server\": %lu },\n",
+                 r->client_retransmits, r->server_retransmits );
+        fprintf( out, "      \"cpu_ns_per_byte\": { \"client\": %.3f, \"server\": %.3f }\n",
+                 r->client_cpu_us * 1e3 / r->bytes, r->server_cpu_us * 1e3 / r->bytes );
+        fprintf( out, "    }%s\n", i + 1 < n ? "," : "" );
+    }
+    fprintf( out, "  ]\n" );
+    fprintf( out, "}\n" );
+}
+
+int main( int argc, char *argv[] )
+{
+    Pattern     pattern   = PATTERN_PINGPONG;
+    double      sizes[MAX_SIZES]   = { 64, 256, L4Payloadsize };
+    int         nsizes    = 3;
+    double      losses[MAX_LOSSES] = { 0 };
+    int         nlosses   = 1;
+    int         count     = 1000;
+    int         window    = 1;
+    int         checksum  = L2_CHECKSUM_XOR;
+    double      delay_ms  = 0;
+    int         port      = 5700;
+    int         serve     = 0;
+    const char* output    = NULL;
+    int opt;
+    while( ( opt = getopt( argc, argv, "p:m:n:w:cl:D:P:o:S:" ) ) != -1 )
+    {
+        switch( opt )
+        {
+        case 'p' :
+            pattern = (Pattern)-1;
+            for( int p = 0; p < 3; p++ )
+            {
+                if( strcmp( optarg, pattern_names[p] ) == 0 ) pattern = (Pattern)p;
+            }
+            if( (int)pattern < 0 ) usage( argv[0] );
+            break;
+        case 'm' :
+            nsizes = parse_list( optarg, sizes, MAX_SIZES );
+            break;
+        case 'n' :
+            count = atoi( optarg );
+            break;
+        case 'w' :
+            window = atoi( optarg );
+            break;
+        case 'c' :
+            checksum = L2_CHECKSUM_CRC32C;
+            break;
+        case 'l' :
+            nlosses = parse_list( optarg, losses, MAX_LOSSES );
+            break;
+        case 'D' :
+            delay_ms = atof( optarg );
+            break;
+        case 'P' :
+            port = atoi( optarg );
+            break;
+        case 'o' :
+            output = optarg;
+            break;
+        case 'S' :
+            serve = 1;
+            port  = atoi( optarg );
+            break;
+        default :
+            usage( argv[0] );
+        }
+    }
+
+    if( nsizes < 1 || nlosses < 1 || count < 1 || window < 1 || delay_ms < 0 ) usage( argv[0] );
+    for( int s = 0; s < nsizes; s++ )
+    {
+        if( sizes[s] < 1 || sizes[s] > L4Payloadsize ) usage( argv[0] );
+    }
+    for( int l = 0; l < nlosses; l++ )
+    {
+        if( losses[l] < 0 || losses[l] > 1 ) usage( argv[0] );
+    }
+
+    if( serve )
+    {
+        if( argc - optind != 0 ) usage( argv[0] );
+        return server_main( port, window, checksum, -1 );
+    }
+
+    const char* server_ip = NULL;
+    if( argc - optind == 2 )
+    {
+        server_ip = argv[optind];
+        port      = atoi( argv[optind+1] );
+        if( nlosses > 1 ) usage( argv[0] );
+    }
+    else if( argc - optind != 0 )
+    {
+        usage( argv[0] );
+    }
+
+    double*    latencies = (double*)malloc( count * sizeof(double) );
+    RunResult* results   = (RunResult*)calloc( nsizes * nlosses, sizeof(RunResult) );
+    if( latencies == NULL || results == NULL )
+    {
+        fprintf( stderr, "%s: Out of memory\n", __FUNCTION__ );
+        return -1;
+    }
+
+    int n = 0;
+    for( int l = 0; l < nlosses; l++ )
+    {
+        L4SAP* l4;
+        if( server_ip != NULL )
+        {
+            l4 = l4sap_create( server_ip, port );
+        }
+        else
+        {
+            /* A new server for every loss rate, since an L4 server
+             * serves only one client.
+             */
+            start_server( port + 1, window, checksum );
+            if( losses[l] > 0 || delay_ms > 0 )
+            {
+                start_emulator( argv[0], port, port + 1, losses[l], delay_ms );
+                l4 = l4sap_create( "127.0.0.1", port );
+            }
+            else
+            {
+                l4 = l4sap_create( "127.0.0.1", port + 1 );
+            }
+        }
+
+        if( window > 1 && l4sap_set_window( l4, window ) < 0 ) fail( "l4sap_set_window", -1 );
+        l2sap_set_checksum( l4->l2sap, checksum );
+
+        for( int s = 0; s < nsizes; s++ )
+        {
+            RunResult* r = &results[n++];
+            r->loss = losses[l];
+
+            fprintf( stderr, "%s: %s, %d x %d bytes, loss %g\n", __FUNCTION__,
+                     pattern_names[pattern], count, (int)sizes[s], losses[l] );
+
+            int retval = client_run( l4, pattern, (int)sizes[s], count, latencies, r );
+            if( retval < 0 )
+            {
+                l4sap_destroy( l4 );
+                fail( "client_run", retval );
+            }
+        }
+
+        l4sap_send( l4, (uint8_t*)"QUIT", 5 );
+        l4sap_destroy( l4 );
+
+        if( server_ip == NULL )
+        {
+            /* Give the server a second to see the QUIT before it is killed */
+            for( int i = 0; i < 100 && server_pid > 0; i++ )
+            {
+                if( waitpid( server_pid, NULL, WNOHANG ) == server_pid ) server_pid = -1;
+                else usleep( 10000 );
+            }
+            stop_children();
+        }
+    }
+
+    FILE* out = stdout;
+    if( output != NULL )
+    {
+        out = fopen( output, "w" );
+        if( out == NULL )
+        {
+            perror( output );
+            return -1;
+        }
+    }
+    write_json( out, pattern, window, checksum, count, delay_ms, results, n );
+    if( out != stdout ) fclose( out );
+
+    free( results );
+    free( latencies );
+    return 0;
+}
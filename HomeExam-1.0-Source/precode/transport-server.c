@@ -0,0 +1,114 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+
+#include "l4sap.h"
+
+/* A native counterpart to transport-test-server. It answers every
+ * message from transport-test-client with "Answering message: '<msg>' !"
+ * and terminates when the client sends "QUIT" or a RESET. Together with
+ * net-emulator it allows testing the L4 layer without the prebuilt
+ * servers.
+ */
+
+void usage( const char* name )
+{
+    fprintf( stderr, "Usage: %s [-w <window>] [-d <interval>] <port>\n"
+                     "       window   - optional, number of L4 packets in flight (default 1)\n"
+                     "       interval - optional, print the L2 and L4 counters to stdout every\n"
+                     "                  interval milliseconds and on exit\n"
+                     "       port     - This server's port\n", name );
+    exit( -1 );
+}
+
+int main( int argc, char *argv[] )
+{
+    int window   = 1;
+    int interval = 0;
+    int opt;
+    while( ( opt = getopt( argc, argv, "w:d:" ) ) != -1 )
+    {
+        switch( opt )
+        {
+        case 'w' :
+            window = atoi( optarg );
+            break;
+        case 'd' :
+            interval = atoi( optarg );
+            break;
+        default :
+            usage( argv[0] );
+        }
+    }
+
+    if( argc - optind != 1 ) usage( argv[0] );
+
+    L4SAP* l4 = l4sap_server_create( atoi(argv[optind]) );
+    if( !l4 )
+    {
+        fprintf( stderr, "%s: Failed to create server on port %s\n", __FUNCTION__, argv[optind] );
+        return -1;
+    }
+
+    if( window > 1 && l4sap_set_window( l4, window ) < 0 )
+    {
+        fprintf( stderr, "%s: Failed to enable window mode\n", __FUNCTION__ );
+        l4sap_destroy( l4 );
+        return -1;
+    }
+
+    if( interval > 0 ) l4sap_set_stats_dump( l4, STDOUT_FILENO, interval );
+
+    for( int round = 0; ; round++ )
+    {
+        char buffer[L4Payloadsize+1];
+        char response[L4Payloadsize];
+
+        fprintf( stderr, "\n%s: Waiting for data, round %d\n\n", __FUNCTION__, round );
+
+        int len = l4sap_recv( l4, (uint8_t*)buffer, L4Payloadsize );
+        if( len == L4_QUIT )
+        {
+            fprintf( stderr, "%s: Client reset the connection.\n", __FUNCTION__ );
+            break;
+        }
+        if( len < 0 )
+        {
+            fprintf( stderr, "%s: Failed to receive data\n", __FUNCTION__ );
+            continue;
+        }
+        buffer[len] = 0;
+
+        fprintf( stderr, "%s: Received %d bytes of data.\n", __FUNCTION__, len );
+
+        if( strcmp( buffer, "QUIT" ) == 0 )
+        {
+            fprintf( stderr, "%s: Client sent QUIT.\n", __FUNCTION__ );
+            break;
+        }
+
+        /* The response must fit in one L4 payload, so long messages are
+         * cut to leave room for the text around them.
+         */
+        int room = (int)sizeof(response) - (int)strlen( "Answering message: '' !" ) - 1;
+        snprintf( response, sizeof(response), "Answering message: '%.*s' !", room, buffer );
+        fprintf( stderr, "%s: Sending buffer: %s\n", __FUNCTION__, response );
+
+        int retval = l4sap_send( l4, (uint8_t*)response, strlen(response)+1 );
+        if( retval == L4_QUIT )
+        {
+            fprintf( stderr, "%s: Client reset the connection.\n", __FUNCTION__ );
+            break;
+        }
+        if( retval < 0 )
+        {
+            fprintf( stderr, "%s: Send failed. Giving up.\n", __FUNCTION__ );
+            l4sap_destroy( l4 );
+            return -1;
+        }
+    }
+
+    l4sap_destroy( l4 );
+    return 0;
+}
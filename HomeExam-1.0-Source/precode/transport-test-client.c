@@ -2,6 +2,7 @@
 #include <stdlib.h>
 #include <string.h>
 #include <sys/select.h>
+#include <unistd.h>
 
 #include "l4sap.h"
 
@@ -13,7 +14,8 @@ static int maxi( int a, int b )
 
 void usage( const char* name )
 {
-    fprintf( stderr, "Usage: %s <serverip> <port>\n"
+    fprintf( stderr, "Usage: %s [-w <window>] <serverip> <port>\n"
+                     "       window   - optional, number of L4 packets in flight (default 1)\n"
                      "       serverip - IPv4 address of the server in dotted decimal notation\n"
                      "       port     - The server's port\n" , name );
     exit( -1 );
@@ -22,15 +24,36 @@ void usage( const char* name )
 
 int main( int argc, char *argv[] )
 {
-    if( argc != 3 ) usage( argv[0] );
+    int window = 1;
+    int opt;
+    while( ( opt = getopt( argc, argv, "w:" ) ) != -1 )
+    {
+        switch( opt )
+        {
+        case 'w' :
+            window = atoi( optarg );
+            break;
+        default :
+            usage( argv[0] );
+        }
+    }
+
+    if( argc - optind != 2 ) usage( argv[0] );
 
-    L4SAP* l4 = l4sap_create( argv[1], atoi(argv[2]) );
+    L4SAP* l4 = l4sap_create( argv[optind], atoi(argv[optind+1]) );
     if( !l4 )
     {
         fprintf( stderr, "%s: Failed to create server\n", __FUNCTION__ );
         return -1;
     }
 
+    if( window > 1 && l4sap_set_window( l4, window ) < 0 )
+    {
+        fprintf( stderr, "%s: Failed to enable window mode\n", __FUNCTION__ );
+        l4sap_destroy( l4 );
+        return -1;
+    }
+
     for( int i=0; i<20; i++ )
     {
         fprintf( stderr, "\n%s: Round %d\n\n", __FUNCTION__, i );
@@ -63,6 +86,12 @@ int main( int argc, char *argv[] )
         }
         fprintf( stderr, "%s: l4sap_send returned with code %d\n", __FUNCTION__, retval );
 
+        long srtt, rto;
+        if( l4sap_get_rtt( l4, &srtt, NULL, &rto ) )
+        {
+            fprintf( stderr, "%s: srtt %ld us, rto %ld us\n", __FUNCTION__, srtt, rto );
+        }
+
         fprintf( stderr, "%s: waiting for data from server.\n", __FUNCTION__ );
         retval = l4sap_recv( l4, (uint8_t*)buffer, len );
         if( retval == L4_QUIT )